@@ -1,3 +1,14 @@
+#include "../atmosphere.glsl"
+
+// Sample is the scattering order, Layer is the first R slice of a partial inscattering dispatch
+layout(push_constant) uniform constants
+{
+    AtmosphereParameters Atmosphere;
+    int Sample;
+    int Layer;
+} PushConstants;
+
+#define ATMOSPHERE_PROFILE PushConstants.Atmosphere
 #include "../lighting.glsl"
 
 float DistanceToAtmosphere(float R, float Mu)
@@ -68,19 +79,26 @@ vec3 GetUV(ivec3 size, vec3 offset)
     return clamp(UV, 0.0, 1.0);
 }
 
+uvec3 GetInscatterTexel()
+{
+    return gl_GlobalInvocationID + uvec3(0, 0, PushConstants.Layer);
+}
+
 void UVWToWorldInscatter(out float R, out float CosViewZenith, out float CosSunZenith, out float CosViewun)
 {
-    R = float(gl_GlobalInvocationID.z) / (DIM_R - 1.0);
+    uvec3 Texel = GetInscatterTexel();
+
+    R = float(Texel.z) / (DIM_R - 1.0);
     // R = R * R;
-    R = sqrt(Rg * Rg + R * R * (Rt * Rt - Rg * Rg)) + (gl_GlobalInvocationID.z == 0 ? 0.01 : (gl_GlobalInvocationID.z == DIM_R - 1 ? -0.001 : 0.0));
+    R = sqrt(Rg * Rg + R * R * (Rt * Rt - Rg * Rg)) + (Texel.z == 0 ? 0.01 : (Texel.z == DIM_R - 1 ? -0.001 : 0.0));
 
     const float Dmin = Rt - R;
     const float Dmax = sqrt(R * R - Rg * Rg) + sqrt(Rt * Rt - Rg * Rg);
     const float Dminp = R - Rg;
     const float Dmaxp = sqrt(R * R - Rg * Rg);
 
-    float x = float(gl_GlobalInvocationID.x);
-    float y = float(gl_GlobalInvocationID.y);
+    float x = float(Texel.x);
+    float y = float(Texel.y);
 
     if (y < float(DIM_MU) * 0.5 - 1.0)
     {
@@ -0,0 +1,22 @@
+#ifndef _ATMOSPHERE_SHADER
+#define _ATMOSPHERE_SHADER
+
+/*
+* Scattering model of the current AtmosphereProfile, distances are in km
+* Mirrors AtmosphereParameters in structs.hpp
+*/
+struct AtmosphereParameters
+{
+    // xyz - Rayleigh scattering, w - Rayleigh scale height
+    vec4 Rayleigh;
+    // xyz - Mie scattering, w - Mie scale height
+    vec4 Mie;
+    // xyz - Mie extinction, w - Mie phase asymmetry
+    vec4 MieExtinction;
+    // xyz - ozone absorption, w - altitude of the ozone layer center
+    vec4 Ozone;
+    // x - ozone layer width, y - sun intensity
+    vec4 Light;
+};
+
+#endif
@@ -217,6 +217,17 @@ dvec3 RoundToIncrement(dvec3 value, float increment)
     return round(value * (1.0 / increment)) * increment;
 }
 
+// clipmap LUT layers are addressed toroidally, origin is in [0, Size) and moves with the level center
+ivec2 ToroidalTexel(ivec2 Texel, ivec2 Origin, int Size)
+{
+    return (Texel + Origin) % Size;
+}
+
+vec2 ToroidalUV(vec2 UV, ivec2 Origin, int Size)
+{
+    return UV + vec2(Origin) / float(Size);
+}
+
 float GetScatteringFactor(float CloudCoverage)
 {
     return saturate(0.1 + smoothstep(0.5, 1.0, saturate(1.0 - pow(CloudCoverage, 5.0) * 5.0)));
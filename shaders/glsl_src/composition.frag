@@ -2,6 +2,7 @@
 #include "ubo.glsl"
 #include "lighting.glsl"
 #include "brdf.glsl"
+#include "sh.glsl"
 
 layout(binding = 1) uniform sampler2D HDRColor;
 layout(binding = 2) uniform sampler2D HDRNormals;
@@ -10,7 +11,10 @@ layout(binding = 4) uniform sampler2D SceneDepth;
 layout(binding = 5) uniform sampler2D TransmittanceLUT;
 layout(binding = 6) uniform sampler2D IrradianceLUT;
 layout(binding = 7) uniform sampler3D InscatteringLUT;
-layout(binding = 8) uniform samplerCube DiffuseLUT;
+layout(std430, binding = 8) readonly buffer IrradianceBuffer
+{
+    vec4 Coefficients[9];
+} IrradianceSH;
 layout(binding = 9) uniform samplerCube SpecularLUT;
 layout(binding = 10) uniform sampler2D BRDFLUT;
 layout(binding = 11) uniform sampler3D CloudLowFrequency;
@@ -190,7 +194,7 @@ vec3 DirectSunlight(in vec3 Eye, in vec3 World, in vec3 View, in vec3 Sun, inout
     R = mix(N, R, (1.0f - A2) * (sqrt(1.0f - A2) + A2));
     vec3 reflection = textureLod(SpecularLUT, R, A2 * float(textureQueryLevels(SpecularLUT) - 1)).rgb;
     vec2 brdf  = texture(BRDFLUT, vec2(NdotV, A2)).rg;
-    vec3 irradiance = max(NdotL, 0.05) * (0.5 * Shadow + 0.25 * dFdx(Shadow) + 0.25 * dFdy(Shadow)) * texture(DiffuseLUT, N).rgb;
+    vec3 irradiance = max(NdotL, 0.05) * (0.5 * Shadow + 0.25 * dFdx(Shadow) + 0.25 * dFdy(Shadow)) * SHIrradiance(IrradianceSH.Coefficients, N);
 
     vec3 diffuse = Material.Albedo.rgb * irradiance;
     vec3 specular = reflection * (F * brdf.x + brdf.y);
@@ -14,24 +14,36 @@ float Rcb = Rg + 0.15 * Rdelta;
 float Rct = Rg + 0.85 * Rdelta;
 float Rcdelta = Rct - Rcb;
 
-const float HR = 8.0;
-const vec3 BetaR = vec3(5.8e-3, 1.35e-2, 3.31e-2);
-
-#if 0
-    // partly cloudy
-    const float HM = 3.0;
-    const vec3 BetaMSca = vec3(3e-3);
-    const vec3 BetaMEx = BetaMSca / 0.9;
-    const float MieG = 0.65;
+#ifdef ATMOSPHERE_PROFILE
+    // scattering model is set at runtime with SetAtmosphereProfile
+    #define HR ATMOSPHERE_PROFILE.Rayleigh.w
+    #define BetaR ATMOSPHERE_PROFILE.Rayleigh.xyz
+    #define HM ATMOSPHERE_PROFILE.Mie.w
+    #define BetaMSca ATMOSPHERE_PROFILE.Mie.xyz
+    #define BetaMEx ATMOSPHERE_PROFILE.MieExtinction.xyz
+    #define MieG ATMOSPHERE_PROFILE.MieExtinction.w
+    #define BetaOzone ATMOSPHERE_PROFILE.Ozone.xyz
+    #define OzoneCenter ATMOSPHERE_PROFILE.Ozone.w
+    #define OzoneWidth ATMOSPHERE_PROFILE.Light.x
+    #define MaxLightIntensity ATMOSPHERE_PROFILE.Light.y
 #else
+    // defaults of AtmosphereProfile, for shaders without access to the current one
+    const float HR = 8.0;
+    const vec3 BetaR = vec3(5.8e-3, 1.35e-2, 3.31e-2);
+
     // clear sky
     const float HM = 1.2;
     const vec3 BetaMSca = vec3(21e-3);
     const vec3 BetaMEx = BetaMSca / 0.9;
     const float MieG = 0.76;
+
+    const vec3 BetaOzone = vec3(0.0);
+    const float OzoneCenter = 25.0;
+    const float OzoneWidth = 30.0;
+
+    const float MaxLightIntensity = 50.0;
 #endif
 
-const float MaxLightIntensity = 50.0;
 const int DIM_MU = 128;
 const int DIM_MU_S = 32;
 const int DIM_R = 32;
@@ -24,6 +24,9 @@ vec4 Vertices[11] = {
     vec4(  0.0, 10.0, 0.0, 1.0)
 };
 
+// first vertex of the draw is the blade LOD
+const int LODOffset[3] = { 0, 27, 42 };
+
 int indices[45] = {
     // lod 0
     0,1,2, 0,2,3,
@@ -48,12 +51,17 @@ layout (constant_id = 6) const float Seed = 0;
 layout(set = 1, binding = 0) uniform sampler2DArray NoiseMap;
 layout (std140, set = 1, binding = 1) readonly buffer TerrainVertex{
 	Vertex at[];
-} vertices;
-layout (std140, set = 1, binding = 2) readonly buffer PositionsBuffer
+} verticesRef;
+// reference vertex and the jitter of the blade
+layout (std430, set = 1, binding = 2) readonly buffer InstanceBuffer
 {
-	ivec4 at[];
-} positions;
+	uvec2 at[];
+} instances;
 layout(set = 1, binding = 3) uniform sampler2D DepthMap;
+layout (std140, set = 1, binding = 4) readonly buffer TerrainOriginsBuffer
+{
+	ivec4 at[];
+} origins;
 
 layout(location = 0) out vec4 ObjectCenter;
 layout(location = 1) out vec4 FragNormal;
@@ -62,10 +70,13 @@ layout(location = 2) out vec3 SlopeNormal;
 void main()
 {
     ivec2 size = ivec2(textureSize(NoiseMap, 0));
-    Vertex vert = vertices.at[positions.at[gl_InstanceIndex / 4][gl_InstanceIndex % 4]];
-    float Level = vert.Position.w; // refine
+    uvec2 Record = instances.at[gl_InstanceIndex];
+    Vertex vert = verticesRef.at[Record.x];
+    float Level = vert.Position.y; // refine
+    ivec2 Origin = origins.at[int(Level)].xy;
+    vert.Position = vec4(texelFetch(NoiseMap, ivec3(ToroidalTexel(ivec2(round(vert.UV.xy * (size - 1))), Origin, size.x), Level), 0).yzw, Level);
 
-    vec4 dH = textureGather(NoiseMap, vec3(vert.UV.xy, Level), 0);
+    vec4 dH = textureGather(NoiseMap, vec3(ToroidalUV(vert.UV.xy, Origin, size.x), Level), 0);
     float Height = (dH.w - MinHeight) / (MaxHeight - MinHeight);
 
     float sampleScale = Scale * exp2(Level);
@@ -93,7 +104,7 @@ void main()
 
     mat3 Rot = mat3(ubo.PlanetMatrix);
     float anim = ubo.Wind * ubo.Time * 0.01;
-    vec2 hash = noise2(WorldUV);
+    vec2 hash = unpackSnorm2x16(Record.y);
 
     ObjectCenter.xyz = ObjectCenter.xyz + Rot * 0.5 * sampleScale * vec3(hash.x, 0.0, hash.y);
     vec4 CenterUV = vec4(ubo.ViewProjectionMatrix * vec4(ObjectCenter.xyz, 1.0));
@@ -107,7 +118,7 @@ void main()
     }
     else
     {
-        vec3 LocalPosition = Vertices[indices[gl_VertexIndex - gl_BaseVertex + (gl_DrawID == 2 || ubo.CameraRadius > Rg + MaxHeight ? 42 : (gl_DrawID == 1 ? 27 : 0))]].xyz;
+        vec3 LocalPosition = Vertices[indices[gl_VertexIndex - gl_BaseVertex + LODOffset[gl_BaseVertex]]].xyz;
         float AO = saturate(0.1 + LocalPosition.y / 10.0);
         
         LocalPosition = LocalPosition * vec2(5.0, 10.0).xyx;
@@ -0,0 +1,240 @@
+#include "ubo.glsl"
+#include "constants.glsl"
+#include "common.glsl"
+#include "noise.glsl"
+#include "hiz.glsl"
+
+layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+
+struct TerrainVertex
+{
+    vec4 Position;
+    vec4 UV;
+};
+
+struct IndirectCommand
+{
+    uint vertexCount;
+    uint instanceCount;
+    uint firstVertex;
+    uint firstInstance;
+};
+
+// one bucket and draw command per grass ring and blade LOD, a ring never has more visible blades than vertices
+layout (constant_id = 2) const uint RingsCount = 0;
+layout (constant_id = 3) const float Scale = 1.f;
+layout (constant_id = 4) const float MinHeight = 0;
+layout (constant_id = 5) const float MaxHeight = 0;
+layout (constant_id = 6) const uint InstanceCount = 0;
+
+// blade height in pixels below which the next, coarser blade is used
+const float LODPixels[2] = { 64.0, 16.0 };
+const float BladeHeight = 100.0;
+const uint GrassLODs = 3;
+const uint BladeVertices[GrassLODs] = { 27, 15, 3 };
+const uint BucketsCount = RingsCount * GrassLODs;
+
+layout(push_constant) uniform constants
+{
+    // view projection HiZ was built with, zero matrix disables the occlusion test
+    dmat4 ViewProjection;
+} PushConstants;
+
+layout (set = 1, binding = 0) uniform sampler2DArray NoiseMap;
+layout (std140, set = 1, binding = 1) readonly buffer TerrainReferenceBuffer
+{
+	TerrainVertex at[];
+} verticesRef;
+// reference vertex and the jitter of the blade
+layout (std430, set = 1, binding = 2) writeonly buffer InstanceBuffer
+{
+	uvec2 at[];
+} instances;
+layout (std430, set = 1, binding = 3) buffer IndirectBuffer
+{
+	IndirectCommand at[];
+} commands;
+layout (std140, set = 1, binding = 4) readonly buffer TerrainOriginsBuffer
+{
+	ivec4 at[];
+} origins;
+// accumulated during the dispatch, last workgroup moves them into the draw commands and resets them
+layout (std430, set = 1, binding = 5) coherent buffer CounterBuffer
+{
+	uint Finished;
+	uint Visible[];
+} counters;
+
+void BuildBox(vec3 CenterPosition, mat3 Rotation, out vec4 Box[8])
+{
+    const vec3 Corners[8] = {
+        vec3(-1.0, 0.0, -1.0),
+        vec3(1.0, 0.0, -1.0),
+        vec3(-1.0, 10.0, -1.0),
+        vec3(-1.0, 0.0, 1.0),
+        vec3(1.0, 10.0, -1.0),
+        vec3(-1.0, 10.0, 1.0),
+        vec3(1.0, 0.0, 1.0),
+        vec3(1.0, 10.0, 1.0),
+    };
+
+    for (int i = 0; i < 8; i++)
+    {
+        Box[i] = vec4(CenterPosition + Rotation * vec2(5.0, 10.0).xyx * Corners[i], 1.0);
+    }
+}
+
+bool Cull(vec4 Box[8])
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (dot(ubo.FrustumPlanes[i], Box[0]) < 0.0
+        && dot(ubo.FrustumPlanes[i], Box[1]) < 0.0
+        && dot(ubo.FrustumPlanes[i], Box[2]) < 0.0
+        && dot(ubo.FrustumPlanes[i], Box[3]) < 0.0
+        && dot(ubo.FrustumPlanes[i], Box[4]) < 0.0
+        && dot(ubo.FrustumPlanes[i], Box[5]) < 0.0
+        && dot(ubo.FrustumPlanes[i], Box[6]) < 0.0
+        && dot(ubo.FrustumPlanes[i], Box[7]) < 0.0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Occlude(vec4 Box[8])
+{
+    vec3 MinNDC = vec3(1.0);
+    vec3 MaxNDC = vec3(-1.0);
+
+    for (int i = 0; i < 8; i++)
+    {
+        dvec4 Clip = PushConstants.ViewProjection * dvec4(Box[i]);
+
+        // box crosses the near plane of the previous frame, nothing to compare with
+        if (Clip.w <= 0.0)
+        {
+            return false;
+        }
+
+        vec3 NDC = vec3(Clip.xyz / Clip.w);
+        MinNDC = min(MinNDC, NDC);
+        MaxNDC = max(MaxNDC, NDC);
+    }
+
+    // depth is reversed, box is hidden when even its closest point is behind every occluder of the previous frame
+    return MaxNDC.z < HiZRect(MinNDC.xy * 0.5 + 0.5, MaxNDC.xy * 0.5 + 0.5, ubo.Resolution).x;
+}
+
+uint BladeLOD(vec3 Position)
+{
+    if (ubo.CameraRadius > Rg + MaxHeight)
+    {
+        return 2u;
+    }
+
+    float Pixels = BladeHeight * abs(ubo.ProjectionMatrix[1][1]) * 0.5 * ubo.Resolution.y / max(distance(Position, ubo.CameraPosition.xyz), 1.0);
+    return Pixels >= LODPixels[0] ? 0u : (Pixels >= LODPixels[1] ? 1u : 2u);
+}
+
+void main()
+{
+    uint Instance = gl_GlobalInvocationID.x;
+    uint Bucket = BucketsCount;
+    uvec2 Record = uvec2(0u);
+
+    // no early return, every invocation takes part in the compaction and the barrier below
+    if (Instance < InstanceCount)
+    {
+        ivec2 size = ivec2(textureSize(NoiseMap, 0));
+        TerrainVertex reference = verticesRef.at[int(Instance)];
+        int Level = int(reference.Position.y);
+
+        TerrainVertex vertex;
+        ivec2 Texel = ToroidalTexel(ivec2(round(reference.UV.xy * (size - 1))), origins.at[Level].xy, size.x);
+        vertex.Position = vec4(texelFetch(NoiseMap, ivec3(Texel, Level), 0).yzw, Level);
+        vertex.UV = reference.UV;
+
+        vec2 WorldUV = vec2(0.0);
+        if (abs(vertex.Position.y) > abs(vertex.Position.x) && abs(vertex.Position.y) > abs(vertex.Position.z))
+        {
+            WorldUV = vertex.Position.xz;
+        }
+        else if (abs(vertex.Position.z) > abs(vertex.Position.x) && abs(vertex.Position.z) > abs(vertex.Position.y))
+        {
+            WorldUV = vertex.Position.xy;
+        }
+        else
+        {
+            WorldUV = vertex.Position.yz;
+        }
+
+        vec2 hash = noise2(WorldUV);
+        mat3 Rot = mat3(ubo.PlanetMatrix);
+        vec3 p = vertex.Position.xyz + Rot * 0.5 * Scale * exp2(Level) * vec3(hash.x, 0.0, hash.y);
+
+        vec4 Box[8];
+        BuildBox(p, Rot, Box);
+
+        if (Cull(Box) && !Occlude(Box))
+        {
+            Bucket = uint(Level) * GrassLODs + BladeLOD(p);
+            Record = uvec2(Instance, packSnorm2x16(hash));
+        }
+    }
+
+#ifdef SUBGROUP_COMPACTION
+    // reference vertices are ordered by level, so a subgroup rarely spans more than one ring and a few LODs
+    // every bucket it touches costs a single atomic, lanes write at their prefix inside the bucket
+    uint FirstBucket = subgroupMin(Bucket);
+    uint LastBucket = subgroupMax(Bucket < BucketsCount ? Bucket : 0u);
+
+    for (uint Current = FirstBucket; Current <= LastBucket && Current < BucketsCount; Current++)
+    {
+        uvec4 Ballot = subgroupBallot(Bucket == Current);
+        uint Count = subgroupBallotBitCount(Ballot);
+        if (Count == 0u)
+        {
+            continue;
+        }
+
+        uint Base = 0u;
+        if (subgroupElect())
+        {
+            Base = atomicAdd(counters.Visible[Current], Count);
+        }
+        Base = subgroupBroadcastFirst(Base);
+
+        if (Bucket == Current)
+        {
+            instances.at[commands.at[Current].firstInstance + Base + subgroupBallotExclusiveBitCount(Ballot)] = Record;
+        }
+    }
+#else
+    // devices without subgroup ballot and arithmetic in compute take a slot per visible blade
+    if (Bucket < BucketsCount)
+    {
+        uint Base = atomicAdd(counters.Visible[Bucket], 1u);
+        instances.at[commands.at[Bucket].firstInstance + Base] = Record;
+    }
+#endif
+
+    memoryBarrierBuffer();
+    barrier();
+
+    // last workgroup to finish publishes the counts, so nothing has to reset the commands before the next dispatch
+    if (gl_LocalInvocationIndex == 0u && atomicAdd(counters.Finished, 1u) == gl_NumWorkGroups.x - 1u)
+    {
+        for (uint Current = 0u; Current < BucketsCount; Current++)
+        {
+            // first vertex selects the blade geometry of the bucket
+            commands.at[Current].vertexCount = BladeVertices[Current % GrassLODs];
+            commands.at[Current].instanceCount = atomicExchange(counters.Visible[Current], 0u);
+            commands.at[Current].firstVertex = Current % GrassLODs;
+        }
+
+        counters.Finished = 0u;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _HIZ_SHADER
+#define _HIZ_SHADER
+
+/*
+* Conservative depth pyramid of the last finished deferred pass, built by hiz_build.comp
+* Bound with VulkanBase::m_HiZSets at set HIZ_SET, binding 0
+* r is the farthest and g the nearest depth under the texel, depth is reversed so 0.0 is the sky
+* Texel t of mip m covers depth texels [t * 2^(m + 1), (t + 1) * 2^(m + 1)), last texel of a mip also covers whatever is left
+*/
+#ifndef HIZ_SET
+#define HIZ_SET 2
+#endif
+
+layout(set = HIZ_SET, binding = 0) uniform sampler2D HiZ;
+
+ivec2 HiZTexel(vec2 UV, vec2 DepthSize, int Level)
+{
+    return min(ivec2(clamp(UV, 0.0, 1.0) * DepthSize) >> (Level + 1), textureSize(HiZ, Level) - 1);
+}
+
+// farthest and nearest depth of the texel covering UV at the given mip
+vec2 HiZPoint(vec2 UV, vec2 DepthSize, int Level)
+{
+    return texelFetch(HiZ, HiZTexel(UV, DepthSize, Level), Level).rg;
+}
+
+// farthest and nearest depth inside the screen rectangle, at most 2x2 texels are read
+vec2 HiZRect(vec2 MinUV, vec2 MaxUV, vec2 DepthSize)
+{
+    vec2 Extent = (clamp(MaxUV, 0.0, 1.0) - clamp(MinUV, 0.0, 1.0)) * DepthSize;
+    int Level = clamp(int(ceil(log2(max(max(Extent.x, Extent.y), 1.0)))) - 1, 0, textureQueryLevels(HiZ) - 1);
+
+    ivec2 MinTexel = HiZTexel(MinUV, DepthSize, Level);
+    ivec2 MaxTexel = HiZTexel(MaxUV, DepthSize, Level);
+
+    vec2 a = texelFetch(HiZ, MinTexel, Level).rg;
+    vec2 b = texelFetch(HiZ, ivec2(MaxTexel.x, MinTexel.y), Level).rg;
+    vec2 c = texelFetch(HiZ, ivec2(MinTexel.x, MaxTexel.y), Level).rg;
+    vec2 d = texelFetch(HiZ, MaxTexel, Level).rg;
+
+    return vec2(min(min(a.x, b.x), min(c.x, d.x)), max(max(a.y, b.y), max(c.y, d.y)));
+}
+
+#endif
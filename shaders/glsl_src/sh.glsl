@@ -0,0 +1,40 @@
+#ifndef _SH_SHADER
+#define _SH_SHADER
+
+/*
+* Diffuse sky light as order 2 real spherical harmonics, 9 rgb coefficients projected by sh_project.comp
+* Coefficients are already convolved with the clamped cosine lobe and divided by pi, so evaluating them gives irradiance / pi
+*/
+
+void SHBasis(vec3 n, out float Y[9])
+{
+    Y[0] = 0.282095;
+    Y[1] = 0.488603 * n.y;
+    Y[2] = 0.488603 * n.z;
+    Y[3] = 0.488603 * n.x;
+    Y[4] = 1.092548 * n.x * n.y;
+    Y[5] = 1.092548 * n.y * n.z;
+    Y[6] = 0.315392 * (3.0 * n.z * n.z - 1.0);
+    Y[7] = 1.092548 * n.x * n.z;
+    Y[8] = 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
+// cosine lobe convolution of every band divided by pi
+const float SHCosineBand[9] = float[9](1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25);
+
+vec3 SHIrradiance(vec4 SH[9], vec3 n)
+{
+    float Y[9];
+    SHBasis(n, Y);
+
+    vec3 Value = vec3(0.0);
+    for (int i = 0; i < 9; i++)
+    {
+        Value += SH[i].rgb * Y[i];
+    }
+
+    // ringing of the truncated series can go below zero opposite to the sun
+    return max(Value, 0.0);
+}
+
+#endif
@@ -7,16 +7,12 @@
 layout(location = 0) in vec4 WorldPosition;
 layout(location = 1) in vec4 NormalData;
 layout(location = 2) in float Height;
+layout(location = 3) in float Erosion;
 
 layout(location = 0) out vec4 outColor;
 layout(location = 1) out vec4 outNormal;
 layout(location = 2) out vec4 outDeferred;
 
-// float SampleWater(vec3 UVW)
-// {
-//     return max(textureLod(WaterMap, UVW, 0).r, textureLod(WaterMap, vec3(UVW.xy * 0.5 + 0.25, UVW.z + 1), 0).r);
-// }
-
 void main()
 {
     vec2 WorldUV = vec2(0.0);
@@ -29,5 +25,5 @@ void main()
 
     outColor = vec4(WorldUV, Height, 100.5);
     outNormal = NormalData;
-    outDeferred = vec4(0.0, 0.0, 0.0, 0.0);
+    outDeferred = vec4(Erosion, 0.0, 0.0, 0.0);
 }
\ No newline at end of file
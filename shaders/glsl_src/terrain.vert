@@ -15,14 +15,49 @@ layout(push_constant) uniform constants
     layout(offset = 32) mat3x4 Orientation;
 } PushConstants;
 
-layout(location = 0) in vec4 vertPosition;
-layout(location = 1) in vec4 vertUV;
+layout(location = 0) in ivec4 vertOffset;
 
 layout(location = 0) out vec4 WorldPosition;
 layout(location = 1) out vec4 NormalData;
 layout(location = 2) out float Height;
+layout(location = 3) out float Erosion;
 
 layout(set = 1, binding = 0) uniform sampler2DArray NoiseMap;
+layout(set = 1, binding = 1) uniform sampler2DArray WaterMap;
+layout (std140, set = 1, binding = 2) readonly buffer TerrainOriginsBuffer
+{
+	ivec4 at[];
+} origins;
+
+vec4 vertPosition;
+vec4 vertUV;
+
+int LevelStep(int Level)
+{
+    return Level == 0 ? 1 : 2 << Level;
+}
+
+// footprint is shared by instanced levels, vertex is found in the LUT of the level that owns it
+void FetchVertex()
+{
+    int Level = gl_InstanceIndex;
+    int Owner = Level - vertOffset.z;
+    int Extent = (textureSize(NoiseMap, 0).x - 1) / 2;
+
+    ivec2 Texel = Extent + vertOffset.xy * (LevelStep(Level) / LevelStep(Owner));
+
+    ivec3 LUTTexel = ivec3(ToroidalTexel(Texel, origins.at[Owner].xy, 2 * Extent + 1), Owner);
+
+    vertPosition = vec4(texelFetch(NoiseMap, LUTTexel, 0).yzw, float(Owner));
+    Erosion = 1.0 - exp(-texelFetch(WaterMap, LUTTexel, 0).r);
+    vertUV = vec4(vec2(Texel) / float(2 * Extent), 0.0, float(LevelStep(Owner) * Extent));
+}
+
+vec3 LevelUV(vec2 UV, float Level)
+{
+    ivec3 Size = textureSize(NoiseMap, 0);
+    return vec3(ToroidalUV(UV, origins.at[min(int(Level), Size.z - 1)].xy, Size.x), Level);
+}
 
 void GetNormalData(float vertexScale, inout vec4 dH)
 {
@@ -31,18 +66,18 @@ void GetNormalData(float vertexScale, inout vec4 dH)
     if (vertUV.x > 0.9 || vertUV.y > 0.9)
     {
         float f = smootherstep(0.0, 1.0, (max(vertUV.x, vertUV.y) - 0.9) / 0.1);
-        dH = mix(textureGather(NoiseMap, vec3(vertUV.xy, Level), 0), textureGather(NoiseMap, vec3(vertUV.xy * 0.5 + 0.25, Level + 1), 0), f);
+        dH = mix(textureGather(NoiseMap, LevelUV(vertUV.xy, Level), 0), textureGather(NoiseMap, LevelUV(vertUV.xy * 0.5 + 0.25, Level + 1), 0), f);
         vertexScale = mix(vertexScale, 2.0 * vertexScale, f);
     }
     else if (vertUV.x < 0.1 || vertUV.y < 0.1)
     {
         float f = smootherstep(0.0, 1.0, 1.0 - min(vertUV.x, vertUV.y) / 0.1);
-        dH = mix(textureGather(NoiseMap, vec3(vertUV.xy, Level), 0), textureGather(NoiseMap, vec3(vertUV.xy * 0.5 + 0.25, Level + 1), 0), f);
+        dH = mix(textureGather(NoiseMap, LevelUV(vertUV.xy, Level), 0), textureGather(NoiseMap, LevelUV(vertUV.xy * 0.5 + 0.25, Level + 1), 0), f);
         vertexScale = mix(vertexScale, 2.0 * vertexScale, f);
     }
     else
     {
-        dH = textureGather(NoiseMap, vec3(vertUV.xy, Level), 0);
+        dH = textureGather(NoiseMap, LevelUV(vertUV.xy, Level), 0);
     }
 
     float sampleScale = vertexScale * exp2(Level);
@@ -53,6 +88,8 @@ void GetNormalData(float vertexScale, inout vec4 dH)
 void main()
 {
     vec4 dH;
+    FetchVertex();
+
     float vertexScale = Scale * (ubo.CameraRadius - Rg > MaxHeight ? exp2(mix(5.0, 0.0, saturate(float(MaxHeight - MinHeight) / float(ubo.CameraRadius - Rg)))) : 1.0);
     GetNormalData(vertexScale, dH);
     
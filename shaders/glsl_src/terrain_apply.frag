@@ -111,6 +111,7 @@ void main()
         vec2 MaterialWeight = MaterialDescriptor.yw;
 
         float w_water = saturate(Height <= 2e-3 ? smoothstep(0.0, 1.0, 1.0 - Height / 2e-3) : 0.0);
+        float w_erosion = saturate(Descriptor2.x);
         const vec3 WaterColor = vec3(0.03, 0.03, 0.05);
 
         SMaterial Material, Material1, Material2;
@@ -129,6 +130,10 @@ void main()
             Material = Material1;
         }
 
+        // droplet flow leaves darker and smoother channels
+        Material.Albedo.rgb *= mix(1.0, 0.6, w_erosion);
+        Material.Roughness = mix(Material.Roughness, 0.5 * Material.Roughness, w_erosion);
+
         Material.Albedo.rgb = mix(Material.Albedo.rgb, WaterColor, w_water);
         Material.Roughness = max(mix(Material.Roughness, 0.0, w_water * w_water * w_water), 0.01);
         Material.AO = mix(Material.AO, 1.0, w_water);
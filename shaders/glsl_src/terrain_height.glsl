@@ -0,0 +1,147 @@
+#ifndef _TERRAIN_HEIGHT_SHADER
+#define _TERRAIN_HEIGHT_SHADER
+
+// expects MinHeight and MaxHeight constants, TerrainOctaves has to be defined by the including shader
+#include "constants.glsl"
+#include "common.glsl"
+#include "noise.glsl"
+
+struct TerrainLayer
+{
+    float Ea;
+    float Es;
+    float Ec;
+    int Octaves;
+    float Sharpness;
+    int Op;
+    float Frequency;
+    float Offset;
+};
+
+layout (std140, set = 1, binding = 1) readonly buffer TerrainLayersBuffer
+{
+    layout(offset = 0) int Count;
+    layout(offset = 4) float TileScale;
+    layout(offset = 16) TerrainLayer at[];
+} Layers;
+
+float TerrainOctaves(TerrainLayer Setting, int level);
+
+float terrain_fbm(vec3 n, vec2 uv, int layer, int level)
+{
+    TerrainLayer Setting = Layers.at[layer];
+
+    float fbm = 0.0;
+    float Ampltude = 1.0;
+    float GainA = 0.54;
+    float GainF = 2.0;
+    float freq = Setting.Frequency;
+    float oct = TerrainOctaves(Setting, level);
+
+    float AltitudeF = Ampltude;
+    float SlopeF = Ampltude;
+
+    vec2 Gp = vec2(0.0);
+    for (int i = 0; i < oct; i++)
+    {
+        float Np = 0.0;
+        vec2 DNp = vec2(0.0);
+        vec2 DNp2 = vec2(0.0);
+        perlind(uv, freq, Np, DNp, DNp2);
+        Np = saturateAngle((Setting.Offset + Np));
+
+        float gi = mix( GainA, GainA * (1.0 / (1.0 + abs( min(0.0, 0.5 * (DNp2.x + DNp2.y)) ))), Setting.Ec );
+        Gp = Gp + DNp * Setting.Es;
+        SlopeF = 1.0 / (1.0 + dot(Gp, Gp));
+        AltitudeF *= mix(gi, gi * max(0.0, Np), Setting.Ea);
+        Ampltude *= GainA;
+        freq *= GainF;
+
+        fbm += SlopeF * AltitudeF * Np;
+
+        GainF *= 1.025;
+        NOISE_SEED++;
+    }
+
+    fbm = Setting.Sharpness >= 0 ? mix(fbm, 1.0 - abs(fbm), Setting.Sharpness) : mix(fbm, abs(fbm), abs(Setting.Sharpness));
+
+    if (abs(Setting.Op) == 1)
+    {
+        if (Setting.Op < 0)
+            fbm = 1.0 - fbm;
+    }
+    else if (abs(Setting.Op) == 2)
+    {
+        if (Setting.Op > 0)
+            fbm = smoothstep(0.0, 1.0, fbm);
+        else
+            fbm = 1.0 - smoothstep(0.0, 1.0, fbm);
+    }
+    else if (abs(Setting.Op) == 3)
+    {
+        if (Setting.Op > 0)
+            fbm = ridge_smoothstep(0.0, 1.0, fbm);
+        else
+            fbm = 1.0 - ridge_smoothstep(0.0, 1.0, fbm);
+    }
+
+    return fbm;
+}
+
+// NOISE_SEED has to be reset to the terrain seed before every call
+float TerrainHeight(vec3 Normal, int Level)
+{
+    float pole = abs(dot(Normal, vec3(0, 1, 0)));
+    vec2 uv1 = 0.5 + vec2(atan(Normal.z, Normal.x) * ONE_OVER_2PI, asin(Normal.y) * ONE_OVER_2PI);
+    vec2 uv2 = 0.5 + vec2(atan(Normal.x, Normal.y) * ONE_OVER_2PI, asin(Normal.z) * ONE_OVER_2PI);
+    float pole_w = pole > 0.9 ? 0.0 : (pole >= 0.7 ? 1.0 - ((pole - 0.7) / (0.9 - 0.7)) : 1.0);
+
+    float T1 = pole_w != 0.0 ? terrain_fbm(Normal, uv1, 0, Level) : 0.0;
+    float T2 = pole_w != 1.0 ? terrain_fbm(Normal, uv2, 0, Level) : 0.0;
+
+    float f1 = 0.5, f2 = 0.5;
+    for (int layer = 1; layer < Layers.Count; layer++)
+    {
+        NOISE_SEED += layer * layer * layer;
+
+        if (pole_w != 0.0)
+        {
+            f1 = smootherstep(0.0, 1.0, 1.0 - fbm_worley(uv1, Layers.TileScale, 3));
+            f1 = smootherstep(0.0, 1.0, smootherstep(0.0, 1.0, f1));
+            T1 = (1.0 - f1) * T1 + f1 * terrain_fbm(Normal, uv1, layer, Level);
+        }
+
+        if (pole_w != 1.0)
+        {
+            f2 = smootherstep(0.0, 1.0, 1.0 - fbm_worley(uv2, Layers.TileScale, 3));
+            f2 = smootherstep(0.0, 1.0, smootherstep(0.0, 1.0, f2));
+            T2 = (1.0 - f2) * T2 + f2 * terrain_fbm(Normal, uv2, layer, Level); 
+        }
+    }
+
+    return floor(MinHeight + saturate(mix(T2, T1, pole_w)) * (MaxHeight - MinHeight));
+}
+
+// major axis times two, plus one for negative direction, same as TerrainCache::CubeFace
+int CubeFace(vec3 Direction, out vec2 UV)
+{
+    vec3 a = abs(Direction);
+    int axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+
+    vec2 plane = axis == 0 ? Direction.yz : (axis == 1 ? Direction.zx : Direction.xy);
+    UV = clamp(0.5 + 0.5 * plane / a[axis], 0.0, 1.0);
+
+    return axis * 2 + (Direction[axis] < 0.0 ? 1 : 0);
+}
+
+vec3 CubeDirection(int Face, vec2 UV)
+{
+    int axis = Face / 2;
+    vec2 plane = 2.0 * UV - 1.0;
+    float major = (Face & 1) == 0 ? 1.0 : -1.0;
+
+    vec3 Direction = axis == 0 ? vec3(major, plane.x, plane.y) : (axis == 1 ? vec3(plane.y, major, plane.x) : vec3(plane.x, plane.y, major));
+    return normalize(Direction);
+}
+
+#endif
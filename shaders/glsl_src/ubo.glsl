@@ -1,6 +1,8 @@
 #ifndef _UBO_SHADER
 #define _UBO_SHADER
 
+#include "atmosphere.glsl"
+
 layout(set = 0, binding = 0) uniform UnfiormBuffer
 {
     dmat4 ReprojectionMatrix;
@@ -25,6 +27,9 @@ layout(set = 0, binding = 0) uniform UnfiormBuffer
     float Gamma;
     float Exposure;
     vec4 FrustumPlanes[6];
+    AtmosphereParameters Atmosphere;
 } ubo;
 
+#define ATMOSPHERE_PROFILE ubo.Atmosphere
+
 #endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "pch.hpp"
+#include "atmosphere_cache.hpp"
+#include "mapped_file.hpp"
+#include "utils.hpp"
+#include <filesystem>
+
+namespace GR
+{
+	AtmosphereCache::Key AtmosphereCache::MakeKey(float Rg, float Rt, const std::vector<std::string>& shaders)
+	{
+		Key key{};
+		key.Rg = Rg;
+		key.Rt = Rt;
+
+		uint64_t hash = 0u;
+		for (const std::string& name : shaders)
+		{
+			MappedFile file("shaders\\" + name + ".spv");
+			if (file.Size() == 0u)
+				return key;
+
+			hash = Utils::Hash64(file.Data(), file.Size(), hash);
+		}
+
+		key.ShaderHash = hash;
+		return key;
+	}
+
+	size_t AtmosphereCache::DataSize(const std::vector<Table>& tables)
+	{
+		size_t size = 0u;
+		for (const Table& table : tables)
+			size += size_t(table.Width) * table.Height * table.Depth * table.TexelSize;
+
+		return size;
+	}
+
+	bool AtmosphereCache::Load(const std::string& path, const Key& key, const std::vector<Table>& tables, void* outData)
+	{
+		if (key.ShaderHash == 0u)
+			return false;
+
+		MappedFile file(path);
+		if (file.Size() < sizeof(Header))
+			return false;
+
+		Header header{};
+		memcpy(&header, file.Data(), sizeof(Header));
+
+		if (header.Magic != Magic || header.Version != Version || memcmp(&header.Source, &key, sizeof(Key)) != 0 || header.TableCount != tables.size())
+			return false;
+
+		const size_t dataOffset = sizeof(Header) + sizeof(Table) * tables.size();
+		if (file.Size() != dataOffset + DataSize(tables) || memcmp(file.Data() + sizeof(Header), tables.data(), sizeof(Table) * tables.size()) != 0)
+			return false;
+
+		memcpy(outData, file.Data() + dataOffset, DataSize(tables));
+		return true;
+	}
+
+	bool AtmosphereCache::Store(const std::string& path, const Key& key, const std::vector<Table>& tables, const void* data)
+	{
+		if (key.ShaderHash == 0u)
+			return false;
+
+		Header header{};
+		header.Source = key;
+		header.TableCount = static_cast<uint32_t>(tables.size());
+
+		std::error_code err;
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), err);
+
+		// write into temporary file first, so interrupted write never leaves valid looking cache
+		const std::string temp = path + ".tmp";
+		bool written = false;
+		{
+			std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			file.write(reinterpret_cast<const char*>(tables.data()), sizeof(Table) * tables.size());
+			file.write(reinterpret_cast<const char*>(data), DataSize(tables));
+
+			written = file.good();
+		}
+
+		if (written)
+		{
+			std::filesystem::rename(temp, path, err);
+		}
+
+		// partial file is never left behind
+		if (!written || err)
+		{
+			std::filesystem::remove(temp, err);
+			return false;
+		}
+
+		return true;
+	}
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include "core.hpp"
+/*
+* Binary cache of precomputed atmosphere tables, they only depend on the planet and the scattering model
+*/
+namespace GR
+{
+	namespace AtmosphereCache
+	{
+		static constexpr uint32_t Magic = 0x43415247; // "GRAC"
+		static constexpr uint32_t Version = 2u;
+		/*
+		* !@brief Values which invalidate the cache file when changed
+		*/
+		struct Key
+		{
+			float Rg = 0.f;
+			float Rt = 0.f;
+			// sample counts are compiled into the precompute shaders
+			uint64_t ShaderHash = 0u;
+			// scattering model the tables are computed with
+			uint64_t ProfileHash = 0u;
+		};
+		/*
+		* !@brief Size of a single table, texels are tightly packed
+		*/
+		struct Table
+		{
+			uint32_t Width = 0u;
+			uint32_t Height = 0u;
+			uint32_t Depth = 0u;
+			uint32_t TexelSize = 0u;
+		};
+		/*
+		* !@brief File layout: Header, Table[TableCount], texels of every table in the same order
+		*/
+		struct Header
+		{
+			uint32_t Magic = AtmosphereCache::Magic;
+			uint32_t Version = AtmosphereCache::Version;
+			Key Source = {};
+			uint32_t TableCount = 0u;
+			uint32_t Padding = 0u;
+		};
+		/*
+		* !@brief Collect values the cache depends on
+		*
+		* @param[in] Rg - planet radius
+		* @param[in] Rt - atmosphere radius
+		* @param[in] shaders - names of the compiled shaders the tables are computed with
+		*
+		* @return Cache key, ShaderHash is 0 if any shader is missing
+		*/
+		Key MakeKey(float Rg, float Rt, const std::vector<std::string>& shaders);
+		/*
+		* !@brief Total size of the texels of all tables
+		*/
+		size_t DataSize(const std::vector<Table>& tables);
+		/*
+		* !@brief Read stored texels
+		*
+		* @param[in] path - path to cache file
+		* @param[in] key - expected cache key
+		* @param[in] tables - expected tables
+		* @param[out] outData - DataSize(tables) bytes, usually mapped staging memory
+		*
+		* @return False if the cache is missing, stale or damaged
+		*/
+		bool Load(const std::string& path, const Key& key, const std::vector<Table>& tables, void* outData);
+		/*
+		* !@brief Write texels of all tables into cache file
+		*
+		* @param[in] data - DataSize(tables) bytes
+		*
+		* @return True if the file was written
+		*/
+		bool Store(const std::string& path, const Key& key, const std::vector<Table>& tables, const void* data);
+	};
+};
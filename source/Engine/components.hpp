@@ -5,6 +5,7 @@
 #include "Engine/enums.hpp"
 #include "Engine/structs.hpp"
 #include "glm/gtx/quaternion.hpp"
+#include "entt/entt.hpp"
 /*
 * List of engine-specific components
 */
@@ -340,7 +341,52 @@ namespace GR
 		{
 			float Value = 1e6f;
 		};
+		/*
+		* !@brief Level of detail selection, level i switches to i + 1 once projected size of the bounds drops below ScreenSize[i]
+		*/
+		struct LODGroup
+		{
+			static constexpr uint32_t MaxLevels = 8u;
+
+			// Fraction of the screen height covered by bounding sphere
+			std::array<float, MaxLevels - 1> ScreenSize = { 0.5f, 0.25f, 0.125f, 0.0625f, 0.03125f, 0.015625f, 0.0078125f };
+			// Relative margin around each threshold, prevents popping back and forth at the boundary
+			float Hysteresis = 0.1f;
+			// Number of levels available in the mesh, set by the renderer
+			uint32_t Levels = 1u;
+			uint32_t Current = 0u;
+
+			GRAPI uint32_t Select(float Size)
+			{
+				while (Current + 1 < Levels && Size < ScreenSize[Current] * (1.f - Hysteresis))
+					Current++;
+
+				while (Current > 0 && Size > ScreenSize[Current - 1] * (1.f + Hysteresis))
+					Current--;
+
+				return Current = std::min(Current, Levels - 1);
+			}
+		};
 
 		using WorldMatrix = TransformMatrix<float, double>;
+		/*
+		* !@brief Transform relative to the parent entity, only used by entities with Relationship component
+		*/
+		struct LocalMatrix : TransformMatrix<float, double>
+		{
+
+		};
+		/*
+		* !@brief Scene graph link, entities with this component get their WorldMatrix from parent's WorldMatrix and LocalMatrix
+		*/
+		struct Relationship
+		{
+			entt::entity Parent = entt::null;
+			uint32_t Depth = 0;
+			// Set when LocalMatrix was modified, WorldMatrix of the whole subtree is recomputed on next update
+			bool Dirty = true;
+			// Set by the update pass when WorldMatrix was rewritten this frame
+			bool Changed = false;
+		};
 	};
 };
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "pch.hpp"
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+namespace GR
+{
+	MappedFile::MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		// writers may keep appending to the file while it is mapped
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+
+		m_File = file;
+
+		LARGE_INTEGER size{};
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+			return;
+
+		m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_Mapping == nullptr)
+			return;
+
+		m_Data = MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+		m_Size = m_Data ? static_cast<size_t>(size.QuadPart) : 0u;
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+
+		struct stat st{};
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED)
+			{
+				m_Data = data;
+				m_Size = static_cast<size_t>(st.st_size);
+			}
+		}
+
+		close(fd);
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+#ifdef _WIN32
+		if (m_Data)
+			UnmapViewOfFile(m_Data);
+
+		if (m_Mapping)
+			CloseHandle(m_Mapping);
+
+		if (m_File)
+			CloseHandle(m_File);
+#else
+		if (m_Data)
+			munmap(m_Data, m_Size);
+#endif
+	}
+};
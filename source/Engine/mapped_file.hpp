@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+/*
+* Read-only view of the whole file, unmapped on destruction
+*/
+namespace GR
+{
+	class MappedFile
+	{
+	public:
+		MappedFile(const std::string& path);
+
+		~MappedFile();
+
+		MappedFile(const MappedFile& other) = delete;
+
+		void operator=(const MappedFile& other) = delete;
+
+		const uint8_t* Data() const { return static_cast<const uint8_t*>(m_Data); };
+
+		size_t Size() const { return m_Size; };
+
+	private:
+		void* m_Data = nullptr;
+		size_t m_Size = 0u;
+#ifdef _WIN32
+		void* m_File = nullptr;
+		void* m_Mapping = nullptr;
+#endif
+	};
+};
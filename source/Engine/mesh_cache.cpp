@@ -0,0 +1,174 @@
+#include "pch.hpp"
+#include "mesh_cache.hpp"
+#include "mapped_file.hpp"
+#include <filesystem>
+
+namespace GR
+{
+	MeshCache::Key MeshCache::MakeKey(const std::string& source, uint32_t LODCount, float LODReduction, bool Optimized, bool Packed)
+	{
+		Key key{};
+		key.LODCount = LODCount;
+		key.LODReduction = LODReduction;
+		key.Optimized = Optimized ? 1u : 0u;
+		key.Packed = Packed ? 1u : 0u;
+
+		std::error_code err;
+		key.SourceSize = std::filesystem::file_size(source, err);
+		if (err)
+		{
+			key.SourceSize = 0u;
+			return key;
+		}
+
+		key.SourceTime = static_cast<int64_t>(std::filesystem::last_write_time(source, err).time_since_epoch().count());
+		return key;
+	}
+
+	std::unique_ptr<VulkanMesh> MeshCache::Load(const RenderScope& Scope, const std::string& path, const Key& key, Shapes::GeometryDescriptor* Geometry)
+	{
+		MappedFile file(path);
+		if (file.Size() < sizeof(Header))
+			return nullptr;
+
+		Header header{};
+		memcpy(&header, file.Data(), sizeof(Header));
+
+		const uint32_t stride = key.Packed ? sizeof(PackedMeshVertex) : sizeof(MeshVertex);
+		if (header.Magic != Magic || header.Version != Version || header.VertexStride != stride || header.Source.Packed != key.Packed
+			|| header.Source.SourceSize != key.SourceSize || header.Source.SourceTime != key.SourceTime
+			|| header.Source.LODCount != key.LODCount || header.Source.LODReduction != key.LODReduction || header.Source.Optimized != key.Optimized)
+			return nullptr;
+
+		const size_t submeshOffset = sizeof(Header);
+		const size_t lodOffset = submeshOffset + sizeof(Submesh) * header.SubmeshCount;
+		const size_t vertexOffset = lodOffset + sizeof(VulkanMesh::LOD) * header.LODCount;
+		const size_t indexOffset = vertexOffset + size_t(header.VertexStride) * header.VertexCount;
+
+		const uint32_t indexStride = header.VertexCount < UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+		if (header.LODCount == 0u || header.IndexStride != indexStride || file.Size() != indexOffset + size_t(header.IndexStride) * header.IndexCount)
+			return nullptr;
+
+		// damaged or mismatched file must not turn into out of bounds draws
+		std::vector<VulkanMesh::LOD> levels(header.LODCount);
+		memcpy(levels.data(), file.Data() + lodOffset, sizeof(VulkanMesh::LOD) * header.LODCount);
+
+		for (const VulkanMesh::LOD& level : levels)
+		{
+			if (size_t(level.firstIndex) + level.indexCount > header.IndexCount)
+				return nullptr;
+		}
+
+		std::vector<Submesh> submeshes(header.SubmeshCount);
+		memcpy(submeshes.data(), file.Data() + submeshOffset, sizeof(Submesh) * header.SubmeshCount);
+
+		for (const Submesh& submesh : submeshes)
+		{
+			if (size_t(submesh.FirstIndex) + submesh.IndexCount > levels[0].indexCount)
+				return nullptr;
+		}
+
+		const uint8_t* indexData = file.Data() + indexOffset;
+		for (size_t i = 0; i < header.IndexCount; i++)
+		{
+			uint32_t index = 0u;
+			memcpy(&index, indexData + i * header.IndexStride, header.IndexStride);
+			if (index >= header.VertexCount)
+				return nullptr;
+		}
+
+		// mapped data goes straight into staging copy
+		void* vertices = const_cast<uint8_t*>(file.Data() + vertexOffset);
+		void* indices = const_cast<uint8_t*>(file.Data() + indexOffset);
+
+		std::unique_ptr<VulkanMesh> mesh;
+		if (key.Packed && header.IndexStride == sizeof(uint16_t))
+		{
+			mesh = std::make_unique<VulkanMesh>(Scope, static_cast<PackedMeshVertex*>(vertices), header.VertexCount, static_cast<uint16_t*>(indices), header.IndexCount, header.Min, header.Max);
+		}
+		else if (key.Packed)
+		{
+			mesh = std::make_unique<VulkanMesh>(Scope, static_cast<PackedMeshVertex*>(vertices), header.VertexCount, static_cast<uint32_t*>(indices), header.IndexCount, header.Min, header.Max);
+		}
+		else if (header.IndexStride == sizeof(uint16_t))
+		{
+			mesh = std::make_unique<VulkanMesh>(Scope, static_cast<MeshVertex*>(vertices), header.VertexCount, static_cast<uint16_t*>(indices), header.IndexCount);
+		}
+		else
+		{
+			mesh = std::make_unique<VulkanMesh>(Scope, static_cast<MeshVertex*>(vertices), header.VertexCount, static_cast<uint32_t*>(indices), header.IndexCount);
+		}
+
+		mesh->SetLODs(std::move(levels));
+
+		if (Geometry)
+		{
+			Geometry->Min = header.Min;
+			Geometry->Max = header.Max;
+			Geometry->Center = (Geometry->Min + Geometry->Max) * 0.5f;
+			Geometry->Radius = glm::length(Geometry->Max - Geometry->Center);
+			Geometry->Submeshes = std::move(submeshes);
+		}
+
+		return mesh;
+	}
+
+	bool MeshCache::Store(const std::string& path, const Key& key, const void* vertices, uint32_t vertexStride, size_t vertexCount, const std::vector<uint32_t>& indices,
+		const std::vector<VulkanMesh::LOD>& levels, const std::vector<Submesh>& submeshes, const glm::vec3& Min, const glm::vec3& Max)
+	{
+		if (key.SourceSize == 0u)
+			return false;
+
+		Header header{};
+		header.VertexStride = vertexStride;
+		header.IndexStride = vertexCount < UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+		header.Source = key;
+		header.VertexCount = static_cast<uint32_t>(vertexCount);
+		header.IndexCount = static_cast<uint32_t>(indices.size());
+		header.SubmeshCount = static_cast<uint32_t>(submeshes.size());
+		header.LODCount = static_cast<uint32_t>(levels.size());
+		header.Min = Min;
+		header.Max = Max;
+
+		// write into temporary file first, so interrupted write never leaves valid looking cache
+		const std::string temp = path + ".tmp";
+		bool written = false;
+		{
+			std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			file.write(reinterpret_cast<const char*>(submeshes.data()), sizeof(Submesh) * submeshes.size());
+			file.write(reinterpret_cast<const char*>(levels.data()), sizeof(VulkanMesh::LOD) * levels.size());
+			file.write(reinterpret_cast<const char*>(vertices), size_t(vertexStride) * vertexCount);
+
+			if (header.IndexStride == sizeof(uint16_t))
+			{
+				std::vector<uint16_t> indices16(indices.begin(), indices.end());
+				file.write(reinterpret_cast<const char*>(indices16.data()), sizeof(uint16_t) * indices16.size());
+			}
+			else
+			{
+				file.write(reinterpret_cast<const char*>(indices.data()), sizeof(uint32_t) * indices.size());
+			}
+
+			written = file.good();
+		}
+
+		std::error_code err;
+		if (written)
+		{
+			std::filesystem::rename(temp, path, err);
+		}
+
+		// partial file is never left behind
+		if (!written || err)
+		{
+			std::filesystem::remove(temp, err);
+			return false;
+		}
+
+		return true;
+	}
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include "core.hpp"
+#include "Engine/shapes.hpp"
+/*
+* Binary cache of imported meshes, stored next to the source file
+*/
+namespace GR
+{
+	namespace MeshCache
+	{
+		static constexpr uint32_t Magic = 0x434D5247; // "GRMC"
+		static constexpr uint32_t Version = 2u;
+		/*
+		* !@brief Values which invalidate the cache file when changed
+		*/
+		struct Key
+		{
+			uint64_t SourceSize = 0u;
+			int64_t SourceTime = 0;
+			uint32_t LODCount = 1u;
+			float LODReduction = 0.5f;
+			uint32_t Optimized = 0u;
+			uint32_t Packed = 0u;
+		};
+		using Submesh = Shapes::Submesh;
+		/*
+		* !@brief File layout: Header, Submesh[SubmeshCount], VulkanMesh::LOD[LODCount], vertices, indices
+		*/
+		struct Header
+		{
+			uint32_t Magic = MeshCache::Magic;
+			uint32_t Version = MeshCache::Version;
+			uint32_t VertexStride = 0u;
+			uint32_t IndexStride = 0u;
+			Key Source = {};
+			uint32_t VertexCount = 0u;
+			uint32_t IndexCount = 0u;
+			uint32_t SubmeshCount = 0u;
+			uint32_t LODCount = 0u;
+			glm::vec3 Min = glm::vec3(0.0);
+			glm::vec3 Max = glm::vec3(0.0);
+		};
+		/*
+		* !@brief Collect values the cache depends on
+		*
+		* @param[in] source - path to the original model file
+		* @param[in] LODCount - requested number of levels of detail
+		* @param[in] LODReduction - fraction of triangles kept by each next level
+		* @param[in] Optimized - whether mesh was reordered for vertex cache and fetch
+		* @param[in] Packed - whether vertices are stored as PackedMeshVertex
+		*
+		* @return Cache key, SourceSize is 0 if source file is missing
+		*/
+		Key MakeKey(const std::string& source, uint32_t LODCount, float LODReduction, bool Optimized, bool Packed);
+		/*
+		* !@brief Map cache file into memory and upload its content
+		*
+		* @param[in] Scope - render scope to create the mesh in
+		* @param[in] path - path to cache file
+		* @param[in] key - expected cache key
+		* @param[out] outGeometry - bounds and submesh table of the mesh, if given
+		*
+		* @return Uploaded mesh or nullptr if the cache is missing, stale or damaged
+		*/
+		std::unique_ptr<VulkanMesh> Load(const RenderScope& Scope, const std::string& path, const Key& key, Shapes::GeometryDescriptor* outGeometry);
+		/*
+		* !@brief Write imported mesh into cache file, indices are stored in the same width they are uploaded with
+		*
+		* @param[in] vertices - vertex data, MeshVertex or PackedMeshVertex depending on the key
+		* @param[in] vertexStride - size of a single vertex
+		* @param[in] vertexCount - number of vertices
+		*
+		* @return True if the file was written
+		*/
+		bool Store(const std::string& path, const Key& key, const void* vertices, uint32_t vertexStride, size_t vertexCount, const std::vector<uint32_t>& indices,
+			const std::vector<VulkanMesh::LOD>& levels, const std::vector<Submesh>& submeshes, const glm::vec3& Min, const glm::vec3& Max);
+	};
+};
@@ -1,165 +1,69 @@
 #include "pch.hpp"
 #include "shapes.hpp"
 #include "utils.hpp"	
+#include "components.hpp"
+#include "mesh_cache.hpp"
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
+#include <atomic>
+#include <thread>
 
 namespace GR
 {
-	std::unique_ptr<VulkanMesh> Shapes::Cube::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
+	// Appends simplified levels of detail to the index list
+	static std::vector<VulkanMesh::LOD> generate_lods(const std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices, uint32_t LODCount, float LODReduction)
 	{
-		std::vector<MeshVertex> vertices;
-		std::vector<uint32_t> indices;
-
-		float dt = m_Scale / float(m_EdgeSplits + 1);
-		float h = 0.5 * m_Scale;
-
-		int row_span = 2 + m_EdgeSplits;
-
-		//face 1
-		uint32_t k1 = vertices.size();
-		uint32_t k2 = k1 + row_span;
-		for (float x = -h; x <= h; x += dt)
-		{
-			for (float z = -h; z <= h; z += dt, k1++, k2++)
-			{
-				MeshVertex v{};
-				v.position = { float(x), h, float(z) };
-				v.uv = { (x + h) / m_Scale, 1.0 - (z + h) / m_Scale };
-				vertices.push_back(v);
-
-				if (x < h && z < h)
-				{
-					indices.insert(indices.end(), {
-						k1, k1 + 1, k2,
-						k1 + 1, k2 + 1, k2
-					});
-				}
-			}
-		}
+		std::vector<VulkanMesh::LOD> levels = { { 0u, static_cast<uint32_t>(indices.size()) } };
+		std::vector<uint32_t> source, simplified;
 
-		//face 2
-		k1 = vertices.size();
-		k2 = k1 + row_span;
-		for (float x = -h; x <= h; x += dt)
+		LODCount = std::min(LODCount, Components::LODGroup::MaxLevels);
+		for (uint32_t i = 1; i < LODCount; i++)
 		{
-			for (float z = -h; z <= h; z += dt, k1++, k2++)
-			{
-				MeshVertex v{};
-				v.position = { float(x), -h, float(z) };
-				v.uv = { (x + h) / m_Scale, (z + h) / m_Scale };
-				vertices.push_back(v);
+			const VulkanMesh::LOD previous = levels.back();
+			source.assign(indices.begin() + previous.firstIndex, indices.begin() + previous.firstIndex + previous.indexCount);
 
-				if (x < h && z < h)
-				{
-					indices.insert(indices.end(), {
-						k1, k2, k1 + 1,
-						k1 + 1, k2, k2 + 1
-					});
-				}
-			}
-		}
+			Utils::SimplifyMesh(vertices, source, static_cast<size_t>(previous.indexCount * LODReduction) / 3 * 3, FLT_MAX, simplified);
 
-		//face 3
-		k1 = vertices.size();
-		k2 = k1 + row_span;
-		for (float x = -h; x <= h; x += dt)
-		{
-			for (float y = -h; y <= h; y += dt, k1++, k2++)
-			{
-				MeshVertex v{};
-				v.position = { float(x), float(y), h };
-				v.uv = { (x + h) / m_Scale, (y + h) / m_Scale };
-				vertices.push_back(v);
+			// seams and borders are locked, nothing left to collapse
+			if (simplified.empty() || simplified.size() >= previous.indexCount)
+				break;
 
-				if (x < h && y < h)
-				{
-					indices.insert(indices.end(), {
-						k1, k2, k1 + 1,
-						k1 + 1, k2, k2 + 1
-					});
-				}
-			}
+			levels.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(simplified.size()) });
+			indices.insert(indices.end(), simplified.begin(), simplified.end());
 		}
 
-		//face 4
-		k1 = vertices.size();
-		k2 = k1 + row_span;
-		for (float x = -h; x <= h; x += dt)
-		{
-			for (float y = -h; y <= h; y += dt, k1++, k2++)
-			{
-				MeshVertex v{};
-				v.position = { float(x), float(y), -h };
-				v.uv = { (x + h) / m_Scale, 1.0 - (y + h) / m_Scale };
-				vertices.push_back(v);
-
-				if (x < h && y < h)
-				{
-					indices.insert(indices.end(), {
-						k1, k1 + 1, k2,
-						k1 + 1, k2 + 1, k2
-					});
-				}
-			}
-		}
+		return levels;
+	}
 
-		//face 5
-		k1 = vertices.size();
-		k2 = k1 + row_span;
-		for (float z = -h; z <= h; z += dt)
+	// Cache and overdraw ordering per level of detail, then vertex order by first use for all levels together
+	// cache statistics are only simulated when the caller asked for geometry, callers which reorder triangles afterwards measure again
+	static void optimize_mesh(std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices, const std::vector<VulkanMesh::LOD>& levels, Shapes::GeometryDescriptor* Geometry)
+	{
+		if (Geometry)
 		{
-			for (float y = -h; y <= h; y += dt, k1++, k2++)
-			{
-				MeshVertex v{};
-				v.position = { h, float(y), float(z) };
-				v.uv = { (z + h) / m_Scale, 1.0 - (y + h) / m_Scale };
-				vertices.push_back(v);
-
-				if (z < h && y < h)
-				{
-					indices.insert(indices.end(), {
-						k1, k1 + 1, k2,
-						k1 + 1, k2 + 1, k2
-					});
-				}
-			}
+			Geometry->CacheBefore = Utils::AnalyzeVertexCache(indices.data(), levels[0].indexCount, vertices.size());
 		}
 
-		//face 6
-		k1 = vertices.size();
-		k2 = k1 + row_span;
-		for (float z = -h; z <= h; z += dt)
+		for (const VulkanMesh::LOD& lod : levels)
 		{
-			for (float y = -h; y <= h; y += dt, k1++, k2++)
-			{
-				MeshVertex v{};
-				v.position = { -h, float(y), float(z) };
-				v.uv = { (z + h) / m_Scale, (y + h) / m_Scale };
-				vertices.push_back(v);
-
-				if (z < h && y < h)
-				{
-					indices.insert(indices.end(), {
-						k1, k2, k1 + 1,
-						k1 + 1, k2, k2 + 1
-					});
-				}
-			}
+			Utils::OptimizeVertexCache(indices.data() + lod.firstIndex, lod.indexCount, vertices.size());
+			Utils::OptimizeOverdraw(indices.data() + lod.firstIndex, lod.indexCount, &vertices[0].position.x, sizeof(MeshVertex), vertices.size());
 		}
 
-		Utils::CalculateNormals(vertices, indices);
-		Utils::CalculateTangents(vertices, indices, 1.f, 1.f);
+		Utils::OptimizeVertexFetch(vertices, indices);
 
 		if (Geometry)
 		{
-			Geometry->Min = glm::vec3(-h);
-			Geometry->Max = glm::vec3(h);
-			Geometry->Center = (Geometry->Min + Geometry->Max) * 0.5f;
-			Geometry->Radius = glm::length(Geometry->Max - Geometry->Center);
+			Geometry->CacheAfter = Utils::AnalyzeVertexCache(indices.data(), levels[0].indexCount, vertices.size());
 		}
+	}
 
+	// Uploads the mesh with the narrowest index type, extra arguments go to VulkanMesh after the index data
+	template<typename Vertex, typename... Args>
+	static std::unique_ptr<VulkanMesh> upload_mesh(const RenderScope& Scope, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<VulkanMesh::LOD> levels, Args&&... args)
+	{
+		std::unique_ptr<VulkanMesh> mesh;
 		if (vertices.size() < UINT16_MAX)
 		{
 			std::vector<uint16_t> indices16;
@@ -168,138 +72,213 @@ namespace GR
 			for (uint32_t i = 0; i < indices.size(); i++)
 				indices16.push_back(static_cast<uint16_t>(indices[i]));
 
-			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices16.data(), indices16.size());
+			mesh = std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices16.data(), indices16.size(), std::forward<Args>(args)...);
 		}
 		else
 		{
-			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices.data(), indices.size());
+			mesh = std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices.data(), indices.size(), std::forward<Args>(args)...);
 		}
+
+		mesh->SetLODs(std::move(levels));
+		return mesh;
 	}
 
-	std::unique_ptr<VulkanMesh> Shapes::Plane::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
+	static void vertex_bounds(const std::vector<MeshVertex>& vertices, glm::vec3& Min, glm::vec3& Max)
 	{
-		std::vector<MeshVertex> vertices;
-		std::vector<uint32_t> indices;
+		Min = glm::vec3(FLT_MAX);
+		Max = glm::vec3(-FLT_MAX);
 
-		float dt = m_Scale / float(m_EdgeSplits + 1);
-		float h = 0.5 * m_Scale;
+		for (const MeshVertex& v : vertices)
+		{
+			Min = glm::min(Min, v.position);
+			Max = glm::max(Max, v.position);
+		}
+	}
 
-		int row_span = 2 + m_EdgeSplits;
+	static std::unique_ptr<VulkanMesh> create_mesh(const RenderScope& Scope, std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices, const Shapes::Shape& shape, Shapes::GeometryDescriptor* Geometry)
+	{
+		std::vector<VulkanMesh::LOD> levels = generate_lods(vertices, indices, shape.m_LODCount, shape.m_LODReduction);
 
-		uint32_t k1 = vertices.size();
-		uint32_t k2 = k1 + row_span;
-		for (float x = -h; x <= h; x += dt)
+		if (shape.m_Optimize && !indices.empty())
 		{
-			for (float z = -h; z <= h; z += dt, k1++, k2++)
-			{
-				MeshVertex v{};
-				v.position = { float(x), 0.0, float(z) };
-				v.uv = { (x + h) / m_Scale, 1.0 - (z + h) / m_Scale };
-				vertices.push_back(v);
-
-				if (x < h && z < h)
-				{
-					indices.insert(indices.end(), {
-						k1 + 1, k2, k1,
-						k2 + 1, k2, k1 + 1
-						});
-				}
-			}
+			optimize_mesh(vertices, indices, levels, Geometry);
 		}
 
-		Utils::CalculateNormals(vertices, indices);
-		Utils::CalculateTangents(vertices, indices, 1.f, 1.f);
-
-		if (Geometry)
+		if (shape.m_PackVertices)
 		{
-			Geometry->Min = glm::vec3(-h, 0.0, -h);
-			Geometry->Max = glm::vec3(h, 0.0, h);
-			Geometry->Center = (Geometry->Min + Geometry->Max) * 0.5f;
-			Geometry->Radius = glm::length(Geometry->Max - Geometry->Center);
+			glm::vec3 Min, Max;
+			vertex_bounds(vertices, Min, Max);
+
+			std::vector<PackedMeshVertex> packed = PackedMeshVertex::Pack(vertices, Min, Max);
+			return upload_mesh(Scope, packed, indices, std::move(levels), Min, Max);
 		}
 
-		if (vertices.size() < UINT16_MAX)
+		return upload_mesh(Scope, vertices, indices, std::move(levels));
+	}
+
+	// Generators with exactly known counts write vertices and indices in place, emit is called with (MeshVertex*, Index*)
+	// single level meshes of 16 bit range are uploaded with 16 bit indices, written right away unless the optimizer reorders them first
+	template<typename Emit>
+	static std::unique_ptr<VulkanMesh> create_mesh(const RenderScope& Scope, size_t vertexCount, size_t indexCount, const Shapes::Shape& shape, Shapes::GeometryDescriptor* Geometry, Emit&& emit)
+	{
+		std::vector<MeshVertex> vertices(vertexCount);
+
+		if (shape.m_LODCount <= 1u && !shape.m_PackVertices && vertexCount < UINT16_MAX)
 		{
-			std::vector<uint16_t> indices16;
-			indices16.reserve(indices.size());
+			std::vector<uint16_t> indices16(indexCount);
 
-			for (uint32_t i = 0; i < indices.size(); i++)
-				indices16.push_back(static_cast<uint16_t>(indices[i]));
+			if (shape.m_Optimize && indexCount > 0u)
+			{
+				// optimizer works on 32 bit indices, they are narrowed once the order is final
+				std::vector<uint32_t> indices(indexCount);
+				emit(vertices.data(), indices.data());
+				optimize_mesh(vertices, indices, { { 0u, static_cast<uint32_t>(indexCount) } }, Geometry);
+
+				std::transform(indices.begin(), indices.end(), indices16.begin(), [](uint32_t index) { return static_cast<uint16_t>(index); });
+			}
+			else
+			{
+				emit(vertices.data(), indices16.data());
+			}
 
 			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices16.data(), indices16.size());
 		}
-		else
-		{
-			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices.data(), indices.size());
-		}
+
+		std::vector<uint32_t> indices(indexCount);
+		emit(vertices.data(), indices.data());
+
+		return create_mesh(Scope, vertices, indices, shape, Geometry);
 	}
 
-	std::unique_ptr<VulkanMesh> Shapes::Sphere::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
-	{
-		std::vector<MeshVertex> vertices;
-		std::vector<uint32_t> indices;
+	// Quad corners in the order of emitted triangles, 0 - (i, j), 1 - (i, j + 1), 2 - (i + 1, j), 3 - (i + 1, j + 1)
+	using QuadWinding = std::array<uint32_t, 6>;
 
-		MeshVertex top;
-		top.position = glm::vec3(0.0, 0.0, m_Radius);
-		top.normal = glm::vec3(0.0, 0.0, 1.0);
-		top.uv = glm::vec2(0.5f + glm::atan(top.normal.z, top.normal.x) * glm::one_over_two_pi<float>(), 1.0 - (0.5f + glm::asin(top.normal.y) * glm::one_over_pi<float>()));
-		vertices.push_back(top);
+	/*
+	* Square grid of n x n vertices, i runs along axisA and j along axisB, both in [-scale / 2, scale / 2]
+	* uv.x follows i, uv.y follows j or 1 - j if flipV is set, normal and tangent are constant over the grid
+	*/
+	template<typename Index>
+	static void emit_grid(MeshVertex* vertices, Index* indices, uint32_t base, uint32_t n, float scale, const glm::vec3& origin, const glm::vec3& axisA, const glm::vec3& axisB,
+		const glm::vec3& normal, const glm::vec3& tangent, bool flipV, const QuadWinding& winding)
+	{
+		const float step = 1.f / float(n - 1);
 
-		for (uint32_t i = 1; i < m_Rings; i++)
+		for (uint32_t i = 0; i < n; i++)
 		{
-			double phi = glm::pi<float>() * float(i) / float(m_Rings);
-			double cosphi = glm::cos(phi);
-			double sinphi = glm::sin(phi);
+			const float u = float(i) * step;
+			for (uint32_t j = 0; j < n; j++)
+			{
+				const float v = float(j) * step;
+
+				MeshVertex& vertex = *vertices++;
+				vertex = {};
+				vertex.position = origin + axisA * ((u - 0.5f) * scale) + axisB * ((v - 0.5f) * scale);
+				vertex.normal = normal;
+				vertex.tangent = tangent;
+				vertex.uv = { u, flipV ? 1.f - v : v };
+			}
+		}
 
-			for (uint32_t j = 0; j < m_Slices; j++)
+		for (uint32_t i = 0; i < n - 1; i++)
+		{
+			for (uint32_t j = 0; j < n - 1; j++)
 			{
-				double theta = glm::two_pi<float>() * float(j) / float(m_Slices);
-				double cosTheta = glm::cos(theta);
-				double sinTheta = glm::sin(theta);
-
-				MeshVertex v;
-				v.position = m_Radius * glm::vec3(cosTheta * sinphi, sinTheta * sinphi, cosphi);
-				v.normal = glm::normalize(v.position);
-				v.uv = glm::vec2(0.5f + glm::atan(v.normal.z, v.normal.x) * glm::one_over_two_pi<float>(), 1.0 - (0.5f + glm::asin(v.normal.y) * glm::one_over_pi<float>()));
-				vertices.push_back(v);
+				const uint32_t k1 = base + i * n + j;
+				const uint32_t k2 = k1 + n;
+				const uint32_t corners[4] = { k1, k1 + 1, k2, k2 + 1 };
+
+				for (uint32_t c : winding)
+				{
+					*indices++ = static_cast<Index>(corners[c]);
+				}
 			}
 		}
+	}
+
+	std::unique_ptr<VulkanMesh> Shapes::Cube::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
+	{
+		const uint32_t n = m_EdgeSplits + 2;
+		const uint32_t faceVertices = n * n;
+		const uint32_t faceIndices = (n - 1) * (n - 1) * 6;
+		const float h = 0.5f * m_Scale;
 
-		MeshVertex bottom;
-		bottom.position = glm::vec3(0.0, 0.0, -m_Radius);
-		bottom.normal = glm::vec3(0.0, 0.0, -1.0);
-		bottom.uv = glm::vec2(0.5f + glm::atan(bottom.normal.z, bottom.normal.x) * glm::one_over_two_pi<float>(), 1.0 - (0.5f + glm::asin(bottom.normal.y) * glm::one_over_pi<float>()));
-		vertices.push_back(bottom);
+		const QuadWinding windingA = { 0, 1, 2, 1, 3, 2 };
+		const QuadWinding windingB = { 0, 2, 1, 1, 2, 3 };
 
-		for (uint32_t j = 1; j < m_Slices; ++j)
+		struct Face
 		{
-			indices.insert(indices.end(), { 0, j, j + 1 });
-		}
-		indices.insert(indices.end(), { 0, m_Slices, 1 });
+			glm::vec3 axisA, axisB, normal;
+			bool flipV;
+			const QuadWinding& winding;
+		};
+
+		// tangent follows uv.x, which runs along axisA
+		const Face faces[6] = {
+			{ { 1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 }, true, windingA },
+			{ { 1, 0, 0 }, { 0, 0, 1 }, { 0, -1, 0 }, false, windingB },
+			{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, false, windingB },
+			{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, true, windingA },
+			{ { 0, 0, 1 }, { 0, 1, 0 }, { 1, 0, 0 }, true, windingA },
+			{ { 0, 0, 1 }, { 0, 1, 0 }, { -1, 0, 0 }, false, windingB },
+		};
 
-		for (uint32_t i = 0; i < m_Rings - 2; ++i)
+		if (Geometry)
 		{
-			uint32_t topRowOffset = (i * m_Slices) + 1;
-			uint32_t bottomRowOffset = ((i + 1) * m_Slices) + 1;
+			Geometry->Min = glm::vec3(-h);
+			Geometry->Max = glm::vec3(h);
+			Geometry->Center = (Geometry->Min + Geometry->Max) * 0.5f;
+			Geometry->Radius = glm::length(Geometry->Max - Geometry->Center);
+		}
 
-			for (uint32_t j = 0; j < m_Slices - 1; ++j)
+		return create_mesh(Scope, 6 * faceVertices, 6 * faceIndices, *this, Geometry, [&](MeshVertex* vertices, auto* indices)
 			{
-				indices.insert(indices.end(), { bottomRowOffset + j, bottomRowOffset + j + 1, topRowOffset + j + 1 });
-				indices.insert(indices.end(), { bottomRowOffset + j, topRowOffset + j + 1, topRowOffset + j });
-			}
-			indices.insert(indices.end(), { bottomRowOffset + m_Slices - 1, bottomRowOffset, topRowOffset });
-			indices.insert(indices.end(), { bottomRowOffset + m_Slices - 1, topRowOffset, topRowOffset + m_Slices - 1 });
-		}
+				for (uint32_t f = 0; f < 6; f++)
+				{
+					const Face& face = faces[f];
+					emit_grid(vertices + f * faceVertices, indices + f * faceIndices, f * faceVertices, n, m_Scale, face.normal * h,
+						face.axisA, face.axisB, face.normal, face.axisA, face.flipV, face.winding);
+				}
+			});
+	}
+
+	std::unique_ptr<VulkanMesh> Shapes::Plane::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
+	{
+		const uint32_t n = m_EdgeSplits + 2;
+		const float h = 0.5f * m_Scale;
 
-		uint32_t lastPosition = vertices.size() - 1;
-		for (uint32_t j = lastPosition - 1; j > lastPosition - m_Slices; --j)
+		if (Geometry)
 		{
-			indices.insert(indices.end(), { lastPosition, j, j - 1 });
+			Geometry->Min = glm::vec3(-h, 0.0, -h);
+			Geometry->Max = glm::vec3(h, 0.0, h);
+			Geometry->Center = (Geometry->Min + Geometry->Max) * 0.5f;
+			Geometry->Radius = glm::length(Geometry->Max - Geometry->Center);
 		}
-		indices.insert(indices.end(), { lastPosition, lastPosition - m_Slices, lastPosition - 1 });
 
-		Utils::CalculateNormals(vertices, indices);
-		Utils::CalculateTangents(vertices, indices, 1.0, 1.0);
+		return create_mesh(Scope, n * n, (n - 1) * (n - 1) * 6, *this, Geometry, [&](MeshVertex* vertices, auto* indices)
+			{
+				emit_grid(vertices, indices, 0u, n, m_Scale, glm::vec3(0.0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1),
+					glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), true, { 1, 2, 0, 3, 2, 1 });
+			});
+	}
+
+	std::unique_ptr<VulkanMesh> Shapes::Sphere::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
+	{
+		const uint32_t rings = glm::max(m_Rings, 2u);
+		const uint32_t slices = glm::max(m_Slices, 3u);
+		const uint32_t vertexCount = (rings - 1) * slices + 2;
+		const uint32_t indexCount = (rings - 1) * slices * 6;
+
+		// texture is wrapped around y axis, tangent points along growing uv.x
+		auto make_vertex = [this](const glm::vec3& normal)
+		{
+			MeshVertex v{};
+			v.position = m_Radius * normal;
+			v.normal = normal;
+			v.tangent = glm::vec3(-normal.z, 0.0, normal.x);
+			v.tangent = glm::dot(v.tangent, v.tangent) > 1e-12f ? glm::normalize(v.tangent) : glm::vec3(1.0, 0.0, 0.0);
+			v.uv = glm::vec2(0.5f + glm::atan(normal.z, normal.x) * glm::one_over_two_pi<float>(), 1.0 - (0.5f + glm::asin(normal.y) * glm::one_over_pi<float>()));
+			return v;
+		};
 
 		if (Geometry)
 		{
@@ -309,27 +288,71 @@ namespace GR
 			Geometry->Radius = glm::length(Geometry->Max - Geometry->Center);
 		}
 
-		if (vertices.size() < UINT16_MAX)
-		{
-			std::vector<uint16_t> indices16;
-			indices16.reserve(indices.size());
+		return create_mesh(Scope, vertexCount, indexCount, *this, Geometry, [&](MeshVertex* vertices, auto* indices)
+			{
+				using Index = std::remove_pointer_t<decltype(indices)>;
+				auto triangle = [&indices](uint32_t a, uint32_t b, uint32_t c)
+				{
+					*indices++ = static_cast<Index>(a);
+					*indices++ = static_cast<Index>(b);
+					*indices++ = static_cast<Index>(c);
+				};
 
-			for (uint32_t i = 0; i < indices.size(); i++)
-				indices16.push_back(static_cast<uint16_t>(indices[i]));
+				*vertices++ = make_vertex(glm::vec3(0.0, 0.0, 1.0));
+				for (uint32_t i = 1; i < rings; i++)
+				{
+					const double phi = glm::pi<double>() * double(i) / double(rings);
+					const double cosphi = glm::cos(phi);
+					const double sinphi = glm::sin(phi);
 
-			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices16.data(), indices16.size());
-		}
-		else
-		{
-			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices.data(), indices.size());
-		}
+					for (uint32_t j = 0; j < slices; j++)
+					{
+						const double theta = glm::two_pi<double>() * double(j) / double(slices);
+						*vertices++ = make_vertex(glm::vec3(glm::cos(theta) * sinphi, glm::sin(theta) * sinphi, cosphi));
+					}
+				}
+				*vertices++ = make_vertex(glm::vec3(0.0, 0.0, -1.0));
+
+				for (uint32_t j = 0; j < slices; j++)
+				{
+					triangle(0, j + 1, (j + 1) % slices + 1);
+				}
+
+				for (uint32_t i = 0; i < rings - 2; i++)
+				{
+					const uint32_t top = i * slices + 1;
+					const uint32_t bottom = top + slices;
+
+					for (uint32_t j = 0; j < slices; j++)
+					{
+						const uint32_t next = (j + 1) % slices;
+						triangle(bottom + j, bottom + next, top + next);
+						triangle(bottom + j, top + next, top + j);
+					}
+				}
+
+				const uint32_t last = vertexCount - 1;
+				const uint32_t ring = last - slices;
+				for (uint32_t j = slices - 1; j > 0; j--)
+				{
+					triangle(last, ring + j, ring + j - 1);
+				}
+				triangle(last, ring, ring + slices - 1);
+			});
 	}
 
 	std::unique_ptr<VulkanMesh> Shapes::Mesh::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
 	{
-		std::unordered_map<MeshVertex, uint32_t> uniqueVertices{};
+		const std::string cache = path + ".grmesh";
+		const MeshCache::Key key = MeshCache::MakeKey(path, m_LODCount, m_LODReduction, m_Optimize, m_PackVertices);
+
+		if (std::unique_ptr<VulkanMesh> cached = MeshCache::Load(Scope, cache, key, Geometry))
+			return cached;
+
 		std::vector<uint32_t> indices;
 		std::vector<MeshVertex> vertices;
+		std::vector<MeshCache::Submesh> submeshes;
+		glm::vec3 Min = glm::vec3(FLT_MAX), Max = glm::vec3(-FLT_MAX);
 		Assimp::Importer importer;
 		std::string file = path;
 		const aiScene* model = importer.ReadFile(file, aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_CalcTangentSpace | aiProcess_FixInfacingNormals);
@@ -340,216 +363,240 @@ namespace GR
 		if (!model)
 			return VK_NULL_HANDLE;
 
-		for (uint32_t submesh_ind = 0; submesh_ind < model->mNumMeshes; submesh_ind++)
+		// vertices of different submeshes never compare equal, so every submesh is deduplicated on its own
+		struct SubmeshData
 		{
-			auto num_vert = model->mMeshes[submesh_ind]->mNumVertices;
-			auto cur_mesh = model->mMeshes[submesh_ind];
-			auto name3 = model->mMeshes[submesh_ind]->mName;
-			auto uv_ind = submesh_ind;
+			std::vector<MeshVertex> vertices;
+			std::vector<uint32_t> indices;
+			glm::vec3 Min = glm::vec3(FLT_MAX), Max = glm::vec3(-FLT_MAX);
+		};
 
-			for (int vert_ind = 0; vert_ind < num_vert; vert_ind++)
-			{
-				MeshVertex vertex{};
-				vertex.position = { cur_mesh->mVertices[vert_ind].x, cur_mesh->mVertices[vert_ind].y, cur_mesh->mVertices[vert_ind].z };
-				vertex.uv = { cur_mesh->mTextureCoords[uv_ind][vert_ind].x, 1.0 - cur_mesh->mTextureCoords[uv_ind][vert_ind].y };
-				vertex.submesh = submesh_ind;
+		std::vector<SubmeshData> parts(model->mNumMeshes);
+		std::atomic<uint32_t> next = 0u;
 
-				Geometry->Max = glm::max(Geometry->Max, vertex.position);
-				Geometry->Min = glm::min(Geometry->Min, vertex.position);
+		auto worker = [&]()
+		{
+			std::vector<MeshVertex> source;
+			for (uint32_t submesh_ind = next++; submesh_ind < model->mNumMeshes; submesh_ind = next++)
+			{
+				auto num_vert = model->mMeshes[submesh_ind]->mNumVertices;
+				auto cur_mesh = model->mMeshes[submesh_ind];
+				auto uv_ind = submesh_ind;
+				SubmeshData& part = parts[submesh_ind];
 
-				if (cur_mesh->HasNormals())
-					vertex.normal = { cur_mesh->mNormals[vert_ind].x, cur_mesh->mNormals[vert_ind].y, cur_mesh->mNormals[vert_ind].z };
+				source.resize(num_vert);
+				for (uint32_t vert_ind = 0; vert_ind < num_vert; vert_ind++)
+				{
+					MeshVertex& vertex = source[vert_ind];
+					vertex = {};
+					vertex.position = { cur_mesh->mVertices[vert_ind].x, cur_mesh->mVertices[vert_ind].y, cur_mesh->mVertices[vert_ind].z };
+					vertex.uv = { cur_mesh->mTextureCoords[uv_ind][vert_ind].x, 1.0 - cur_mesh->mTextureCoords[uv_ind][vert_ind].y };
+					vertex.submesh = submesh_ind;
 
-				if (cur_mesh->HasTangentsAndBitangents())
-					vertex.tangent = { cur_mesh->mTangents[vert_ind].x, cur_mesh->mTangents[vert_ind].y, cur_mesh->mTangents[vert_ind].z };
+					part.Max = glm::max(part.Max, vertex.position);
+					part.Min = glm::min(part.Min, vertex.position);
 
-				if (uniqueVertices.count(vertex) == 0)
-				{
-					int index = uniqueVertices.size();
-					uniqueVertices[vertex] = index;
+					if (cur_mesh->HasNormals())
+						vertex.normal = { cur_mesh->mNormals[vert_ind].x, cur_mesh->mNormals[vert_ind].y, cur_mesh->mNormals[vert_ind].z };
 
-					indices.push_back(index);
-					vertices.push_back(std::move(vertex));
-				}
-				else
-				{
-					indices.push_back(uniqueVertices[vertex]);
+					if (cur_mesh->HasTangentsAndBitangents())
+						vertex.tangent = { cur_mesh->mTangents[vert_ind].x, cur_mesh->mTangents[vert_ind].y, cur_mesh->mTangents[vert_ind].z };
 				}
+
+				Utils::DeduplicateVertices(source.data(), source.size(), part.vertices, part.indices);
+			}
+		};
+
+		const uint32_t threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), model->mNumMeshes));
+		std::vector<std::future<void>> tasks;
+		for (uint32_t i = 1; i < threadCount; i++)
+		{
+			tasks.push_back(std::async(std::launch::async, worker));
+		}
+
+		worker();
+		for (std::future<void>& task : tasks)
+		{
+			task.get();
+		}
+
+		// merge submeshes in their original order
+		size_t vertexTotal = 0u, indexTotal = 0u;
+		for (const SubmeshData& part : parts)
+		{
+			vertexTotal += part.vertices.size();
+			indexTotal += part.indices.size();
+		}
+
+		vertices.reserve(vertexTotal);
+		indices.reserve(indexTotal);
+		submeshes.reserve(parts.size());
+
+		for (SubmeshData& part : parts)
+		{
+			const uint32_t base = static_cast<uint32_t>(vertices.size());
+			submeshes.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(part.indices.size()) });
+
+			for (uint32_t index : part.indices)
+			{
+				indices.push_back(base + index);
 			}
+
+			vertices.insert(vertices.end(), part.vertices.begin(), part.vertices.end());
+			Min = glm::min(Min, part.Min);
+			Max = glm::max(Max, part.Max);
+
+			part = {};
 		}
 
 		if (Geometry)
 		{
+			Geometry->Min = Min;
+			Geometry->Max = Max;
 			Geometry->Center = (Geometry->Min + Geometry->Max) * 0.5f;
 			Geometry->Radius = glm::length(Geometry->Max - Geometry->Center);
 		}
 
-		if (vertices.size() < UINT16_MAX)
+		std::vector<VulkanMesh::LOD> levels = generate_lods(vertices, indices, m_LODCount, m_LODReduction);
+
+		if (m_Optimize && !indices.empty())
 		{
-			std::vector<uint16_t> indices16;
-			indices16.reserve(indices.size());
+			optimize_mesh(vertices, indices, levels, Geometry);
 
-			for (uint32_t i = 0; i < indices.size(); i++)
-				indices16.push_back(static_cast<uint16_t>(indices[i]));
+			// optimization mixes triangles of different submeshes, group them back so the table stays valid
+			std::vector<uint32_t> triangles(levels[0].indexCount / 3);
+			std::iota(triangles.begin(), triangles.end(), 0u);
+			std::stable_sort(triangles.begin(), triangles.end(), [&](uint32_t a, uint32_t b)
+				{
+					return vertices[indices[a * 3]].submesh < vertices[indices[b * 3]].submesh;
+				});
 
-			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices16.data(), indices16.size());
+			std::vector<uint32_t> grouped;
+			grouped.reserve(levels[0].indexCount);
+			for (MeshCache::Submesh& submesh : submeshes)
+			{
+				submesh.IndexCount = 0u;
+			}
+
+			for (uint32_t t : triangles)
+			{
+				MeshCache::Submesh& submesh = submeshes[vertices[indices[t * 3]].submesh];
+				submesh.FirstIndex = submesh.IndexCount == 0u ? static_cast<uint32_t>(grouped.size()) : submesh.FirstIndex;
+				submesh.IndexCount += 3u;
+				grouped.insert(grouped.end(), { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] });
+			}
+
+			std::copy(grouped.begin(), grouped.end(), indices.begin());
+
+			// statistics of the order that is uploaded
+			if (Geometry)
+			{
+				Geometry->CacheAfter = Utils::AnalyzeVertexCache(indices.data(), levels[0].indexCount, vertices.size());
+			}
 		}
-		else
+
+		if (Geometry)
+		{
+			Geometry->Submeshes = submeshes;
+		}
+
+		if (m_PackVertices)
 		{
-			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices.data(), indices.size());
+			std::vector<PackedMeshVertex> packed = PackedMeshVertex::Pack(vertices, Min, Max);
+			MeshCache::Store(cache, key, packed.data(), sizeof(PackedMeshVertex), packed.size(), indices, levels, submeshes, Min, Max);
+
+			return upload_mesh(Scope, packed, indices, std::move(levels), Min, Max);
 		}
+
+		MeshCache::Store(cache, key, vertices.data(), sizeof(MeshVertex), vertices.size(), indices, levels, submeshes, Min, Max);
+
+		return upload_mesh(Scope, vertices, indices, std::move(levels));
 	}
 
-	std::unique_ptr<VulkanMesh> Shapes::GeoClipmap::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
+	// Lattice of all clipmap levels, triangles and vertices created by each level are stored after the previous one
+	static void build_clipmap(const Shapes::GeoClipmap& shape, std::vector<TerrainVertex>& vertices, std::vector<uint32_t>& indices, std::vector<uint32_t>& levelFirstIndex, std::vector<uint32_t>* levelFirstVertex = nullptr)
 	{
-		const uint32_t m = (glm::max(m_VerPerRing, 7u) + 1) / 4;
-		std::vector<uint32_t> indices{};
-		std::vector<TerrainVertex> vertices{};
+		const uint32_t m = (glm::max(shape.m_VerPerRing, 7u) + 1) / 4;
 
-		std::unordered_map<glm::vec3, uint32_t> uniquePositions{};
-
-		indices.reserve(m * m * 24u * m_Rings);
-		vertices.reserve(m * m * 9u * m_Rings);
+		indices.reserve(m * m * 24u * shape.m_Rings);
+		vertices.reserve(m * m * 9u * shape.m_Rings);
+		levelFirstIndex.reserve(shape.m_Rings + 1);
 
 		const int32_t padding = 1u;
 		const int32_t g = m / 2;
 
-		float Diameter = (1 << m_Rings - 1) * (m + 2 * padding);
-		for (uint32_t level = 0u; level < m_Rings; level++)
+		// every level owns a lattice of its half step vertices, coordinates below are doubled so half steps stay integer
+		// a vertex is shared with whichever level created it first, found by index arithmetic instead of hashing positions
+		const int32_t extent = 2 * (g + padding);
+		const int32_t side = 2 * extent + 1;
+		std::vector<uint32_t> lattice(size_t(side) * side * shape.m_Rings, UINT32_MAX);
+
+		auto lattice_slot = [&](uint32_t level, int32_t x2, int32_t z2) -> uint32_t*
+		{
+			const int32_t step = level == 0 ? 1 : (1 << level + 1);
+			if (x2 % step != 0 || z2 % step != 0)
+				return nullptr;
+
+			const int32_t i = x2 / step + extent;
+			const int32_t j = z2 / step + extent;
+			if (i < 0 || j < 0 || i >= side || j >= side)
+				return nullptr;
+
+			return &lattice[(size_t(level) * side + j) * side + i];
+		};
+
+		float Diameter = (1 << shape.m_Rings - 1) * (m + 2 * padding);
+		for (uint32_t level = 0u; level < shape.m_Rings; level++)
 		{
+			levelFirstIndex.push_back(static_cast<uint32_t>(indices.size()));
+			if (levelFirstVertex)
+				levelFirstVertex->push_back(static_cast<uint32_t>(vertices.size()));
+
 			int32_t step = level == 0 ? 1u : (1u << level + 1);
 			int32_t prev_step = level > 0 ? (1u << level) : 0u;
 			int32_t half_step = prev_step;
 			int32_t radius = step * (g + padding);
 
 			float L = float(level);
-			float Scale = m_Scale;
 			float DiameterLevel = step * (m + 2 * padding);
 
+			auto vertex = [&](int32_t x2, int32_t z2) -> uint32_t
+			{
+				for (int32_t owner = level; owner >= 0; owner--)
+				{
+					const uint32_t* slot = lattice_slot(owner, x2, z2);
+					if (slot && *slot != UINT32_MAX)
+						return *slot;
+				}
+
+				const glm::vec3 p = glm::vec3(0.5f * float(x2), L, 0.5f * float(z2));
+				const glm::vec4 uv = glm::vec4(0.5f + p.x / DiameterLevel, 0.5f + p.z / DiameterLevel, Diameter, DiameterLevel);
+
+				vertices.emplace_back(glm::vec4{ p, 1.0 }, uv);
+				return *lattice_slot(level, x2, z2) = static_cast<uint32_t>(vertices.size() - 1);
+			};
+
 			for (int32_t z = -radius; z < radius; z += step)
 			{
-				uint32_t A = 0u, B = 0u, C = 0u, D = 0u, E = 0u, F = 0u, G = 0u, H = 0u, I = 0u;
 				for (int32_t x = -radius; x < radius; x += step)
 				{
 					if (level == 0 || glm::max(glm::abs(x + half_step), glm::abs(z + half_step)) > g * prev_step)
 					{
-						glm::vec3 Ap = glm::vec3(float(x), L, float(z));
-						glm::vec3 Cp = glm::vec3(float(x + step), L, float(z));
-						glm::vec3 Gp = glm::vec3(float(x), L, float(z + step));
-						glm::vec3 Ip = glm::vec3(float(x + step), L, float(z + step));
-
-						glm::vec3 Bp = (Ap + Cp) * 0.5f;
-						glm::vec3 Dp = (Ap + Gp) * 0.5f;
-						glm::vec3 Fp = (Cp + Ip) * 0.5f;
-						glm::vec3 Hp = (Gp + Ip) * 0.5f;
-						glm::vec3 Ep = (Ap + Ip) * 0.5f;
-
-						const glm::vec4 UvNorm = glm::vec4(glm::vec2(DiameterLevel), glm::vec2(1.0));
-
-						glm::vec4 Auv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Ap.x, Ap.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Buv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Bp.x, Bp.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Cuv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Cp.x, Cp.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Duv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Dp.x, Dp.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Euv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Ep.x, Ep.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Fuv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Fp.x, Fp.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Guv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Gp.x, Gp.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Iuv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Ip.x, Ip.z, Diameter, DiameterLevel) / UvNorm;
-						glm::vec4 Huv = glm::vec4(0.5, 0.5, 0.0, 0.0) + glm::vec4(Hp.x, Hp.z, Diameter, DiameterLevel) / UvNorm;
-
-#if 1
-						if (!uniquePositions.contains(Ap * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Ap, 1.0 }, Auv);
-							uniquePositions[Ap * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						A = uniquePositions[Ap * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Bp * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Bp, 1.0 }, Buv);
-							uniquePositions[Bp * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						B = uniquePositions[Bp * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Cp * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Cp, 1.0 }, Cuv);
-							uniquePositions[Cp * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						C = uniquePositions[Cp * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Dp * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Dp, 1.0 }, Duv);
-							uniquePositions[Dp * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						D = uniquePositions[Dp * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Ep * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Ep, 1.0 }, Euv);
-							uniquePositions[Ep * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						E = uniquePositions[Ep * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Fp * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Fp, 1.0 }, Fuv);
-							uniquePositions[Fp * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						F = uniquePositions[Fp * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Gp * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Gp, 1.0 }, Guv);
-							uniquePositions[Gp * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						G = uniquePositions[Gp * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Hp * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Hp, 1.0 }, Huv);
-							H = vertices.size() - 1;
-							uniquePositions[Hp * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						H = uniquePositions[Hp * glm::vec3(1, 0, 1)];
-
-						if (!uniquePositions.contains(Ip * glm::vec3(1, 0, 1)))
-						{
-							vertices.emplace_back(glm::vec4{ Ip, 1.0 }, Iuv);
-							uniquePositions[Ip * glm::vec3(1, 0, 1)] = vertices.size() - 1;
-						}
-						I = uniquePositions[Ip * glm::vec3(1, 0, 1)];
-#else
-						vertices.emplace_back(Ap);
-						A = C > 0u ? C : vertices.size() - 1;
-
-						vertices.emplace_back(Bp);
-						B = vertices.size() - 1;
-
-						vertices.emplace_back(Cp);
-						C = vertices.size() - 1;
-
-						vertices.emplace_back(Dp);
-						D = F > 0u ? F : vertices.size() - 1;
-
-						vertices.emplace_back(Ep);
-						E = vertices.size() - 1;
-
-						vertices.emplace_back(Fp);
-						F = vertices.size() - 1;
-
-						vertices.emplace_back(Gp);
-						G = I > 0u ? I : vertices.size() - 1;
-
-						vertices.emplace_back(Hp);
-						H = vertices.size() - 1;
-
-						vertices.emplace_back(Ip); 
-						I = vertices.size() - 1;
-#endif
-
-						if (x == -radius && level + 1 < m_Rings)
+						// A B C
+						// D E F
+						// G H I
+						const int32_t x2 = 2 * x, z2 = 2 * z;
+						const uint32_t A = vertex(x2, z2);
+						const uint32_t B = vertex(x2 + step, z2);
+						const uint32_t C = vertex(x2 + 2 * step, z2);
+						const uint32_t D = vertex(x2, z2 + step);
+						const uint32_t E = vertex(x2 + step, z2 + step);
+						const uint32_t F = vertex(x2 + 2 * step, z2 + step);
+						const uint32_t G = vertex(x2, z2 + 2 * step);
+						const uint32_t H = vertex(x2 + step, z2 + 2 * step);
+						const uint32_t I = vertex(x2 + 2 * step, z2 + 2 * step);
+
+						if (x == -radius && level + 1 < shape.m_Rings)
 						{
 							indices.insert(indices.end(), { E, A, G });
 						}
@@ -558,7 +605,7 @@ namespace GR
 							indices.insert(indices.end(), { E, A, D, E, D, G });
 						}
 
-						if (x + step >= radius && level + 1 < m_Rings)
+						if (x + step >= radius && level + 1 < shape.m_Rings)
 						{
 							indices.insert(indices.end(), { E, I, C });
 						}
@@ -567,7 +614,7 @@ namespace GR
 							indices.insert(indices.end(), { E, I, F, E, F, C });
 						}
 
-						if (z == -radius && level + 1 < m_Rings)
+						if (z == -radius && level + 1 < shape.m_Rings)
 						{
 							indices.insert(indices.end(), { E, C, A });
 						}
@@ -576,7 +623,7 @@ namespace GR
 							indices.insert(indices.end(), { E, C, B, E, B, A });
 						}
 
-						if (z + step >= radius && level + 1 < m_Rings)
+						if (z + step >= radius && level + 1 < shape.m_Rings)
 						{
 							indices.insert(indices.end(), { E, G, I });
 						}
@@ -585,16 +632,126 @@ namespace GR
 							indices.insert(indices.end(), { E, G, H, E, H, I });
 						}
 					}
-					else
-					{
-						A = 0u, B = 0u, C = 0u, D = 0u, E = 0u, F = 0u, G = 0u, H = 0u, I = 0u;
-					}
 				}
 			}
 		}
 
+		levelFirstIndex.push_back(static_cast<uint32_t>(indices.size()));
+		if (levelFirstVertex)
+			levelFirstVertex->push_back(static_cast<uint32_t>(vertices.size()));
+
 		indices.shrink_to_fit();
 		vertices.shrink_to_fit();
+	}
+
+	std::unique_ptr<VulkanMesh> Shapes::GeoClipmap::Generate(const RenderScope& Scope, GeometryDescriptor* Geometry) const
+	{
+		std::vector<uint32_t> indices{};
+		std::vector<TerrainVertex> vertices{};
+		std::vector<uint32_t> levelFirstIndex{};
+
+		build_clipmap(*this, vertices, indices, levelFirstIndex);
+
+		// vertices are laid out ring by ring and grass buffers rely on it, so only triangles are reordered
+		if (m_Optimize)
+		{
+			Utils::OptimizeVertexCache(indices.data(), indices.size(), vertices.size());
+		}
+
+		return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices.data(), indices.size());
+	}
+
+	std::unique_ptr<VulkanMesh> Shapes::GeoClipmap::GenerateFootprints(const RenderScope& Scope, std::vector<FootprintDraw>& outDraws, std::vector<uint32_t>& outLevelVertices, std::vector<TerrainVertex>* outLattice) const
+	{
+		std::vector<uint32_t> latticeIndices{};
+		std::vector<TerrainVertex> lattice{};
+		std::vector<uint32_t> levelFirstIndex{};
+
+		outLevelVertices.clear();
+		build_clipmap(*this, lattice, latticeIndices, levelFirstIndex, &outLevelVertices);
+
+		std::vector<ClipmapVertex> vertices{};
+		std::vector<uint32_t> indices{};
+		std::vector<ClipmapVertex> footprintVertices{}, previousVertices{};
+		std::vector<uint32_t> footprintIndices{}, previousIndices{};
+
+		// lattice vertex to footprint vertex of the level it was last referenced from
+		std::vector<glm::uvec2> remap(lattice.size(), glm::uvec2(UINT32_MAX));
+		size_t maxVertices = 0u;
+
+		outDraws.clear();
+		for (uint32_t level = 0u; level < m_Rings; level++)
+		{
+			const int32_t step = level == 0 ? 1 : (1 << level + 1);
+
+			footprintVertices.clear();
+			footprintIndices.clear();
+
+			// lattice positions are rewritten relative to the level, so rings between the first and the last produce the same footprint
+			for (uint32_t i = levelFirstIndex[level]; i < levelFirstIndex[level + 1]; i++)
+			{
+				glm::uvec2& local = remap[latticeIndices[i]];
+				if (local.x != level)
+				{
+					const TerrainVertex& source = lattice[latticeIndices[i]];
+					const int32_t x2 = static_cast<int32_t>(glm::round(2.f * source.position.x));
+					const int32_t z2 = static_cast<int32_t>(glm::round(2.f * source.position.z));
+
+					assert(x2 % step == 0 && z2 % step == 0);
+
+					ClipmapVertex v{};
+					v.offset[0] = static_cast<int16_t>(x2 / step);
+					v.offset[1] = static_cast<int16_t>(z2 / step);
+					v.owner = static_cast<int16_t>(level - static_cast<uint32_t>(source.position.y));
+					v.padding = 0;
+
+					local = glm::uvec2(level, static_cast<uint32_t>(footprintVertices.size()));
+					footprintVertices.push_back(v);
+				}
+
+				footprintIndices.push_back(local.y);
+			}
+
+			if (m_Optimize)
+			{
+				Utils::OptimizeVertexCache(footprintIndices.data(), footprintIndices.size(), footprintVertices.size());
+				Utils::OptimizeVertexFetch(footprintVertices, footprintIndices);
+			}
+
+			if (!outDraws.empty() && footprintIndices == previousIndices && footprintVertices == previousVertices)
+			{
+				outDraws.back().levelCount++;
+				continue;
+			}
+
+			FootprintDraw draw{};
+			draw.firstIndex = static_cast<uint32_t>(indices.size());
+			draw.indexCount = static_cast<uint32_t>(footprintIndices.size());
+			draw.vertexOffset = static_cast<int32_t>(vertices.size());
+			draw.firstLevel = level;
+			draw.levelCount = 1u;
+			outDraws.push_back(draw);
+
+			maxVertices = glm::max(maxVertices, footprintVertices.size());
+			vertices.insert(vertices.end(), footprintVertices.begin(), footprintVertices.end());
+			indices.insert(indices.end(), footprintIndices.begin(), footprintIndices.end());
+
+			std::swap(previousVertices, footprintVertices);
+			std::swap(previousIndices, footprintIndices);
+		}
+
+		// lattice indices are only used to build the footprints, its vertices are the reference the heights are evaluated for
+		if (outLattice)
+		{
+			*outLattice = std::move(lattice);
+		}
+
+		// indices are local to each footprint, draws add the vertex offset
+		if (maxVertices < UINT16_MAX)
+		{
+			std::vector<uint16_t> indices16(indices.begin(), indices.end());
+			return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices16.data(), indices16.size());
+		}
 
 		return std::make_unique<VulkanMesh>(Scope, vertices.data(), vertices.size(), indices.data(), indices.size());
 	}
@@ -2,17 +2,32 @@
 #include "core.hpp"
 #include "Vulkan/mesh.hpp"
 #include "Vulkan/scope.hpp"
+#include "Engine/utils.hpp"
 
 namespace GR
 {
 	namespace Shapes
 	{
+		/*
+		* !@brief Range of indices imported from a single source submesh
+		*/
+		struct Submesh
+		{
+			uint32_t FirstIndex = 0u;
+			uint32_t IndexCount = 0u;
+		};
+
 		struct GeometryDescriptor
 		{
 			glm::vec3 Min;
 			glm::vec3 Max;
 			glm::vec3 Center;
 			float Radius;
+			// post-transform cache of the first level before and after m_Optimize, zero when the optimizer did not run
+			Utils::VertexCacheStats CacheBefore = {};
+			Utils::VertexCacheStats CacheAfter = {};
+			// index ranges of the first level per source submesh, only filled by Shapes::Mesh
+			std::vector<Submesh> Submeshes = {};
 		};
 		/*
 		* !@brief This is a base class, use one of the specifications
@@ -25,6 +40,16 @@ namespace GR
 
 		public:
 			virtual glm::vec3 GetDimensions() const = 0;
+
+		public:
+			// Number of levels of detail generated by mesh simplification, level 0 is the full mesh
+			uint32_t m_LODCount = 1u;
+			// Fraction of triangles kept by each next level
+			float m_LODReduction = 0.5f;
+			// Reorder triangles and vertices for post-transform cache, overdraw and vertex fetch before upload
+			bool m_Optimize = true;
+			// Upload PackedMeshVertex instead of MeshVertex, roughly 2.4 times less vertex memory and bandwidth
+			bool m_PackVertices = false;
 		};
 
 		class Cube : public Shape
@@ -97,9 +122,36 @@ namespace GR
 
 		class GeoClipmap : public Shape
 		{
+		public:
+			/*
+			* !@brief Instanced draw of a single footprint, instance index is the clipmap level
+			*/
+			struct FootprintDraw
+			{
+				uint32_t firstIndex = 0u;
+				uint32_t indexCount = 0u;
+				int32_t vertexOffset = 0;
+				uint32_t firstLevel = 0u;
+				uint32_t levelCount = 0u;
+			};
+
 		protected:
 			friend class VulkanBase;
+			/*
+			* !@brief Generate reference lattice of all levels, used to evaluate terrain heights into the LUT
+			*/
 			GRAPI virtual std::unique_ptr<VulkanMesh> Generate(const RenderScope& Scope, GeometryDescriptor* outGeometry = nullptr) const override;
+			/*
+			* !@brief Generate level invariant footprints of the clipmap, levels sharing the same footprint are drawn as instances of it
+			*
+			* @param[in] Scope - render scope to create the mesh in
+			* @param[out] outDraws - draws covering every level, in level order
+			* @param[out] outLevelVertices - first vertex of every level in the reference lattice, followed by the total vertex count
+			* @param[out] outLattice - vertices of the reference lattice, the same Generate uploads, if given
+			*
+			* @return Mesh of ClipmapVertex with all footprints
+			*/
+			GRAPI std::unique_ptr<VulkanMesh> GenerateFootprints(const RenderScope& Scope, std::vector<FootprintDraw>& outDraws, std::vector<uint32_t>& outLevelVertices, std::vector<TerrainVertex>* outLattice = nullptr) const;
 
 		public:
 			glm::vec3 GetDimensions() const override
@@ -115,6 +167,8 @@ namespace GR
 			float m_MaxHeight = 1.f;
 			uint32_t m_NoiseSeed = 0u;
 			uint32_t m_GrassRings = 0u;
+			// most grass instances culled and drawn per frame, the outermost grass rings are cut to fit, 0 keeps all of them
+			uint32_t m_GrassBudget = 0u;
 		};
 	};
 }
\ No newline at end of file
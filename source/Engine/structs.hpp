@@ -9,6 +9,17 @@ struct ApplicationSettings
 	glm::ivec2 WindowExtents;
 };
 /*
+* !@brief Scattering model of the atmosphere as it is seen by shaders, mirrors atmosphere.glsl
+*/
+struct AtmosphereParameters
+{
+	glm::vec4 Rayleigh;
+	glm::vec4 Mie;
+	glm::vec4 MieExtinction;
+	glm::vec4 Ozone;
+	glm::vec4 Light;
+};
+/*
 * !@brief General per-frame values for rendering
 */
 struct UniformBuffer
@@ -35,6 +46,7 @@ struct UniformBuffer
 	float Gamma;
 	float Exposure;
 	glm::vec4 FrustumPlanes[6];
+	AtmosphereParameters Atmosphere;
 };
 /*
 * !@brief Struct describing the coverage of volumetric clouds
@@ -50,7 +62,42 @@ struct CloudLayerProfile
 	float Density = 0.006;
 };
 /*
+* !@brief Struct describing the scattering model of the atmosphere, coefficients are per km and heights are in km
 * 
+* The planet itself is fixed, radii come from the Rg and Rt shader constants
+*/
+struct AtmosphereProfile
+{
+	bool operator==(AtmosphereProfile& other)
+	{
+		return memcmp(this, &other, sizeof(AtmosphereProfile)) == 0;
+	}
+
+	glm::vec3 RayleighScattering = glm::vec3(5.8e-3, 1.35e-2, 3.31e-2);
+	float RayleighHeight = 8.0;
+	glm::vec3 MieScattering = glm::vec3(21e-3);
+	float MieHeight = 1.2;
+	// ratio of scattering to extinction of aerosols
+	float MieAlbedo = 0.9;
+	float MieG = 0.76;
+	// absorption of the ozone layer, earth is about (0.65e-3, 1.881e-3, 0.085e-3)
+	glm::vec3 OzoneAbsorption = glm::vec3(0.0);
+	float OzoneCenter = 25.0;
+	float OzoneWidth = 30.0;
+	float SunIntensity = 50.0;
+};
+/*
+* !@brief Struct describing the conversion error of an atmosphere table, relative error is against values of at least 1e-4
+*/
+struct AtmosphereFormatError
+{
+	float MaxAbs = 0.0;
+	float MeanAbs = 0.0;
+	float MaxRel = 0.0;
+	float MeanRel = 0.0;
+};
+/*
+* !@brief Struct describing a single layer of terrain noise, Octaves is the upper bound of the screen space octave budget
 */
 struct TerrainLayerProfile
 {
@@ -0,0 +1,200 @@
+#include "pch.hpp"
+#include "terrain_cache.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+namespace GR
+{
+	namespace
+	{
+		// remapping is cheap, but not free, so written tiles are kept in memory for a while
+		constexpr size_t RemapThreshold = 64u;
+	};
+
+	TerrainCache::TerrainCache(const std::string& path, const Key& key)
+		: m_Key(key), m_Path(path)
+	{
+		m_RecordSize = sizeof(uint64_t) + sizeof(uint16_t) * uint64_t(TileTexels());
+
+		uint64_t validSize = 0u;
+		{
+			MappedFile file(path);
+			Header header{};
+
+			if (file.Size() >= sizeof(Header))
+				memcpy(&header, file.Data(), sizeof(Header));
+
+			if (file.Size() >= sizeof(Header) && header.Magic == Magic && header.Version == Version && memcmp(&header.Source, &key, sizeof(Key)) == 0)
+			{
+				validSize = sizeof(Header) + (file.Size() - sizeof(Header)) / m_RecordSize * m_RecordSize;
+			}
+		}
+
+		std::error_code err;
+		if (validSize == 0u)
+		{
+			std::filesystem::create_directories(std::filesystem::path(path).parent_path(), err);
+
+			Header header{};
+			header.Source = key;
+
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		}
+		else if (std::filesystem::file_size(path, err) != validSize)
+		{
+			// interrupted write leaves partial record at the end, drop it so appended records stay aligned
+			std::filesystem::resize_file(path, validSize, err);
+		}
+
+		remap();
+
+		m_Writer = std::thread([this]() { write_pending(); });
+	}
+
+	TerrainCache::~TerrainCache()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stop = true;
+		}
+
+		m_Signal.notify_one();
+		m_Writer.join();
+	}
+
+	bool TerrainCache::Load(uint64_t tile, uint16_t* outHeights)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			auto pending = m_Pending.find(tile);
+			if (pending != m_Pending.end())
+			{
+				memcpy(outHeights, pending->second.data(), sizeof(uint16_t) * pending->second.size());
+				return true;
+			}
+		}
+
+		auto it = m_Index.find(tile);
+		if (it == m_Index.end())
+			return false;
+
+		memcpy(outHeights, m_File->Data() + it->second + sizeof(uint64_t), sizeof(uint16_t) * TileTexels());
+		return true;
+	}
+
+	void TerrainCache::Store(uint64_t tile, std::vector<uint16_t>&& heights)
+	{
+		assert(heights.size() == TileTexels());
+
+		bool full = false;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Disabled || m_Pending.count(tile) != 0 || m_Index.count(tile) != 0)
+				return;
+
+			m_Pending[tile] = std::move(heights);
+			m_Queue.push_back(tile);
+			full = m_Written.size() >= RemapThreshold;
+		}
+
+		m_Signal.notify_one();
+
+		if (full)
+			remap();
+	}
+
+	uint64_t TerrainCache::TileKey(uint32_t face, uint32_t level, uint32_t x, uint32_t y)
+	{
+		return uint64_t(face | (level << 8u)) | (uint64_t(x | (y << 16u)) << 32u);
+	}
+
+	uint32_t TerrainCache::TileHash(uint64_t tile)
+	{
+		uint32_t hash = uint32_t(tile) * 0x9E3779B1u ^ uint32_t(tile >> 32u) * 0x85EBCA6Bu;
+		return hash ^ (hash >> 16u);
+	}
+
+	uint32_t TerrainCache::CubeFace(const glm::dvec3& direction, glm::dvec2& outUV)
+	{
+		const glm::dvec3 a = glm::abs(direction);
+		const uint32_t axis = a.x >= a.y && a.x >= a.z ? 0u : (a.y >= a.z ? 1u : 2u);
+
+		const glm::dvec2 plane = axis == 0u ? glm::dvec2(direction.y, direction.z) : (axis == 1u ? glm::dvec2(direction.z, direction.x) : glm::dvec2(direction.x, direction.y));
+		outUV = glm::clamp(0.5 + 0.5 * plane / a[axis], 0.0, 1.0);
+
+		return axis * 2u + (direction[axis] < 0.0 ? 1u : 0u);
+	}
+
+	void TerrainCache::write_pending()
+	{
+		std::ofstream file(m_Path, std::ios::binary | std::ios::app);
+		std::error_code err;
+		uint64_t offset = std::filesystem::file_size(m_Path, err);
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		while (true)
+		{
+			m_Signal.wait(lock, [this]() { return m_Stop || !m_Queue.empty(); });
+
+			if (m_Queue.empty())
+				break;
+
+			const uint64_t tile = m_Queue.front();
+			m_Queue.pop_front();
+
+			// tile stays in pending until the file is remapped, so the vector is not touched by anyone else
+			const std::vector<uint16_t>& heights = m_Pending[tile];
+			lock.unlock();
+
+			file.write(reinterpret_cast<const char*>(&tile), sizeof(uint64_t));
+			file.write(reinterpret_cast<const char*>(heights.data()), sizeof(uint16_t) * heights.size());
+			file.flush();
+
+			lock.lock();
+			if (!file.good())
+			{
+				// file can not be appended to anymore, stop caching so unwritten tiles are not kept in memory forever
+				m_Disabled = true;
+				m_Pending.erase(tile);
+				for (uint64_t queued : m_Queue)
+					m_Pending.erase(queued);
+				m_Queue.clear();
+				break;
+			}
+
+			m_Written.push_back({ tile, offset });
+			offset += m_RecordSize;
+		}
+	}
+
+	void TerrainCache::remap()
+	{
+		std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>(m_Path);
+
+		if (m_Index.empty())
+		{
+			for (uint64_t offset = sizeof(Header); offset + m_RecordSize <= file->Size(); offset += m_RecordSize)
+			{
+				uint64_t tile = 0u;
+				memcpy(&tile, file->Data() + offset, sizeof(uint64_t));
+				m_Index[tile] = offset;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (const std::pair<uint64_t, uint64_t>& written : m_Written)
+		{
+			if (written.second + m_RecordSize > file->Size())
+				continue;
+
+			m_Index[written.first] = written.second;
+			m_Pending.erase(written.first);
+		}
+
+		m_Written.erase(std::remove_if(m_Written.begin(), m_Written.end(), [this](const std::pair<uint64_t, uint64_t>& written) { return m_Index.count(written.first) != 0; }), m_Written.end());
+		m_File = std::move(file);
+	}
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include "core.hpp"
+#include "Engine/mapped_file.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <deque>
+/*
+* Persistent cache of procedural terrain height tiles
+*/
+namespace GR
+{
+	class TerrainCache
+	{
+	public:
+		static constexpr uint32_t Magic = 0x43545247; // "GRTC"
+		static constexpr uint32_t Version = 1u;
+		// highest quadtree level which still fits 16 bit tile coordinates
+		static constexpr uint32_t MaxLevel = 16u;
+		/*
+		* !@brief Values which invalidate the cache file when changed
+		*/
+		struct Key
+		{
+			uint64_t ProfileHash = 0u;
+			uint32_t Seed = 0u;
+			uint32_t TileSize = 0u;
+			float MinHeight = 0.f;
+			float MaxHeight = 0.f;
+			float Radius = 0.f;
+			uint32_t Padding = 0u;
+		};
+		/*
+		* !@brief File layout: Header, then (uint64_t tile, uint16_t heights[TileTexels]) records in the order they were written
+		*/
+		struct Header
+		{
+			uint32_t Magic = TerrainCache::Magic;
+			uint32_t Version = TerrainCache::Version;
+			Key Source = {};
+		};
+		/*
+		* !@brief Open cache file, file with a different key is started anew
+		*
+		* @param[in] path - path to cache file
+		* @param[in] key - values the stored heights depend on
+		*/
+		TerrainCache(const std::string& path, const Key& key);
+		/*
+		* !@brief Finishes pending writes
+		*/
+		~TerrainCache();
+
+		TerrainCache(const TerrainCache& other) = delete;
+
+		void operator=(const TerrainCache& other) = delete;
+		/*
+		* !@brief Number of height samples along the tile border, tiles share their border samples with neighbours
+		*/
+		uint32_t TileExtent() const { return m_Key.TileSize + 1u; };
+		/*
+		* !@brief Number of height samples in a single tile
+		*/
+		uint32_t TileTexels() const { return TileExtent() * TileExtent(); };
+		/*
+		* !@brief Copy stored tile heights
+		*
+		* @param[in] tile - key made with TileKey
+		* @param[out] outHeights - TileTexels() heights above minimal terrain height
+		*
+		* @return True if the tile was found
+		*/
+		bool Load(uint64_t tile, uint16_t* outHeights);
+		/*
+		* !@brief Queue tile to be appended to the file on the writer thread, ignored once a write has failed
+		*
+		* @param[in] tile - key made with TileKey
+		* @param[in] heights - TileTexels() heights above minimal terrain height
+		*/
+		void Store(uint64_t tile, std::vector<uint16_t>&& heights);
+		/*
+		* !@brief Pack quadtree node of a cube face into a key
+		*
+		* @param[in] face - cube face, major axis times two plus one for negative direction
+		* @param[in] level - quadtree level, face is split into 2^level tiles along each side
+		* @param[in] x, y - tile coordinates on the face
+		*/
+		static uint64_t TileKey(uint32_t face, uint32_t level, uint32_t x, uint32_t y);
+		/*
+		* !@brief Hash of a tile key, same as the one used by terrain_noise to probe resident tiles
+		*/
+		static uint32_t TileHash(uint64_t tile);
+		/*
+		* !@brief Project direction onto the cube, same as CubeFace in terrain_height.glsl
+		*
+		* @param[in] direction - direction from the planet center
+		* @param[out] outUV - position on the face in [0, 1]
+		*
+		* @return Cube face index
+		*/
+		static uint32_t CubeFace(const glm::dvec3& direction, glm::dvec2& outUV);
+
+	private:
+		void write_pending();
+
+		void remap();
+
+		Key m_Key = {};
+		std::string m_Path = {};
+		uint64_t m_RecordSize = 0u;
+		std::unique_ptr<MappedFile> m_File = {};
+		// offset of every tile inside the mapped part of the file
+		std::unordered_map<uint64_t, uint64_t> m_Index = {};
+
+		std::mutex m_Mutex = {};
+		std::condition_variable m_Signal = {};
+		std::thread m_Writer = {};
+		bool m_Stop = false;
+		// set by the writer thread when the file could not be written, no more tiles are accepted after that
+		bool m_Disabled = false;
+		// tiles which are not part of the mapping yet, both queued and already written
+		std::unordered_map<uint64_t, std::vector<uint16_t>> m_Pending = {};
+		std::deque<uint64_t> m_Queue = {};
+		std::vector<std::pair<uint64_t, uint64_t>> m_Written = {};
+	};
+};
@@ -6,64 +6,375 @@
 #include <stb/stb_image.h>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
+#include <atomic>
+#include <thread>
+
+#if defined(_M_X64) || defined(__SSE2__)
+	#include <immintrin.h>
+	#define GR_SIMD_SSE 1
+#endif
 
 namespace GR
 {
-	void Utils::CalculateNormals(std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices)
+	namespace
 	{
-		for (int i = 0; i < indices.size(); i += 3)
+		// Symmetric 4x4 matrix of plane distances, sum of squared distances to the planes of adjacent triangles
+		struct Quadric
+		{
+			double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+			double b2 = 0.0, bc = 0.0, bd = 0.0;
+			double c2 = 0.0, cd = 0.0;
+			double d2 = 0.0;
+
+			Quadric() = default;
+
+			Quadric(const glm::dvec3& n, double d, double w)
+				: a2(w * n.x * n.x), ab(w * n.x * n.y), ac(w * n.x * n.z), ad(w * n.x * d),
+				b2(w * n.y * n.y), bc(w * n.y * n.z), bd(w * n.y * d),
+				c2(w * n.z * n.z), cd(w * n.z * d),
+				d2(w * d * d)
+			{
+
+			}
+
+			Quadric& operator+=(const Quadric& q)
+			{
+				a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+				b2 += q.b2; bc += q.bc; bd += q.bd;
+				c2 += q.c2; cd += q.cd;
+				d2 += q.d2;
+
+				return *this;
+			}
+
+			double Error(const glm::dvec3& p) const
+			{
+				return a2 * p.x * p.x + 2.0 * ab * p.x * p.y + 2.0 * ac * p.x * p.z + 2.0 * ad * p.x
+					+ b2 * p.y * p.y + 2.0 * bc * p.y * p.z + 2.0 * bd * p.y
+					+ c2 * p.z * p.z + 2.0 * cd * p.z
+					+ d2;
+			}
+		};
+
+		constexpr uint32_t ForsythCacheSize = 32u;
+
+		// Vertex score from "Linear-Speed Vertex Cache Optimisation", T. Forsyth
+		float forsyth_score(int32_t cachePosition, uint32_t remaining)
+		{
+			if (remaining == 0u)
+				return -1.f;
+
+			float score = 0.f;
+			if (cachePosition >= 0)
+			{
+				score = cachePosition < 3 ? 0.75f : glm::pow(1.f - float(cachePosition - 3) / float(ForsythCacheSize - 3), 1.5f);
+			}
+
+			return score + 2.f * glm::pow(float(remaining), -0.5f);
+		}
+
+		// Split [0, count) into chunks of grain size and process them on all hardware threads
+		template<typename Func>
+		void parallel_for(size_t count, size_t grain, Func&& func)
 		{
-			MeshVertex& A = vertices[indices[i]];
-			MeshVertex& B = vertices[indices[i + 1]];
-			MeshVertex& C = vertices[indices[i + 2]];
-			glm::vec3 contributingNormal = glm::cross(glm::vec3(B.position) - glm::vec3(A.position), glm::vec3(C.position) - glm::vec3(A.position));
-			float area = glm::length(contributingNormal) / 2.f;
-			glm::vec3 contributingNormal2 = glm::normalize(contributingNormal) * area;
+			const size_t chunks = (count + grain - 1) / grain;
+			const size_t threadCount = std::max<size_t>(1u, std::min<size_t>(std::thread::hardware_concurrency(), chunks));
+			std::atomic<size_t> next = 0u;
+
+			auto worker = [&]()
+			{
+				for (size_t chunk = next++; chunk < chunks; chunk = next++)
+				{
+					func(chunk * grain, std::min(count, (chunk + 1) * grain));
+				}
+			};
+
+			std::vector<std::future<void>> tasks;
+			for (size_t i = 1; i < threadCount; i++)
+			{
+				tasks.push_back(std::async(std::launch::async, worker));
+			}
 
-			vertices[indices[i]].normal += contributingNormal;
-			vertices[indices[i + 1]].normal += contributingNormal;
-			vertices[indices[i + 2]].normal += contributingNormal;
+			worker();
+			for (std::future<void>& task : tasks)
+			{
+				task.get();
+			}
 		}
 
-		for (int i = 0; i < vertices.size(); i++)
+		// Triangles adjacent to every vertex, lets vertices gather face values without write conflicts
+		struct VertexTriangles
+		{
+			std::vector<uint32_t> offsets;
+			std::vector<uint32_t> triangles;
+
+			VertexTriangles(const std::vector<uint32_t>& indices, size_t vertexCount)
+				: offsets(vertexCount + 1, 0u), triangles(indices.size())
+			{
+				for (uint32_t index : indices)
+				{
+					offsets[index + 1]++;
+				}
+
+				std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+				std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+				for (size_t i = 0; i < indices.size(); i++)
+				{
+					triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+				}
+			}
+		};
+
+		// Structure of arrays scratch for 3 component vectors
+		struct Vec3Array
+		{
+			std::vector<float> x, y, z;
+
+			Vec3Array(size_t count)
+				: x(count, 0.f), y(count, 0.f), z(count, 0.f)
+			{
+			}
+		};
+
+		// Sum face vectors around every vertex, optionally remove the component along reference direction, then normalize
+		void gather_normalize(const VertexTriangles& adjacency, const Vec3Array& faces, const Vec3Array* reference, Vec3Array& out)
+		{
+			const size_t count = out.x.size();
+
+			parallel_for(count, 4096u, [&](size_t begin, size_t end)
+				{
+					for (size_t v = begin; v < end; v++)
+					{
+						float x = 0.f, y = 0.f, z = 0.f;
+						for (uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; i++)
+						{
+							const uint32_t t = adjacency.triangles[i];
+							x += faces.x[t];
+							y += faces.y[t];
+							z += faces.z[t];
+						}
+
+						out.x[v] = x;
+						out.y[v] = y;
+						out.z[v] = z;
+					}
+
+					size_t v = begin;
+#ifdef GR_SIMD_SSE
+					const __m128 epsilon = _mm_set1_ps(1e-20f);
+					for (; v + 4 <= end; v += 4)
+					{
+						__m128 x = _mm_loadu_ps(&out.x[v]);
+						__m128 y = _mm_loadu_ps(&out.y[v]);
+						__m128 z = _mm_loadu_ps(&out.z[v]);
+
+						if (reference)
+						{
+							const __m128 rx = _mm_loadu_ps(&reference->x[v]);
+							const __m128 ry = _mm_loadu_ps(&reference->y[v]);
+							const __m128 rz = _mm_loadu_ps(&reference->z[v]);
+							const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, rx), _mm_mul_ps(y, ry)), _mm_mul_ps(z, rz));
+
+							x = _mm_sub_ps(x, _mm_mul_ps(rx, d));
+							y = _mm_sub_ps(y, _mm_mul_ps(ry, d));
+							z = _mm_sub_ps(z, _mm_mul_ps(rz, d));
+						}
+
+						const __m128 length = _mm_sqrt_ps(_mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)), epsilon));
+						_mm_storeu_ps(&out.x[v], _mm_div_ps(x, length));
+						_mm_storeu_ps(&out.y[v], _mm_div_ps(y, length));
+						_mm_storeu_ps(&out.z[v], _mm_div_ps(z, length));
+					}
+#endif
+					for (; v < end; v++)
+					{
+						glm::vec3 value(out.x[v], out.y[v], out.z[v]);
+						if (reference)
+						{
+							const glm::vec3 r(reference->x[v], reference->y[v], reference->z[v]);
+							value -= r * glm::dot(value, r);
+						}
+
+						value /= glm::sqrt(glm::max(glm::dot(value, value), 1e-20f));
+						out.x[v] = value.x;
+						out.y[v] = value.y;
+						out.z[v] = value.z;
+					}
+				});
+		}
+
+		struct Collapse
+		{
+			double cost;
+			uint32_t from;
+			uint32_t to;
+			uint32_t fromVersion;
+			uint32_t toVersion;
+
+			bool operator>(const Collapse& other) const
+			{
+				return cost > other.cost;
+			}
+		};
+	};
+
+	void Utils::CalculateNormals(std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		const size_t vertexCount = vertices.size();
+		const size_t triangleCount = indices.size() / 3;
+
+		Vec3Array positions(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			positions.x[i] = vertices[i].position.x;
+			positions.y[i] = vertices[i].position.y;
+			positions.z[i] = vertices[i].position.z;
+		}
+
+		// area weighted face normals, length of the cross product is twice the area
+		Vec3Array faces(triangleCount);
+		parallel_for(triangleCount, 4096u, [&](size_t begin, size_t end)
+			{
+				const uint32_t* index = indices.data();
+				const float* px = positions.x.data();
+				const float* py = positions.y.data();
+				const float* pz = positions.z.data();
+
+				size_t t = begin;
+#ifdef GR_SIMD_SSE
+				for (; t + 4 <= end; t += 4)
+				{
+					const uint32_t* i = index + t * 3;
+					const __m128 ax = _mm_setr_ps(px[i[0]], px[i[3]], px[i[6]], px[i[9]]);
+					const __m128 ay = _mm_setr_ps(py[i[0]], py[i[3]], py[i[6]], py[i[9]]);
+					const __m128 az = _mm_setr_ps(pz[i[0]], pz[i[3]], pz[i[6]], pz[i[9]]);
+					const __m128 e1x = _mm_sub_ps(_mm_setr_ps(px[i[1]], px[i[4]], px[i[7]], px[i[10]]), ax);
+					const __m128 e1y = _mm_sub_ps(_mm_setr_ps(py[i[1]], py[i[4]], py[i[7]], py[i[10]]), ay);
+					const __m128 e1z = _mm_sub_ps(_mm_setr_ps(pz[i[1]], pz[i[4]], pz[i[7]], pz[i[10]]), az);
+					const __m128 e2x = _mm_sub_ps(_mm_setr_ps(px[i[2]], px[i[5]], px[i[8]], px[i[11]]), ax);
+					const __m128 e2y = _mm_sub_ps(_mm_setr_ps(py[i[2]], py[i[5]], py[i[8]], py[i[11]]), ay);
+					const __m128 e2z = _mm_sub_ps(_mm_setr_ps(pz[i[2]], pz[i[5]], pz[i[8]], pz[i[11]]), az);
+
+					_mm_storeu_ps(&faces.x[t], _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y)));
+					_mm_storeu_ps(&faces.y[t], _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z)));
+					_mm_storeu_ps(&faces.z[t], _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x)));
+				}
+#endif
+				for (; t < end; t++)
+				{
+					const uint32_t* i = index + t * 3;
+					const glm::vec3 A(px[i[0]], py[i[0]], pz[i[0]]);
+					const glm::vec3 B(px[i[1]], py[i[1]], pz[i[1]]);
+					const glm::vec3 C(px[i[2]], py[i[2]], pz[i[2]]);
+					const glm::vec3 normal = glm::cross(B - A, C - A);
+
+					faces.x[t] = normal.x;
+					faces.y[t] = normal.y;
+					faces.z[t] = normal.z;
+				}
+			});
+
+		Vec3Array normals(vertexCount);
+		gather_normalize(VertexTriangles(indices, vertexCount), faces, nullptr, normals);
+
+		for (size_t i = 0; i < vertexCount; i++)
 		{
-			vertices[i].normal = glm::normalize(vertices[i].normal);
+			vertices[i].normal = glm::vec3(normals.x[i], normals.y[i], normals.z[i]);
 		}
 	}
 
 	void Utils::CalculateTangents(std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices, float u_scale, float v_scale)
 	{
-		for (int i = 0; i < indices.size(); i += 3)
+		const size_t vertexCount = vertices.size();
+		const size_t triangleCount = indices.size() / 3;
+
+		Vec3Array positions(vertexCount), normals(vertexCount);
+		std::vector<float> u(vertexCount), v(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
 		{
-			MeshVertex& A = vertices[indices[i]];
-			MeshVertex& B = vertices[indices[i + 1]];
-			MeshVertex& C = vertices[indices[i + 2]];
+			const MeshVertex& vertex = vertices[i];
+			positions.x[i] = vertex.position.x;
+			positions.y[i] = vertex.position.y;
+			positions.z[i] = vertex.position.z;
+			normals.x[i] = vertex.normal.x;
+			normals.y[i] = vertex.normal.y;
+			normals.z[i] = vertex.normal.z;
+
+			const glm::vec2 uv = (vertex.uv - 0.5f) * u_scale + (0.5f * v_scale);
+			u[i] = uv.x;
+			v[i] = 1.f - uv.y;
+		}
 
-			glm::vec2 uv0 = (A.uv - 0.5f) * u_scale + (0.5f * v_scale);
-			glm::vec2 uv1 = (B.uv - 0.5f) * u_scale + (0.5f * v_scale);
-			glm::vec2 uv2 = (C.uv - 0.5f) * u_scale + (0.5f * v_scale);
+		// unnormalized face tangents, triangles with degenerate uv mapping contribute nothing
+		Vec3Array faces(triangleCount);
+		parallel_for(triangleCount, 4096u, [&](size_t begin, size_t end)
+			{
+				const uint32_t* index = indices.data();
+				const float* px = positions.x.data();
+				const float* py = positions.y.data();
+				const float* pz = positions.z.data();
+				const float* pu = u.data();
+				const float* pv = v.data();
 
-			glm::vec3 diff1;
-			glm::vec3 diff2;
-			glm::vec2 delta1;
-			glm::vec2 delta2;
+				size_t t = begin;
+#ifdef GR_SIMD_SSE
+				const __m128 epsilon = _mm_set1_ps(1e-12f);
+				const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+				for (; t + 4 <= end; t += 4)
+				{
+					const uint32_t* i = index + t * 3;
+					const __m128 ax = _mm_setr_ps(px[i[0]], px[i[3]], px[i[6]], px[i[9]]);
+					const __m128 ay = _mm_setr_ps(py[i[0]], py[i[3]], py[i[6]], py[i[9]]);
+					const __m128 az = _mm_setr_ps(pz[i[0]], pz[i[3]], pz[i[6]], pz[i[9]]);
+					const __m128 au = _mm_setr_ps(pu[i[0]], pu[i[3]], pu[i[6]], pu[i[9]]);
+					const __m128 av = _mm_setr_ps(pv[i[0]], pv[i[3]], pv[i[6]], pv[i[9]]);
+					const __m128 e1x = _mm_sub_ps(_mm_setr_ps(px[i[1]], px[i[4]], px[i[7]], px[i[10]]), ax);
+					const __m128 e1y = _mm_sub_ps(_mm_setr_ps(py[i[1]], py[i[4]], py[i[7]], py[i[10]]), ay);
+					const __m128 e1z = _mm_sub_ps(_mm_setr_ps(pz[i[1]], pz[i[4]], pz[i[7]], pz[i[10]]), az);
+					const __m128 e2x = _mm_sub_ps(_mm_setr_ps(px[i[2]], px[i[5]], px[i[8]], px[i[11]]), ax);
+					const __m128 e2y = _mm_sub_ps(_mm_setr_ps(py[i[2]], py[i[5]], py[i[8]], py[i[11]]), ay);
+					const __m128 e2z = _mm_sub_ps(_mm_setr_ps(pz[i[2]], pz[i[5]], pz[i[8]], pz[i[11]]), az);
+					const __m128 d1u = _mm_sub_ps(_mm_setr_ps(pu[i[1]], pu[i[4]], pu[i[7]], pu[i[10]]), au);
+					const __m128 d1v = _mm_sub_ps(_mm_setr_ps(pv[i[1]], pv[i[4]], pv[i[7]], pv[i[10]]), av);
+					const __m128 d2u = _mm_sub_ps(_mm_setr_ps(pu[i[2]], pu[i[5]], pu[i[8]], pu[i[11]]), au);
+					const __m128 d2v = _mm_sub_ps(_mm_setr_ps(pv[i[2]], pv[i[5]], pv[i[8]], pv[i[11]]), av);
 
-			diff1 = B.position - A.position;
-			diff2 = C.position - A.position;
-			delta1 = glm::vec2(uv1.x, 1.f - uv1.y) - glm::vec2(uv0.x, 1.f - uv0.y);
-			delta2 = glm::vec2(uv2.x, 1.f - uv2.y) - glm::vec2(uv0.x, 1.f - uv0.y);
+					const __m128 det = _mm_sub_ps(_mm_mul_ps(d1u, d2v), _mm_mul_ps(d1v, d2u));
+					const __m128 valid = _mm_cmpgt_ps(_mm_and_ps(det, absMask), epsilon);
+					const __m128 f = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.f), det), valid);
 
-			float f = 1.0f / (delta1.x * delta2.y - delta1.y * delta2.x);
-			glm::vec3 tangent;
-			glm::vec3 bitangent;
+					_mm_storeu_ps(&faces.x[t], _mm_mul_ps(f, _mm_sub_ps(_mm_mul_ps(d2v, e1x), _mm_mul_ps(d1v, e2x))));
+					_mm_storeu_ps(&faces.y[t], _mm_mul_ps(f, _mm_sub_ps(_mm_mul_ps(d2v, e1y), _mm_mul_ps(d1v, e2y))));
+					_mm_storeu_ps(&faces.z[t], _mm_mul_ps(f, _mm_sub_ps(_mm_mul_ps(d2v, e1z), _mm_mul_ps(d1v, e2z))));
+				}
+#endif
+				for (; t < end; t++)
+				{
+					const uint32_t* i = index + t * 3;
+					const glm::vec3 A(px[i[0]], py[i[0]], pz[i[0]]);
+					const glm::vec3 diff1 = glm::vec3(px[i[1]], py[i[1]], pz[i[1]]) - A;
+					const glm::vec3 diff2 = glm::vec3(px[i[2]], py[i[2]], pz[i[2]]) - A;
+					const glm::vec2 delta1 = glm::vec2(pu[i[1]] - pu[i[0]], pv[i[1]] - pv[i[0]]);
+					const glm::vec2 delta2 = glm::vec2(pu[i[2]] - pu[i[0]], pv[i[2]] - pv[i[0]]);
 
-			tangent.x = f * (delta2.y * diff1.x - delta1.y * diff2.x);
-			tangent.y = f * (delta2.y * diff1.y - delta1.y * diff2.y);
-			tangent.z = f * (delta2.y * diff1.z - delta1.y * diff2.z);
+					const float det = delta1.x * delta2.y - delta1.y * delta2.x;
+					const float f = glm::abs(det) > 1e-12f ? 1.0f / det : 0.f;
+					const glm::vec3 tangent = f * (delta2.y * diff1 - delta1.y * diff2);
 
-			vertices[indices[i]].tangent = tangent;
-			vertices[indices[i + 1]].tangent = tangent;
-			vertices[indices[i + 2]].tangent = tangent;
+					faces.x[t] = tangent.x;
+					faces.y[t] = tangent.y;
+					faces.z[t] = tangent.z;
+				}
+			});
+
+		// accumulated tangents are made orthogonal to the vertex normal
+		Vec3Array tangents(vertexCount);
+		gather_normalize(VertexTriangles(indices, vertexCount), faces, &normals, tangents);
+
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			vertices[i].tangent = glm::vec3(tangents.x[i], tangents.y[i], tangents.z[i]);
 		}
 	}
 
@@ -208,6 +519,504 @@ namespace GR
 		free(pixels);
 	}
 
+	float Utils::SimplifyMesh(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, std::vector<uint32_t>& outIndices)
+	{
+		const uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+		const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+		std::vector<uint32_t> triangles(indices.begin(), indices.begin() + triangleCount * 3);
+		std::vector<uint8_t> removed(triangleCount, 0);
+		uint32_t liveTriangles = triangleCount;
+
+		// vertices sharing position are split by attribute seams, those are kept in place
+		std::unordered_map<glm::vec3, uint32_t> positions;
+		std::vector<uint32_t> canonical(vertexCount);
+		std::vector<uint8_t> locked(vertexCount, 0);
+		glm::vec3 Min = glm::vec3(FLT_MAX), Max = glm::vec3(-FLT_MAX);
+
+		for (uint32_t v = 0; v < vertexCount; v++)
+		{
+			auto [it, inserted] = positions.try_emplace(vertices[v].position, v);
+			canonical[v] = it->second;
+			locked[it->second] |= !inserted;
+
+			Min = glm::min(Min, vertices[v].position);
+			Max = glm::max(Max, vertices[v].position);
+		}
+
+		// edges with a single triangle are open borders, also kept in place
+		std::unordered_map<uint64_t, uint32_t> edges;
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint64_t a = canonical[triangles[t * 3 + k]];
+				uint64_t b = canonical[triangles[t * 3 + (k + 1) % 3]];
+				edges[a < b ? (a << 32) | b : (b << 32) | a]++;
+			}
+		}
+
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint64_t a = canonical[triangles[t * 3 + k]];
+				uint64_t b = canonical[triangles[t * 3 + (k + 1) % 3]];
+				if (edges[a < b ? (a << 32) | b : (b << 32) | a] == 1)
+				{
+					locked[a] = locked[b] = 1;
+				}
+			}
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		std::vector<std::vector<uint32_t>> adjacency(vertexCount);
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			const glm::dvec3 p0 = vertices[triangles[t * 3]].position;
+			const glm::dvec3 p1 = vertices[triangles[t * 3 + 1]].position;
+			const glm::dvec3 p2 = vertices[triangles[t * 3 + 2]].position;
+
+			glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+			const double area = glm::length(n);
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				adjacency[triangles[t * 3 + k]].push_back(t);
+			}
+
+			if (area == 0.0)
+				continue;
+
+			n /= area;
+			const Quadric q(n, -glm::dot(n, p0), area * 0.5);
+			quadrics[triangles[t * 3]] += q;
+			quadrics[triangles[t * 3 + 1]] += q;
+			quadrics[triangles[t * 3 + 2]] += q;
+		}
+
+		const double extent = glm::max(glm::length(glm::dvec3(Max - Min)), 1e-6);
+		const double maxCost = glm::pow(double(maxError) * extent, 2.0);
+
+		std::vector<uint32_t> version(vertexCount, 0);
+		std::vector<uint8_t> collapsed(vertexCount, 0);
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+
+		auto push = [&](uint32_t from, uint32_t to)
+		{
+			if (locked[canonical[from]])
+				return;
+
+			Quadric q = quadrics[from];
+			q += quadrics[to];
+			heap.push({ glm::max(q.Error(vertices[to].position), 0.0), from, to, version[from], version[to] });
+		};
+
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				push(triangles[t * 3 + k], triangles[t * 3 + (k + 1) % 3]);
+				push(triangles[t * 3 + (k + 1) % 3], triangles[t * 3 + k]);
+			}
+		}
+
+		double error = 0.0;
+		while (!heap.empty() && size_t(liveTriangles) * 3 > targetIndexCount)
+		{
+			const Collapse c = heap.top();
+			heap.pop();
+
+			if (collapsed[c.from] || collapsed[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion)
+				continue;
+
+			if (c.cost > maxCost)
+				break;
+
+			// reject collapses which flip any of the remaining triangles
+			bool flips = false;
+			const glm::vec3 target = vertices[c.to].position;
+			for (uint32_t t : adjacency[c.from])
+			{
+				uint32_t* tri = &triangles[t * 3];
+				if (removed[t] || tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+					continue;
+
+				glm::vec3 p[3] = { vertices[tri[0]].position, vertices[tri[1]].position, vertices[tri[2]].position };
+				const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					p[k] = tri[k] == c.from ? target : p[k];
+				}
+
+				if (glm::dot(before, glm::cross(p[1] - p[0], p[2] - p[0])) <= 0.f)
+				{
+					flips = true;
+					break;
+				}
+			}
+
+			if (flips)
+				continue;
+
+			for (uint32_t t : adjacency[c.from])
+			{
+				uint32_t* tri = &triangles[t * 3];
+				if (removed[t])
+					continue;
+
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+				{
+					removed[t] = 1;
+					liveTriangles--;
+					continue;
+				}
+
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					tri[k] = tri[k] == c.from ? c.to : tri[k];
+				}
+				adjacency[c.to].push_back(t);
+			}
+
+			quadrics[c.to] += quadrics[c.from];
+			collapsed[c.from] = 1;
+			version[c.to]++;
+			error = c.cost;
+
+			for (uint32_t t : adjacency[c.to])
+			{
+				if (removed[t])
+					continue;
+
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					const uint32_t v = triangles[t * 3 + k];
+					if (v != c.to)
+					{
+						push(v, c.to);
+						push(c.to, v);
+					}
+				}
+			}
+		}
+
+		outIndices.clear();
+		outIndices.reserve(liveTriangles * 3);
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			if (!removed[t])
+			{
+				outIndices.insert(outIndices.end(), { triangles[t * 3], triangles[t * 3 + 1], triangles[t * 3 + 2] });
+			}
+		}
+
+		return static_cast<float>(glm::sqrt(error) / extent);
+	}
+
+	Utils::VertexCacheStats Utils::AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+	{
+		VertexCacheStats stats{};
+		if (indexCount < 3)
+			return stats;
+
+		// vertex stays in FIFO cache until cacheSize other vertices were pushed after it
+		std::vector<uint32_t> timestamps(vertexCount, 0u);
+		uint32_t time = cacheSize + 1;
+		uint32_t misses = 0u, unique = 0u;
+
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			const uint32_t v = indices[i];
+			unique += timestamps[v] == 0u;
+
+			if (time - timestamps[v] > cacheSize)
+			{
+				timestamps[v] = time++;
+				misses++;
+			}
+		}
+
+		stats.ACMR = float(misses) / float(indexCount / 3);
+		stats.ATVR = float(misses) / float(glm::max(unique, 1u));
+		return stats;
+	}
+
+	void Utils::OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		const uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+		if (triangleCount == 0u)
+			return;
+
+		// triangles of each vertex, live ones are kept at the front of the vertex range
+		std::vector<uint32_t> remaining(vertexCount, 0u), offsets(vertexCount + 1, 0u);
+		for (uint32_t i = 0; i < triangleCount * 3; i++)
+		{
+			remaining[indices[i]]++;
+		}
+
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] = offsets[v] + remaining[v];
+		}
+
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		{
+			std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+			for (uint32_t i = 0; i < triangleCount * 3; i++)
+			{
+				adjacency[cursor[indices[i]]++] = i / 3;
+			}
+		}
+
+		std::vector<int32_t> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			vertexScore[v] = forsyth_score(-1, remaining[v]);
+		}
+
+		std::vector<uint8_t> emitted(triangleCount, 0u);
+		std::vector<uint32_t> result;
+		result.reserve(triangleCount * 3);
+
+		std::array<uint32_t, ForsythCacheSize + 3> cache, next;
+		uint32_t cacheCount = 0u;
+		uint32_t scan = 0u;
+		int64_t best = -1;
+
+		while (result.size() < triangleCount * 3)
+		{
+			if (best < 0)
+			{
+				while (emitted[scan])
+					scan++;
+
+				best = scan;
+			}
+
+			const uint32_t* tri = &indices[best * 3];
+			result.insert(result.end(), { tri[0], tri[1], tri[2] });
+			emitted[best] = 1u;
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t v = tri[k];
+				uint32_t* list = &adjacency[offsets[v]];
+				for (uint32_t j = 0; j < remaining[v]; j++)
+				{
+					if (list[j] == best)
+					{
+						std::swap(list[j], list[remaining[v] - 1]);
+						break;
+					}
+				}
+				remaining[v]--;
+			}
+
+			// emitted vertices go to the front, the rest shifts back
+			uint32_t nextCount = 0u;
+			next[nextCount++] = tri[0];
+			next[nextCount++] = tri[1];
+			next[nextCount++] = tri[2];
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				const uint32_t v = cache[i];
+				if (v != tri[0] && v != tri[1] && v != tri[2])
+				{
+					next[nextCount++] = v;
+				}
+			}
+
+			cacheCount = std::min(nextCount, ForsythCacheSize);
+			for (uint32_t i = 0; i < nextCount; i++)
+			{
+				const uint32_t v = next[i];
+				cachePosition[v] = i < ForsythCacheSize ? static_cast<int32_t>(i) : -1;
+				vertexScore[v] = forsyth_score(cachePosition[v], remaining[v]);
+			}
+
+			// only triangles touching the cache can change their score, the best one is among them
+			best = -1;
+			float bestScore = -FLT_MAX;
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				const uint32_t v = next[i];
+				for (uint32_t j = 0; j < remaining[v]; j++)
+				{
+					const uint32_t t = adjacency[offsets[v] + j];
+					const float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+					if (score > bestScore)
+					{
+						bestScore = score;
+						best = t;
+					}
+				}
+			}
+
+			std::swap(cache, next);
+		}
+
+		memcpy(indices, result.data(), sizeof(uint32_t) * result.size());
+	}
+
+	void Utils::OptimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t stride, size_t vertexCount)
+	{
+		const uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+		if (triangleCount < 2u)
+			return;
+
+		auto position = [positions, stride](uint32_t v)
+		{
+			const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + size_t(v) * stride);
+			return glm::vec3(p[0], p[1], p[2]);
+		};
+
+		// cluster boundaries are where cache optimized order restarts, i.e. all three vertices miss the cache
+		std::vector<uint32_t> clusters = { 0u };
+		{
+			const uint32_t cacheSize = 16u;
+			std::vector<uint32_t> timestamps(vertexCount, 0u);
+			uint32_t time = cacheSize + 1;
+
+			for (uint32_t t = 0; t < triangleCount; t++)
+			{
+				uint32_t misses = 0u;
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					const uint32_t v = indices[t * 3 + k];
+					if (time - timestamps[v] > cacheSize)
+					{
+						timestamps[v] = time++;
+						misses++;
+					}
+				}
+
+				if (misses == 3u && t > clusters.back())
+				{
+					clusters.push_back(t);
+				}
+			}
+		}
+
+		glm::vec3 meshCenter = glm::vec3(0.0);
+		float meshArea = 0.f;
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			const glm::vec3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+			const float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+			meshCenter += (p0 + p1 + p2) * (area / 3.f);
+			meshArea += area;
+		}
+		meshCenter /= glm::max(meshArea, FLT_MIN);
+
+		// clusters facing away from the center occlude the rest of the mesh, so they go first
+		const uint32_t clusterCount = static_cast<uint32_t>(clusters.size());
+		std::vector<float> sortKey(clusterCount);
+		for (uint32_t c = 0; c < clusterCount; c++)
+		{
+			const uint32_t begin = clusters[c];
+			const uint32_t end = c + 1 < clusterCount ? clusters[c + 1] : triangleCount;
+
+			glm::vec3 center = glm::vec3(0.0), normal = glm::vec3(0.0);
+			float area = 0.f;
+			for (uint32_t t = begin; t < end; t++)
+			{
+				const glm::vec3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+				const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+				const float a = glm::length(n);
+
+				center += (p0 + p1 + p2) * (a / 3.f);
+				normal += n;
+				area += a;
+			}
+
+			center /= glm::max(area, FLT_MIN);
+			const float length = glm::length(normal);
+			sortKey[c] = length > 0.f ? glm::dot(center - meshCenter, normal / length) : -FLT_MAX;
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&sortKey](uint32_t a, uint32_t b)
+			{
+				return sortKey[a] > sortKey[b];
+			});
+
+		std::vector<uint32_t> result;
+		result.reserve(triangleCount * 3);
+		for (uint32_t c : order)
+		{
+			const uint32_t begin = clusters[c];
+			const uint32_t end = c + 1 < clusterCount ? clusters[c + 1] : triangleCount;
+			result.insert(result.end(), indices + begin * 3, indices + end * 3);
+		}
+
+		memcpy(indices, result.data(), sizeof(uint32_t) * result.size());
+	}
+
+	uint64_t Utils::Hash64(const void* data, size_t size, uint64_t seed)
+	{
+		// xxHash64
+		constexpr uint64_t P1 = 11400714785074694791ull;
+		constexpr uint64_t P2 = 14029467366897019727ull;
+		constexpr uint64_t P3 = 1609587929392839161ull;
+		constexpr uint64_t P4 = 9650029242287828579ull;
+		constexpr uint64_t P5 = 2870177450012600261ull;
+
+		auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+		auto read64 = [](const uint8_t* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; };
+		auto read32 = [](const uint8_t* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return uint64_t(v); };
+		auto round = [&rotl](uint64_t acc, uint64_t lane) { return rotl(acc + lane * P2, 31) * P1; };
+		auto merge = [&round](uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * P1 + P4; };
+
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		const uint8_t* const end = p + size;
+		uint64_t h = 0u;
+
+		if (size >= 32)
+		{
+			uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+			for (; p + 32 <= end; p += 32)
+			{
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+			}
+
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+		}
+		else
+		{
+			h = seed + P5;
+		}
+
+		h += uint64_t(size);
+
+		for (; p + 8 <= end; p += 8)
+			h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+
+		if (p + 4 <= end)
+		{
+			h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+
+		for (; p < end; p++)
+			h = rotl(h ^ (uint64_t(*p) * P5), 11) * P1;
+
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+
+		return h;
+	}
+
 	double Utils::GetTime()
 	{
 		return glfwGetTime();
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <cstring>
 #include "core.hpp"
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
@@ -11,14 +12,152 @@ namespace GR
 	namespace Utils
 	{
 		/*
+		* !@brief Set vertex normals to the normalized sum of area weighted normals of adjacent triangles
 		*
+		* @param[in, out] vertices - vertex data
+		* @param[in] indices - triangle list
 		*/
 		GRAPI void CalculateNormals(std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices);
 		/*
+		* !@brief Set vertex tangents to the sum of tangents of adjacent triangles, orthogonalized against vertex normal
 		*
+		* @param[in, out] vertices - vertex data with valid normals
+		* @param[in] indices - triangle list
+		* @param[in] u_scale - scale of the texture coordinates
+		* @param[in] v_scale - offset scale of the texture coordinates
 		*/
 		GRAPI void CalculateTangents(std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices, float u_scale, float v_scale);
 		/*
+		* !@brief Reduce triangle count with quadric error edge collapses, vertices are only removed, never moved or added
+		* 
+		* @param[in] vertices - vertex data, stays valid for the output indices
+		* @param[in] indices - triangle list to simplify
+		* @param[in] targetIndexCount - stop once triangle list is this short
+		* @param[in] maxError - stop once collapse error relative to the mesh extent gets larger than this
+		* @param[out] outIndices - simplified triangle list
+		* 
+		* @return Relative error of the last collapse
+		*/
+		GRAPI float SimplifyMesh(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, std::vector<uint32_t>& outIndices);
+		/*
+		* !@brief Post-transform cache efficiency of the index list
+		*/
+		struct VertexCacheStats
+		{
+			// Average cache miss ratio, vertex shader invocations per triangle
+			float ACMR = 0.f;
+			// Average transform to vertex ratio, vertex shader invocations per referenced vertex
+			float ATVR = 0.f;
+		};
+		/*
+		* !@brief Simulate FIFO post-transform cache over the triangle list
+		*
+		* @param[in] indices - triangle list
+		* @param[in] indexCount - number of indices
+		* @param[in] vertexCount - number of vertices referenced by the list
+		* @param[in] cacheSize - number of entries in the simulated cache
+		*/
+		GRAPI VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16u);
+		/*
+		* !@brief Reorder triangles for post-transform cache reuse (Forsyth), done in place
+		*
+		* @param[in, out] indices - triangle list
+		* @param[in] indexCount - number of indices
+		* @param[in] vertexCount - number of vertices referenced by the list
+		*/
+		GRAPI void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+		/*
+		* !@brief Reorder clusters of cache optimized triangle list so outward facing clusters are drawn first, done in place
+		*
+		* @param[in, out] indices - triangle list, should be already optimized for vertex cache
+		* @param[in] indexCount - number of indices
+		* @param[in] positions - pointer to position of the first vertex
+		* @param[in] stride - distance between positions in bytes
+		* @param[in] vertexCount - number of vertices referenced by the list
+		*/
+		GRAPI void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t stride, size_t vertexCount);
+		/*
+		* !@brief Reorder vertices by first use in the index list and drop unreferenced ones
+		*
+		* @param[in, out] vertices - vertex data
+		* @param[in, out] indices - index list, remapped to the new vertex order
+		*/
+		template<typename Vertex>
+		void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+		{
+			std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+			std::vector<Vertex> reordered;
+			reordered.reserve(vertices.size());
+
+			for (uint32_t& index : indices)
+			{
+				if (remap[index] == UINT32_MAX)
+				{
+					remap[index] = static_cast<uint32_t>(reordered.size());
+					reordered.push_back(vertices[index]);
+				}
+
+				index = remap[index];
+			}
+
+			vertices.swap(reordered);
+		}
+		/*
+		* !@brief Hash raw bytes with xxHash64
+		*
+		* @param[in] data - pointer to the data
+		* @param[in] size - size of the data in bytes
+		* @param[in] seed - initial hash value
+		*
+		* @return 64 bit hash
+		*/
+		GRAPI uint64_t Hash64(const void* data, size_t size, uint64_t seed = 0u);
+		/*
+		* !@brief Merge bitwise identical vertices, uses open addressing table with single probe sequence per vertex
+		* Vertex type must not contain padding bytes
+		*
+		* @param[in] vertices - source vertices, one per index
+		* @param[in] count - number of source vertices
+		* @param[out] outVertices - unique vertices in order of first appearance, appended to
+		* @param[out] outIndices - index of unique vertex for every source vertex, appended to
+		*
+		* @return Number of unique vertices added
+		*/
+		template<typename Vertex>
+		size_t DeduplicateVertices(const Vertex* vertices, size_t count, std::vector<Vertex>& outVertices, std::vector<uint32_t>& outIndices)
+		{
+			// load factor is kept at or below 0.5
+			size_t capacity = 16u;
+			while (capacity < count * 2)
+				capacity *= 2;
+
+			const size_t mask = capacity - 1;
+			const size_t first = outVertices.size();
+			std::vector<uint32_t> table(capacity, UINT32_MAX);
+
+			outVertices.reserve(first + count);
+			outIndices.reserve(outIndices.size() + count);
+
+			for (size_t i = 0; i < count; i++)
+			{
+				const Vertex& vertex = vertices[i];
+				size_t slot = static_cast<size_t>(Hash64(&vertex, sizeof(Vertex))) & mask;
+
+				while (table[slot] != UINT32_MAX && memcmp(&outVertices[first + table[slot]], &vertex, sizeof(Vertex)) != 0)
+					slot = (slot + 1) & mask;
+
+				if (table[slot] == UINT32_MAX)
+				{
+					table[slot] = static_cast<uint32_t>(outVertices.size() - first);
+					outVertices.push_back(vertex);
+				}
+
+				outIndices.push_back(static_cast<uint32_t>(first) + table[slot]);
+			}
+
+			return outVertices.size() - first;
+		}
+		/*
 		* !@brief Convert roughness, metallic, ao, transmittance maps to more tightly packed ARM image
 		*
 		* @param[in] Roughness - local path to roughness map image file
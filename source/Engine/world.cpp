@@ -55,35 +55,168 @@ namespace GR
 		Resource.Set(static_cast<VulkanBase*>(m_Scope)->_loadImage(paths, VK_FORMAT_R8G8B8A8_UNORM));
 	}
 
+	void World::SetParent(Entity Child, Entity Parent)
+	{
+		assert(Child != Parent);
+
+		Components::WorldMatrix& world = Registry.get<Components::WorldMatrix>(Child);
+		Components::LocalMatrix& local = Registry.get_or_emplace<Components::LocalMatrix>(Child);
+
+		if (Parent != entt::null)
+		{
+			// parent has to be a part of the graph as well
+			if (!Registry.all_of<Components::Relationship>(Parent))
+			{
+				Components::WorldMatrix& parentWorld = Registry.get<Components::WorldMatrix>(Parent);
+				Components::LocalMatrix& parentLocal = Registry.emplace_or_replace<Components::LocalMatrix>(Parent);
+				parentLocal.orientation = parentWorld.orientation;
+				parentLocal.offset = parentWorld.offset;
+				Registry.emplace<Components::Relationship>(Parent);
+			}
+
+#if DEBUG == 1
+			for (Entity p = Parent; p != entt::null; p = Registry.get<Components::Relationship>(p).Parent)
+			{
+				assert(p != Child);
+			}
+#endif
+
+			// express current placement in parent space
+			const Components::WorldMatrix& parentWorld = Registry.get<Components::WorldMatrix>(Parent);
+			const glm::mat3 invRotation = glm::inverse(parentWorld.orientation);
+			local.orientation = invRotation * world.orientation;
+			local.offset = glm::dmat3(invRotation) * (world.offset - parentWorld.offset);
+		}
+		else
+		{
+			local.orientation = world.orientation;
+			local.offset = world.offset;
+		}
+
+		Components::Relationship& link = Registry.get_or_emplace<Components::Relationship>(Child);
+		link.Parent = Parent;
+		link.Dirty = true;
+
+		m_HierarchyChanged = true;
+	}
+
+	Components::LocalMatrix& World::GetLocalTransform(Entity ent)
+	{
+		Registry.get<Components::Relationship>(ent).Dirty = true;
+		return Registry.get<Components::LocalMatrix>(ent);
+	}
+
+	void World::UpdateTransforms()
+	{
+		if (m_HierarchyChanged)
+		{
+			auto links = Registry.view<Components::Relationship>();
+			for (const auto& [ent, link] : links.each())
+			{
+				link.Depth = 0;
+				for (Entity p = link.Parent; p != entt::null && Registry.valid(p); p = Registry.get<Components::Relationship>(p).Parent)
+				{
+					link.Depth++;
+				}
+			}
+
+			// parents go before children, the order only guarantees that, subtrees are not contiguous and WorldMatrix is looked up per entity
+			Registry.sort<Components::Relationship>([](const Components::Relationship& lhs, const Components::Relationship& rhs)
+				{
+					return lhs.Depth < rhs.Depth || (lhs.Depth == rhs.Depth && lhs.Parent < rhs.Parent);
+				});
+			// WorldMatrix storage is owned by the draw group and keeps its own order
+			Registry.sort<Components::LocalMatrix, Components::Relationship>();
+
+			m_HierarchyChanged = false;
+		}
+
+		auto view = Registry.view<Components::Relationship, Components::LocalMatrix, Components::WorldMatrix>();
+		view.use<Components::Relationship>();
+
+		for (const auto& [ent, link, local, world] : view.each())
+		{
+			if (link.Parent != entt::null && !Registry.valid(link.Parent))
+			{
+				// parent was destroyed, the child becomes root of its subtree
+				link.Parent = entt::null;
+				link.Dirty = true;
+				m_HierarchyChanged = true;
+			}
+
+			if (link.Parent == entt::null)
+			{
+				if (link.Dirty)
+				{
+					world.orientation = local.orientation;
+					world.offset = local.offset;
+				}
+				else if (world.orientation != local.orientation || world.offset != local.offset)
+				{
+					// root was moved through its WorldMatrix, keep local in sync so the subtree follows
+					local.orientation = world.orientation;
+					local.offset = world.offset;
+					link.Dirty = true;
+				}
+
+				link.Changed = link.Dirty;
+			}
+			else
+			{
+				const Components::Relationship& parentLink = Registry.get<Components::Relationship>(link.Parent);
+				link.Changed = link.Dirty || parentLink.Changed;
+				if (link.Changed)
+				{
+					const Components::WorldMatrix& parentWorld = Registry.get<Components::WorldMatrix>(link.Parent);
+					world.orientation = parentWorld.orientation * local.orientation;
+					world.offset = parentWorld.offset + glm::dmat3(parentWorld.orientation) * local.offset;
+				}
+			}
+
+			link.Dirty = false;
+		}
+	}
+
 	void World::DrawScene(double Delta)
 	{
 		auto renderer = static_cast<VulkanBase*>(m_Scope);
-		auto view = Registry.view<PBRObject, Components::WorldMatrix>();
 
-		for (const auto& [ent, gro, world] : view.each())
+		UpdateTransforms();
+
+		// draw data is owned by a single group, so the loop walks packed arrays instead of doing a lookup per component
+		auto group = Registry.group<Components::WorldMatrix, Components::BoundingBox, Components::CullDistance, Components::LODGroup, Components::RGBColor,
+			Components::RoughnessMultiplier, Components::MetallicOverride, Components::DisplacementScale>(entt::get<PBRObject>);
+
+		const float focal = glm::abs(renderer->m_Camera.Projection.matrix[1][1]);
+		for (const auto& [ent, world, Box, Cull, lod, color, roughness, metallic, displacement, gro] : group.each())
 		{
-			Components::BoundingBox& Box = Registry.get<Components::BoundingBox>(ent);
-			Components::CullDistance& Cull = Registry.get<Components::CullDistance>(ent);
 			if (glm::distance2(renderer->m_Camera.Transform.offset, world.offset) < SQR(Cull.Value)
 				&& renderer->m_Camera.FrustumCull(world.GetMatrix(), Box.Min, Box.Max))
 			{
 				PBRConstants constants{};
 				constants.Offset = world.GetOffset();
 				constants.Orientation = glm::mat3x4(world.GetRotation());
-				constants.Color = glm::vec4(Registry.get<Components::RGBColor>(ent).Value, 1.0);
-				constants.RoughnessMultiplier = Registry.get<Components::RoughnessMultiplier>(ent).Value;
-				constants.Metallic = Registry.get<Components::MetallicOverride>(ent).Value;
-				constants.HeightScale = Registry.get<Components::DisplacementScale>(ent).Value;
+				constants.Color = glm::vec4(color.Value, 1.0);
+				constants.RoughnessMultiplier = roughness.Value;
+				constants.Metallic = metallic.Value;
+				constants.HeightScale = displacement.Value;
 
 				if (gro.is_dirty())
 				{
 					renderer->_updateObject(ent, Registry);
 				}
 
-				renderer->_drawObject(gro, constants);
+				// bounding sphere radius scaled by the largest axis of the transform
+				const float scale = glm::max(glm::length(world.orientation[0]), glm::max(glm::length(world.orientation[1]), glm::length(world.orientation[2])));
+				const float radius = 0.5f * glm::length(Box.Max - Box.Min) * scale;
+				const float distance = static_cast<float>(glm::distance(renderer->m_Camera.Transform.offset, world.offset));
+
+				renderer->_drawObject(gro, constants, lod.Select(radius * focal / glm::max(distance, 1e-4f)));
 			}
 		}
 
+		renderer->_flushObjects();
+
 		if (m_TerrainEntity != entt::entity(-1))
 		{
 			renderer->_beginTerrainPass(); // hack, explicitely switch from objects to terrain rendering (this call happen after all objects)
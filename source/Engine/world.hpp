@@ -16,6 +16,7 @@ namespace GR
 	protected:
 		Renderer* m_Scope;
 		entt::entity m_TerrainEntity = entt::entity(-1);
+		bool m_HierarchyChanged = false;
 
 	public:
 		entt::registry Registry;
@@ -32,6 +33,27 @@ namespace GR
 		GRAPI virtual void DrawScene(double Delta);
 
 		GRAPI virtual void Clear();
+		/*
+		* !@brief Attaches entity to the parent, current world placement of the child is preserved
+		*
+		* @param[in] Child - entity to attach
+		* @param[in] Parent - new parent, entt::null detaches the child
+		*/
+		GRAPI void SetParent(Entity Child, Entity Parent);
+		/*
+		* !@brief Gets transform relative to the parent and marks the subtree for update
+		*
+		* @param[in] ent - entity with Relationship component
+		*
+		* @return Local transform of the entity
+		*/
+		GRAPI Components::LocalMatrix& GetLocalTransform(Entity ent);
+		/*
+		* !@brief Propagates world transforms of dirty subtrees, parents are always processed before children
+		*
+		* Roots accept either transform, a WorldMatrix written directly is copied into LocalMatrix unless GetLocalTransform was used since the last update
+		*/
+		GRAPI virtual void UpdateTransforms();
 
 		GRAPI void BindTexture(Components::Resource<Texture>& Resource, const std::string& path);
 
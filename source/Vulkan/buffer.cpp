@@ -56,6 +56,20 @@ Buffer& Buffer::UnMap()
 	return *this;
 }
 
+Buffer& Buffer::Flush()
+{
+	vmaFlushAllocation(Scope->GetAllocator(), memory, 0, VK_WHOLE_SIZE);
+
+	return *this;
+}
+
+Buffer& Buffer::Invalidate()
+{
+	vmaInvalidateAllocation(Scope->GetAllocator(), memory, 0, VK_WHOLE_SIZE);
+
+	return *this;
+}
+
 Buffer& Buffer::Update(void* data, size_t data_size, size_t offset)
 {
 	if (data_size == VK_WHOLE_SIZE)
@@ -46,6 +46,10 @@ public:
 
 	Buffer& UnMap();
 
+	Buffer& Flush();
+
+	Buffer& Invalidate();
+
 	Buffer& Update(void* data, size_t data_size = VK_WHOLE_SIZE, size_t offset = 0);
 
 	Buffer& Update(VkCommandBuffer cmd, void* data, size_t data_size = VK_WHOLE_SIZE, size_t offset = 0);
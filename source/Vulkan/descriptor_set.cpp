@@ -133,6 +133,34 @@ DescriptorSetDescriptor& DescriptorSetDescriptor::AddStorageImage(uint32_t bindi
 	return *this;
 }
 
+DescriptorSetDescriptor& DescriptorSetDescriptor::AddStorageImages(uint32_t binding, VkShaderStageFlags stages, const std::vector<VkImageView>& views, VkImageLayout layout)
+{
+	// infos of the array have to stay in place, writes keep pointers into imageInfos
+	assert(imageInfos.size() + views.size() <= imageInfos.capacity());
+
+	VkDescriptorSetLayoutBinding DSBinding{};
+	DSBinding.binding = binding;
+	DSBinding.descriptorCount = views.size();
+	DSBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	DSBinding.stageFlags = stages;
+
+	VkWriteDescriptorSet DSWrites{};
+	DSWrites.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	DSWrites.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	DSWrites.descriptorCount = views.size();
+	DSWrites.dstBinding = binding;
+
+	for (VkImageView view : views)
+		imageInfos.emplace_back(VK_NULL_HANDLE, view, layout);
+
+	DSWrites.pImageInfo = &imageInfos[imageInfos.size() - views.size()];
+
+	bindings.push_back(DSBinding);
+	writes.push_back(DSWrites);
+
+	return *this;
+}
+
 std::unique_ptr<DescriptorSet> DescriptorSetDescriptor::Allocate(const RenderScope& Scope)
 {
 	std::unique_ptr<DescriptorSet> out = std::make_unique<DescriptorSet>(Scope);
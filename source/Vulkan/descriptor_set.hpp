@@ -45,6 +45,8 @@ public:
 
 	DescriptorSetDescriptor& AddStorageImage(uint32_t binding, VkShaderStageFlags stages, VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
 
+	DescriptorSetDescriptor& AddStorageImages(uint32_t binding, VkShaderStageFlags stages, const std::vector<VkImageView>& views, VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
+
 	std::unique_ptr<DescriptorSet> Allocate(const RenderScope& Scope);
 
 private:
@@ -9,7 +9,7 @@ struct GraphicsObject
 private:
 	friend class VulkanBase;
 
-	std::unique_ptr<GraphicsPipeline> pipeline;
+	std::shared_ptr<GraphicsPipeline> pipeline;
 	std::unique_ptr<DescriptorSet> descriptorSet;
 };
 
@@ -51,4 +51,13 @@ private:
 
 	std::unique_ptr<VulkanMesh> mesh;
 	bool dirty = false;
-};
\ No newline at end of file
+};
+/*
+* !@brief Single deferred draw recorded by _drawObject and issued in sorted order by _flushObjects
+*/
+struct DrawPacket
+{
+	const PBRObject* object;
+	uint32_t lod;
+	PBRConstants constants;
+};
@@ -1,5 +1,60 @@
 #include "pch.hpp"
 #include "mesh.hpp"
+#include <glm/gtc/packing.hpp>
+
+static glm::vec2 octahedral_encode(glm::vec3 n)
+{
+	const float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+	if (l1 == 0.f)
+		return glm::vec2(0.f);
+
+	n /= l1;
+	if (n.z >= 0.f)
+		return glm::vec2(n.x, n.y);
+
+	return (1.f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+}
+
+static int16_t snorm16(float x)
+{
+	return static_cast<int16_t>(glm::round(glm::clamp(x, -1.f, 1.f) * 32767.f));
+}
+
+static uint16_t unorm16(float x)
+{
+	return static_cast<uint16_t>(glm::round(glm::clamp(x, 0.f, 1.f) * 65535.f));
+}
+
+std::vector<PackedMeshVertex> PackedMeshVertex::Pack(const std::vector<MeshVertex>& vertices, const glm::vec3& Min, const glm::vec3& Max)
+{
+	const glm::vec3 extent = Extent(Min, Max);
+	std::vector<PackedMeshVertex> packed(vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const MeshVertex& v = vertices[i];
+		PackedMeshVertex& p = packed[i];
+
+		const glm::vec3 q = (v.position - Min) / extent;
+		p.position[0] = unorm16(q.x);
+		p.position[1] = unorm16(q.y);
+		p.position[2] = unorm16(q.z);
+		p.position[3] = static_cast<uint16_t>(std::min(v.submesh, uint32_t(UINT16_MAX)));
+
+		const glm::vec2 n = octahedral_encode(v.normal * extent);
+		p.normal[0] = snorm16(n.x);
+		p.normal[1] = snorm16(n.y);
+
+		const glm::vec2 t = octahedral_encode(v.tangent * extent);
+		p.tangent[0] = snorm16(t.x);
+		p.tangent[1] = snorm16(t.y);
+
+		p.uv[0] = glm::packHalf1x16(v.uv.x);
+		p.uv[1] = glm::packHalf1x16(v.uv.y);
+	}
+
+	return packed;
+}
 
 VulkanMesh::VulkanMesh(const RenderScope& InScope, MeshVertex* vertices, size_t numVertices, uint32_t* indices, size_t numIndices)
 	: Scope(&InScope)
@@ -24,6 +79,7 @@ VulkanMesh::VulkanMesh(const RenderScope& InScope, MeshVertex* vertices, size_t
 
 	verticesCount = numVertices;
 	indicesCount = numIndices;
+	lods = { { 0u, indicesCount } };
 	indexType = VK_INDEX_TYPE_UINT32;
 }
 
@@ -50,6 +106,7 @@ VulkanMesh::VulkanMesh(const RenderScope& InScope, MeshVertex* vertices, size_t
 
 	verticesCount = numVertices;
 	indicesCount = numIndices;
+	lods = { { 0u, indicesCount } };
 	indexType = VK_INDEX_TYPE_UINT16;
 }
 
@@ -82,5 +139,122 @@ VulkanMesh::VulkanMesh(const RenderScope& InScope, TerrainVertex* vertices, size
 
 	verticesCount = numVertices;
 	indicesCount = numIndices;
+	lods = { { 0u, indicesCount } };
+	indexType = VK_INDEX_TYPE_UINT32;
+}
+
+VulkanMesh::VulkanMesh(const RenderScope& InScope, ClipmapVertex* vertices, size_t numVertices, uint32_t* indices, size_t numIndices)
+	: Scope(&InScope)
+{
+	VkBufferCreateInfo sbInfo{};
+	sbInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	sbInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	sbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	sbInfo.size = sizeof(ClipmapVertex) * numVertices;
+
+	VmaAllocationCreateInfo sbAlloc{};
+	sbAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	vertexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	sbInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	sbInfo.size = sizeof(uint32_t) * numIndices;
+	indexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	vertexBuffer->Update(vertices);
+	indexBuffer->Update(indices);
+
+	verticesCount = numVertices;
+	indicesCount = numIndices;
+	lods = { { 0u, indicesCount } };
 	indexType = VK_INDEX_TYPE_UINT32;
-}
\ No newline at end of file
+}
+
+VulkanMesh::VulkanMesh(const RenderScope& InScope, ClipmapVertex* vertices, size_t numVertices, uint16_t* indices, size_t numIndices)
+	: Scope(&InScope)
+{
+	VkBufferCreateInfo sbInfo{};
+	sbInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	sbInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	sbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	sbInfo.size = sizeof(ClipmapVertex) * numVertices;
+
+	VmaAllocationCreateInfo sbAlloc{};
+	sbAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	vertexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	sbInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	sbInfo.size = sizeof(uint16_t) * numIndices;
+	indexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	vertexBuffer->Update(vertices);
+	indexBuffer->Update(indices);
+
+	verticesCount = numVertices;
+	indicesCount = numIndices;
+	lods = { { 0u, indicesCount } };
+	indexType = VK_INDEX_TYPE_UINT16;
+}
+
+VulkanMesh::VulkanMesh(const RenderScope& InScope, PackedMeshVertex* vertices, size_t numVertices, uint32_t* indices, size_t numIndices, const glm::vec3& Min, const glm::vec3& Max)
+	: Scope(&InScope)
+{
+	VkBufferCreateInfo sbInfo{};
+	sbInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	sbInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	sbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	sbInfo.size = sizeof(PackedMeshVertex) * numVertices;
+
+	VmaAllocationCreateInfo sbAlloc{};
+	sbAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	vertexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	sbInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	sbInfo.size = sizeof(uint32_t) * numIndices;
+	indexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	vertexBuffer->Update(vertices);
+	indexBuffer->Update(indices);
+
+	verticesCount = numVertices;
+	indicesCount = numIndices;
+	lods = { { 0u, indicesCount } };
+	indexType = VK_INDEX_TYPE_UINT32;
+
+	packed = true;
+	dequantizeScale = PackedMeshVertex::Extent(Min, Max);
+	dequantizeOffset = Min;
+}
+
+VulkanMesh::VulkanMesh(const RenderScope& InScope, PackedMeshVertex* vertices, size_t numVertices, uint16_t* indices, size_t numIndices, const glm::vec3& Min, const glm::vec3& Max)
+	: Scope(&InScope)
+{
+	VkBufferCreateInfo sbInfo{};
+	sbInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	sbInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	sbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	sbInfo.size = sizeof(PackedMeshVertex) * numVertices;
+
+	VmaAllocationCreateInfo sbAlloc{};
+	sbAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	vertexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	sbInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	sbInfo.size = sizeof(uint16_t) * numIndices;
+	indexBuffer = std::make_unique<Buffer>(*Scope, sbInfo, sbAlloc);
+
+	vertexBuffer->Update(vertices);
+	indexBuffer->Update(indices);
+
+	verticesCount = numVertices;
+	indicesCount = numIndices;
+	lods = { { 0u, indicesCount } };
+	indexType = VK_INDEX_TYPE_UINT16;
+
+	packed = true;
+	dequantizeScale = PackedMeshVertex::Extent(Min, Max);
+	dequantizeOffset = Min;
+}
@@ -62,6 +62,67 @@ struct MeshVertex
 	glm::vec2 uv;
 };
 
+/*
+* !@brief Compressed MeshVertex, position is quantized inside mesh bounds, normal and tangent are octahedral encoded
+*/
+struct PackedMeshVertex
+{
+	static const VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(PackedMeshVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	static const std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions()
+	{
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(4);
+
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attributeDescriptions[0].offset = offsetof(PackedMeshVertex, position);
+
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[1].offset = offsetof(PackedMeshVertex, normal);
+
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[2].offset = offsetof(PackedMeshVertex, tangent);
+
+		attributeDescriptions[3].binding = 0;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R16G16_SFLOAT;
+		attributeDescriptions[3].offset = offsetof(PackedMeshVertex, uv);
+
+		return attributeDescriptions;
+	}
+	/*
+	* !@brief Size of the quantization box, degenerate axes are widened to keep the dequantization matrix invertible
+	*/
+	static glm::vec3 Extent(const glm::vec3& Min, const glm::vec3& Max)
+	{
+		return glm::max(Max - Min, glm::vec3(1e-4f));
+	}
+	/*
+	* !@brief Compress vertices, dequantization is folded into the world matrix as scale Extent(Min, Max) and offset Min,
+	* so normal and tangent are stored premultiplied by that scale to come out right from inverse transpose
+	*/
+	static std::vector<PackedMeshVertex> Pack(const std::vector<MeshVertex>& vertices, const glm::vec3& Min, const glm::vec3& Max);
+
+	// xyz - position in bounds, w - submesh
+	uint16_t position[4];
+	int16_t normal[2];
+	int16_t tangent[2];
+	uint16_t uv[2];
+};
+
 struct TerrainVertex
 {
 	static const VkVertexInputBindingDescription getBindingDescription()
@@ -100,16 +161,57 @@ struct TerrainVertex
 	glm::vec4 uv;
 };
 
+/*
+* !@brief Vertex of an instanced clipmap footprint, world position and height are read from terrain LUT of the owning level
+*/
+struct ClipmapVertex
+{
+	static const VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(ClipmapVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	static const std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions()
+	{
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_SINT;
+		attributeDescriptions[0].offset = offsetof(ClipmapVertex, offset);
+
+		return attributeDescriptions;
+	}
+
+	bool operator==(const ClipmapVertex& other) const
+	{
+		return offset[0] == other.offset[0] && offset[1] == other.offset[1] && owner == other.owner;
+	}
+
+	// lattice position in half steps of the drawn level
+	int16_t offset[2];
+	// number of levels below the drawn one, vertices on the inner border belong to the finer level
+	int16_t owner;
+	int16_t padding;
+};
+
 template<>
 struct std::hash<MeshVertex>
 {
 	size_t operator()(MeshVertex const& vertex) const
 	{
-		return ((std::hash<glm::vec3>()(vertex.position)
-			^ (std::hash<glm::vec3>()(vertex.normal))
-			^ (std::hash<glm::vec3>()(vertex.tangent))
-			^ (std::hash<glm::vec2>()(vertex.uv))
-			^ (std::hash<uint32_t>()(vertex.submesh))) >> 1);
+		// order dependent combine, plain xor cancels out on mirrored data
+		size_t seed = std::hash<uint32_t>()(vertex.submesh);
+		glm::detail::hash_combine(seed, std::hash<glm::vec3>()(vertex.position));
+		glm::detail::hash_combine(seed, std::hash<glm::vec3>()(vertex.normal));
+		glm::detail::hash_combine(seed, std::hash<glm::vec3>()(vertex.tangent));
+		glm::detail::hash_combine(seed, std::hash<glm::vec2>()(vertex.uv));
+		return seed;
 	}
 };
 
@@ -124,19 +226,37 @@ struct std::hash<TerrainVertex>
 
 struct VulkanMesh
 {
+	/*
+	* !@brief Range of the index buffer drawn for a single level of detail, all levels share vertex buffer
+	*/
+	struct LOD
+	{
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+	};
+
 	VulkanMesh(const RenderScope& Scope, MeshVertex* vertices, size_t numVertices, uint32_t* indices, size_t numIndices);
 
 	VulkanMesh(const RenderScope& Scope, MeshVertex* vertices, size_t numVertices, uint16_t* indices, size_t numIndices);
 
+	VulkanMesh(const RenderScope& Scope, PackedMeshVertex* vertices, size_t numVertices, uint32_t* indices, size_t numIndices, const glm::vec3& Min, const glm::vec3& Max);
+
+	VulkanMesh(const RenderScope& Scope, PackedMeshVertex* vertices, size_t numVertices, uint16_t* indices, size_t numIndices, const glm::vec3& Min, const glm::vec3& Max);
+
 	VulkanMesh(const RenderScope& Scope, TerrainVertex* vertices, size_t numVertices, uint32_t* indices, size_t numIndices);
 
+	VulkanMesh(const RenderScope& Scope, ClipmapVertex* vertices, size_t numVertices, uint32_t* indices, size_t numIndices);
+
+	VulkanMesh(const RenderScope& Scope, ClipmapVertex* vertices, size_t numVertices, uint16_t* indices, size_t numIndices);
+
 	VulkanMesh(const VulkanMesh& other) = delete;
 
 	void operator=(const VulkanMesh& other) = delete;
 
 	VulkanMesh(VulkanMesh&& other) noexcept
 		: Scope(other.Scope), vertexBuffer(std::move(other.vertexBuffer)), indexBuffer(std::move(other.indexBuffer)),
-		indicesCount(other.indicesCount), verticesCount(other.verticesCount)
+		indicesCount(other.indicesCount), verticesCount(other.verticesCount), indexType(other.indexType), lods(std::move(other.lods)),
+		packed(other.packed), dequantizeScale(other.dequantizeScale), dequantizeOffset(other.dequantizeOffset)
 	{
 		other.indicesCount = 0;
 		other.verticesCount = 0;
@@ -148,6 +268,11 @@ struct VulkanMesh
 		indexBuffer = std::move(other.indexBuffer);
 		indicesCount = other.indicesCount;
 		verticesCount = other.indicesCount;
+		indexType = other.indexType;
+		lods = std::move(other.lods);
+		packed = other.packed;
+		dequantizeScale = other.dequantizeScale;
+		dequantizeOffset = other.dequantizeOffset;
 
 		other.indicesCount = 0;
 		other.verticesCount = 0;
@@ -165,12 +290,28 @@ struct VulkanMesh
 
 	VkIndexType GetIndexType() const { return indexType; };
 
+	uint32_t GetLODCount() const { return static_cast<uint32_t>(lods.size()); };
+
+	const LOD& GetLOD(uint32_t level) const { return lods[std::min(level, GetLODCount() - 1)]; };
+
+	void SetLODs(std::vector<LOD> levels) { lods = std::move(levels); };
+
+	bool IsPacked() const { return packed; };
+
+	const glm::vec3& GetDequantizeScale() const { return dequantizeScale; };
+
+	const glm::vec3& GetDequantizeOffset() const { return dequantizeOffset; };
+
 private:
 	std::shared_ptr<Buffer> vertexBuffer = {};
 	std::shared_ptr<Buffer> indexBuffer = {};
 	uint32_t indicesCount = 0;
 	uint32_t verticesCount = 0;
 	VkIndexType indexType;
+	std::vector<LOD> lods = {};
+	bool packed = false;
+	glm::vec3 dequantizeScale = glm::vec3(1.0);
+	glm::vec3 dequantizeOffset = glm::vec3(0.0);
 
 	const RenderScope* Scope = VK_NULL_HANDLE;
 };
\ No newline at end of file
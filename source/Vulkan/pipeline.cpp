@@ -101,6 +101,8 @@ std::unique_ptr<ComputePipeline> ComputePipelineDescriptor::Construct(const Rend
 	VkShaderModule shader = VK_NULL_HANDLE;
 
 	std::ifstream shaderFile("shaders\\" + shaderNames[VK_SHADER_STAGE_COMPUTE_BIT] + ".spv", std::ios::ate | std::ios::binary);
+	// binaries are produced by the shaders target of the build
+	assert(shaderFile.is_open());
 	std::size_t fileSize = (std::size_t)shaderFile.tellg();
 	shaderFile.seekg(0);
 	std::vector<char> shaderCode(fileSize);
@@ -346,6 +348,7 @@ std::unique_ptr<GraphicsPipeline> GraphicsPipelineDescriptor::Construct(const Re
 		if (shaderNames.count(stages[i]) > 0)
 		{
 			std::ifstream shaderFile("shaders\\" + shaderNames[stages[i]] + ".spv", std::ios::ate | std::ios::binary);
+			assert(shaderFile.is_open());
 			std::size_t fileSize = (std::size_t)shaderFile.tellg();
 			shaderFile.seekg(0);
 			std::vector<char> shaderCode(fileSize);
@@ -128,6 +128,8 @@ VulkanBase::VulkanBase(GLFWwindow* window)
 	deviceFeatures.fillModeNonSolid = VK_TRUE;
 	deviceFeatures.geometryShader = VK_TRUE;
 	deviceFeatures.multiDrawIndirect = VK_TRUE;
+	deviceFeatures.shaderStorageImageExtendedFormats = VK_TRUE;
+	deviceFeatures.shaderStorageImageArrayDynamicIndexing = VK_TRUE;
 
 	std::vector<VkDescriptorPoolSize> pool_sizes =
 	{
@@ -160,6 +162,18 @@ VulkanBase::VulkanBase(GLFWwindow* window)
 		.CreateSimpleRenderPass()
 		.CreateTerrainRenderPass()
 		.CreateDescriptorPool(1000u, pool_sizes);
+
+	// grass compaction ballots a whole subgroup per ring, devices without it fall back to an atomic per blade
+	VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+	subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+	VkPhysicalDeviceProperties2 deviceProperties{};
+	deviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	deviceProperties.pNext = &subgroupProperties;
+	vkGetPhysicalDeviceProperties2(m_Scope.GetPhysicalDevice(), &deviceProperties);
+
+	const VkSubgroupFeatureFlags subgroupCompaction = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+	m_SubgroupCompaction = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0 && (subgroupProperties.supportedOperations & subgroupCompaction) == subgroupCompaction;
 	
 	res = create_swapchain_images() & res;
 	res = create_framebuffers() & res;
@@ -185,7 +199,7 @@ VulkanBase::VulkanBase(GLFWwindow* window)
 	::CreateSyncronizationStruct(m_Scope.GetDevice(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetPool(), m_PresentSync.size(), 2, m_PresentSync.data());
 	::CreateSyncronizationStruct(m_Scope.GetDevice(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetPool(), m_TerrainAsync.size(), 1, m_TerrainAsync.data());
 	::CreateSyncronizationStruct(m_Scope.GetDevice(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetPool(), m_CubemapAsync.size(), 1, m_CubemapAsync.data());
-	::CreateSyncronizationStruct(m_Scope.GetDevice(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetPool(), m_DeferredSync.size(), 1, m_DeferredSync.data());
+	::CreateSyncronizationStruct(m_Scope.GetDevice(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetPool(), m_DeferredSync.size(), 2, m_DeferredSync.data());
 	::CreateSyncronizationStruct(m_Scope.GetDevice(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetPool(), m_ComposeSync.size(), 1, m_ComposeSync.data());
 	::CreateSyncronizationStruct(m_Scope.GetDevice(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetPool(), m_BackgroundAsync.size(), 1, m_BackgroundAsync.data());
 
@@ -243,20 +257,30 @@ VulkanBase::~VulkanBase() noexcept
 	vkDestroyDescriptorPool(m_Scope.GetDevice(), m_ImguiPool, VK_NULL_HANDLE);
 #endif
 
+	m_TerrainCache.reset();
+	m_TerrainTileCompute.reset();
+	m_TerrainTileSet.resize(0);
+	m_TerrainTileStaging.resize(0);
+	m_TerrainTileTable.reset();
+	m_TerrainTiles.reset();
 	m_TerrainLayer.reset();
 
+	m_WaterCompute.reset();
+	m_WaterSet.resize(0);
+	m_WaterLUT.resize(0);
+	m_ErosionMap.reset();
+
 	m_GrassSet.resize(0);
 	m_GrassPipeline.reset();
 
 	m_VolumeWeatherCube.reset();
 
-	m_DiffusePrecompute.reset();
 	m_SpecularPrecompute.reset();
 
 	m_GrassOcclude.reset();
 	m_GrassIndirect.resize(0);
-	m_GrassIndirectRef.reset();
-	m_GrassPositions.resize(0);
+	m_GrassInstances.resize(0);
+	m_GrassCounters.resize(0);
 	m_GrassDrawSet.resize(0);
 
 	m_TerrainCompute.reset();
@@ -266,15 +290,18 @@ VulkanBase::~VulkanBase() noexcept
 	m_TerrainDrawSet.resize(0);
 	m_TerrainSet.resize(0);
 	m_TerrainLUT.resize(0);
-	m_DiffuseIrradience.resize(0);
+	m_TerrainOrigins.resize(0);
+	m_IrradianceSH.resize(0);
 	m_SpecularLUT.resize(0);
-	m_CubemapLUT.resize(0);
+	m_CubemapLUT.reset();
+	m_IrradianceSHTarget.reset();
+	m_SpecularTarget.reset();
 
 	m_VolumetricsAbovePipeline.reset();
 	m_VolumetricsUnderPipeline.reset();
 	m_VolumetricsComposePipeline.reset();
 	m_VolumetricsBetweenPipeline.reset();
-	m_VolumetricsDescriptor.reset();
+	m_VolumetricsDescriptors.resize(0);
 	m_UBOTempBuffers.resize(0);
 	m_UBOSkyBuffers.resize(0);
 	m_UBOBuffers.resize(0);
@@ -287,9 +314,10 @@ VulkanBase::~VulkanBase() noexcept
 	m_VolumeDetail.reset();
 	m_VolumeWeather.reset();
 
-	m_TransmittanceLUT.reset();
-	m_ScatteringLUT.reset();
-	m_IrradianceLUT.reset();
+	m_TransmittanceLUT.resize(0);
+	m_ScatteringLUT.resize(0);
+	m_IrradianceLUT.resize(0);
+	m_AtmosphereBuild.reset();
 
 	m_DefaultWhite.reset();
 	m_DefaultBlack.reset();
@@ -352,15 +380,22 @@ VulkanBase::~VulkanBase() noexcept
 	m_CubemapMipPipeline.reset();
 	m_CompositionPipeline.reset();
 	m_PostProcessPipeline.reset();
-	m_ConvolutionPipeline.reset();
+	m_IrradianceSHPipeline.reset();
 	m_SpecularIBLPipeline.reset();
+	m_IBLBlendPipeline.reset();
 
 	m_DepthHR.resize(0);
+	m_HiZ.resize(0);
+	m_HiZCounters.resize(0);
+	m_HiZDescriptors.resize(0);
+	m_HiZSets.resize(0);
+	m_HiZPipeline.reset();
 
 	m_NormalAttachments.resize(0);
 	m_NormalViews.resize(0);
 
-	TerrainVBs.resize(0);
+	m_TerrainReference.reset();
+	m_TerrainFootprints.resize(0);
 
 	m_DeferredAttachments.resize(0);
 	m_DeferredViews.resize(0);
@@ -383,10 +418,13 @@ VulkanBase::~VulkanBase() noexcept
 	m_ConvolutionDescriptors.resize(0);
 	m_BlurDescriptors.resize(0);
 	m_SpecularDescriptors.resize(0);
-	m_DiffuseDescriptors.resize(0);
+	m_IrradianceSHDescriptors.reset();
 	m_CubemapMipDescriptors.resize(0);
+	m_IBLBlendDescriptors.resize(0);
 
 	m_TemporalVolumetrics.resize(0);
+	m_PBRPipeline.reset();
+	m_PBRPackedPipeline.reset();
 	m_UBOTempSets.resize(0);
 	m_UBOSkySets.resize(0);
 	m_UBOSets.resize(0);
@@ -408,6 +446,12 @@ bool VulkanBase::BeginFrame()
 
 	assert(!m_InFrame, "Finish the frame in progress first!");
 
+	// new atmosphere is swapped in once its conversion is no longer in flight
+	if (m_AtmosphereBuild && m_AtmosphereBuild->Converted && m_FrameCount >= m_AtmosphereBuild->IdleFrame)
+	{
+		atmosphere_publish();
+	}
+
 	// Udpate UBO
 	{
 		glm::dmat4 view_matrix = m_Camera.GetViewMatrix();
@@ -454,11 +498,14 @@ bool VulkanBase::BeginFrame()
 			WindSpeed,
 			Time,
 			m_Camera.Gamma,
-			m_Camera.Exposure
+			m_Camera.Exposure,
+			{},
+			m_Atmosphere
 		};
 		memcpy(Uniform.FrustumPlanes, m_Camera._planes, sizeof(glm::vec4) * 6);
 
 		m_UBOTempBuffers[m_ResourceIndex]->Update(static_cast<void*>(&Uniform), sizeof(Uniform));
+		m_FrameViewProjection[m_ResourceIndex] = view_proj_matrix;
 	}
 
 	VkCommandBufferBeginInfo beginInfo{};
@@ -475,73 +522,52 @@ bool VulkanBase::BeginFrame()
 		if (m_FrameCount > 1)
 		{
 			m_TerrainLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_TerrainAsync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
-			// m_WaterLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_TerrainAsync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
-		}
-
-		if (m_GrassIndirectRef)
-		{
-			VkBufferCopy region{};
-			region.size = m_GrassIndirectRef->GetSize() - sizeof(VkDrawIndirectCommand);
-			region.srcOffset = sizeof(VkDrawIndirectCommand);
-			vkCmdCopyBuffer(m_TerrainAsync[m_ResourceIndex].Commands, m_GrassIndirectRef->GetBuffer(), m_GrassIndirect[m_ResourceIndex]->GetBuffer(), 1, &region);
+			m_WaterLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_TerrainAsync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
 		}
 
 		m_TerrainLUT[m_ResourceIndex].Image->TransitionLayout(m_TerrainAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
-		// m_WaterLUT[m_ResourceIndex].Image->TransitionLayout(m_TerrainAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
 
-		m_UBOTempSets[m_ResourceIndex]->BindSet(0, m_TerrainAsync[m_ResourceIndex].Commands, *m_TerrainCompute);
-		m_TerrainSet[m_ResourceIndex]->BindSet(1, m_TerrainAsync[m_ResourceIndex].Commands, *m_TerrainCompute);
-		m_TerrainCompute->BindPipeline(m_TerrainAsync[m_ResourceIndex].Commands);
-		vkCmdDispatch(m_TerrainAsync[m_ResourceIndex].Commands, m_TerrainDispatches, 1, 1);
+		terrain_update(m_TerrainAsync[m_ResourceIndex].Commands);
 
-		m_TerrainSet[m_ResourceIndex]->BindSet(0, m_TerrainAsync[m_ResourceIndex].Commands, *m_TerrainCompose);
-		m_TerrainCompose->BindPipeline(m_TerrainAsync[m_ResourceIndex].Commands);
-
-		int i = 0;
-		m_TerrainCompose->PushConstants(m_TerrainAsync[m_ResourceIndex].Commands, &i, sizeof(int), 0, VK_SHADER_STAGE_COMPUTE_BIT);
-		vkCmdDispatch(m_TerrainAsync[m_ResourceIndex].Commands, ceil(float((m_TerrainLUT[0].Image->GetExtent().width) / 8.f)), ceil(float((m_TerrainLUT[0].Image->GetExtent().height) / 4.f)), 1);
-
-		for (i = 1; i < m_TerrainLUT[0].Image->GetArrayLayers(); i++)
-		{
-			m_TerrainLUT[m_ResourceIndex].Image->TransitionLayout(m_TerrainAsync[m_ResourceIndex].Commands, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, i - 1, 1), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
-			m_TerrainCompose->PushConstants(m_TerrainAsync[m_ResourceIndex].Commands, &i, sizeof(int), 0, VK_SHADER_STAGE_COMPUTE_BIT);
-			vkCmdDispatch(m_TerrainAsync[m_ResourceIndex].Commands, ceil(float((m_TerrainLUT[0].Image->GetExtent().width) / 16.f)), ceil(float((m_TerrainLUT[0].Image->GetExtent().height) / 8.f)), 1);
-		}
 		m_TerrainLUT[m_ResourceIndex].Image->TransitionLayout(m_TerrainAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
 
 		if (m_GrassOcclude)
 		{
+			// patches are tested against the pyramid of the previous frame, projected the way it was rendered
+			glm::dmat4 HiZViewProjection = m_HiZPending ? m_FrameViewProjection[WRAPL(m_ResourceIndex)] : glm::dmat4(0.0);
+
 			m_GrassOcclude->BindPipeline(m_TerrainAsync[m_ResourceIndex].Commands);
 			m_UBOTempSets[m_ResourceIndex]->BindSet(0, m_TerrainAsync[m_ResourceIndex].Commands, *m_GrassOcclude);
 			m_GrassSet[m_ResourceIndex]->BindSet(1, m_TerrainAsync[m_ResourceIndex].Commands, *m_GrassOcclude);
-			vkCmdDispatchIndirect(m_TerrainAsync[m_ResourceIndex].Commands, m_GrassIndirectRef->GetBuffer(), 0);
+			m_HiZSets[WRAPL(m_ResourceIndex)]->BindSet(2, m_TerrainAsync[m_ResourceIndex].Commands, *m_GrassOcclude);
+			m_GrassOcclude->PushConstants(m_TerrainAsync[m_ResourceIndex].Commands, &HiZViewProjection, sizeof(glm::dmat4), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+			const uint32_t instances = static_cast<uint32_t>(m_GrassInstances[m_ResourceIndex]->GetSize() / (sizeof(glm::uvec2) * GrassLODs));
+			vkCmdDispatch(m_TerrainAsync[m_ResourceIndex].Commands, instances / 32 + uint32_t(instances % 32 > 0), 1, 1);
 		}
 
-#if 0
-		VkClearColorValue Color;
-		Color.float32[0] = 0.0;
-		vkCmdClearColorImage(m_TerrainAsync[m_ResourceIndex].Commands, m_WaterLUT[m_ResourceIndex].Image->GetImage(), VK_IMAGE_LAYOUT_GENERAL, &Color, 1, &m_WaterLUT[m_ResourceIndex].Image->GetSubResourceRange());
-
-		m_WaterSet[m_ResourceIndex]->BindSet(0, m_TerrainAsync[m_ResourceIndex].Commands, *m_WaterCompute);
-		m_WaterCompute->BindPipeline(m_TerrainAsync[m_ResourceIndex].Commands);
-		
-		for (int i = 0; i < 5; i++)
-		{
-			vkCmdDispatch(m_TerrainAsync[m_ResourceIndex].Commands, ceil(float(m_WaterLUT[0].Image->GetExtent().width) / 8.f), ceil(float(m_WaterLUT[0].Image->GetExtent().height) / 4.f), m_WaterLUT[0].Image->GetArrayLayers());
-			m_WaterLUT[m_ResourceIndex].Image->TransitionLayout(m_TerrainAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
-		}
-		m_WaterLUT[m_ResourceIndex].Image->TransitionLayout(m_TerrainAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-#else
-		// m_WaterLUT[m_ResourceIndex].Image->TransitionLayout(m_TerrainAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-#endif
+		// erosion traces the updated heights, a fixed amount of droplets every frame
+		terrain_erosion(m_TerrainAsync[m_ResourceIndex].Commands);
 
 		m_TerrainLUT[m_ResourceIndex].Image->TransferOwnership(m_TerrainAsync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
-		// m_WaterLUT[m_ResourceIndex].Image->TransferOwnership(m_TerrainAsync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
+		m_WaterLUT[m_ResourceIndex].Image->TransferOwnership(m_TerrainAsync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
 
 		vkEndCommandBuffer(m_TerrainAsync[m_ResourceIndex].Commands);
 
+		m_TerrainAsync[m_ResourceIndex].waitStages = { };
+		m_TerrainAsync[m_ResourceIndex].waitSemaphores = { };
+
+		if (m_HiZPending)
+		{
+			m_TerrainAsync[m_ResourceIndex].waitSemaphores.push_back(m_DeferredSync[WRAPL(m_ResourceIndex)].Semaphores[1]);
+			m_TerrainAsync[m_ResourceIndex].waitStages.push_back(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			m_HiZPending = false;
+		}
+
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = m_TerrainAsync[m_ResourceIndex].waitSemaphores.size();
+		submitInfo.pWaitSemaphores = m_TerrainAsync[m_ResourceIndex].waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = m_TerrainAsync[m_ResourceIndex].waitStages.data();
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &m_TerrainAsync[m_ResourceIndex].Commands;
 		submitInfo.signalSemaphoreCount = 1;
@@ -558,76 +584,18 @@ bool VulkanBase::BeginFrame()
 		if (m_FrameCount >= m_ResourceCount)
 		{
 			m_SpecularLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_CubemapAsync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
-			m_DiffuseIrradience[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_CubemapAsync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
 		}
 
-		uint32_t mips = m_SpecularLUT[m_ResourceIndex].Image->GetMipLevelsCount();
-		uint32_t X = CubeR / 8 + uint32_t(CubeR % 8 > 0);
-		uint32_t Y = CubeR / 4 + uint32_t(CubeR % 4 > 0);
-
-		m_CubemapLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
-		m_SpecularLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
-		m_DiffuseIrradience[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
-
-		m_CubemapPipeline->BindPipeline(m_CubemapAsync[m_ResourceIndex].Commands);
-		m_CubemapDescriptors[m_ResourceIndex]->BindSet(0, m_CubemapAsync[m_ResourceIndex].Commands, *m_CubemapPipeline);
-		vkCmdDispatch(m_CubemapAsync[m_ResourceIndex].Commands, X, Y, 6u);
-
-		m_CubemapMipPipeline->BindPipeline(m_CubemapAsync[m_ResourceIndex].Commands);
-		for (uint32_t mip = 1; mip < mips; mip++)
+		// tables of a new atmosphere are computed a step per frame next to the IBL
+		if (m_AtmosphereBuild && m_AtmosphereBuild->Step < atmosphere_step_count() && m_FrameCount >= m_AtmosphereBuild->IdleFrame)
 		{
-			uint32_t ScaledR = CubeR >> mip;
-			uint32_t scaledX = ScaledR / 8 + uint32_t(ScaledR % 8 > 0);
-			uint32_t scaledY = ScaledR / 4 + uint32_t(ScaledR % 4 > 0);
-
-			m_CubemapMipDescriptors[m_ResourceIndex * mips + mip]->BindSet(0, m_CubemapAsync[m_ResourceIndex].Commands, *m_CubemapMipPipeline);
-			vkCmdDispatch(m_CubemapAsync[m_ResourceIndex].Commands, scaledX, scaledY, 6u);
-
-			m_CubemapLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, mip, 1, 0, 6), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+			atmosphere_step(m_CubemapAsync[m_ResourceIndex].Commands);
 		}
-		m_CubemapLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-
-		m_ConvolutionPipeline->BindPipeline(m_CubemapAsync[m_ResourceIndex].Commands);
-		m_ConvolutionDescriptors[m_ResourceIndex]->BindSet(0, m_CubemapAsync[m_ResourceIndex].Commands, *m_ConvolutionPipeline);
-		m_DiffuseDescriptors[m_ResourceIndex]->BindSet(1, m_CubemapAsync[m_ResourceIndex].Commands, *m_ConvolutionPipeline);
-		vkCmdDispatch(m_CubemapAsync[m_ResourceIndex].Commands, X, Y, 6u);
-
-		for (uint32_t mip = 1; mip < mips; mip++)
-		{
-			uint32_t ScaledR = CubeR >> mip;
-			uint32_t scaledX = ceil(float(ScaledR) / 8.f);
-			uint32_t scaledY = ceil(float(ScaledR) / 4.f);
-
-			m_SpecularIBLPipeline->BindPipeline(m_CubemapAsync[m_ResourceIndex].Commands);
-			m_ConvolutionDescriptors[m_ResourceIndex]->BindSet(0, m_CubemapAsync[m_ResourceIndex].Commands, *m_SpecularIBLPipeline);
-			m_SpecularDescriptors[m_ResourceIndex * mips + mip]->BindSet(1, m_CubemapAsync[m_ResourceIndex].Commands, *m_SpecularIBLPipeline);
-
-			float pushConstant = float(mip) / float(mips - 1.0);
-			m_SpecularIBLPipeline->PushConstants(m_CubemapAsync[m_ResourceIndex].Commands, &pushConstant, sizeof(float), 0, VK_SHADER_STAGE_COMPUTE_BIT);
-			vkCmdDispatch(m_CubemapAsync[m_ResourceIndex].Commands, scaledX, scaledY, 6u);
-		}
-
-		m_SpecularLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-		m_CubemapLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-
-		VkImageCopy copy{};
-		copy.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copy.dstSubresource.layerCount = 6;
-		copy.dstSubresource.mipLevel = 0;
-		copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copy.srcSubresource.layerCount = 6;
-		copy.srcSubresource.mipLevel = 0;
-		copy.extent = { CubeR, CubeR, 1 };
-		vkCmdCopyImage(m_CubemapAsync[m_ResourceIndex].Commands, m_CubemapLUT[m_ResourceIndex].Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_SpecularLUT[m_ResourceIndex].Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
 
-		m_CubemapLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-		m_SpecularLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-		m_SpecularLUT[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_REMAINING_MIP_LEVELS, 0, 6), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-
-		m_DiffuseIrradience[m_ResourceIndex].Image->TransitionLayout(m_CubemapAsync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		// sky is rebuilt a slice per frame once it changed, sampled copies fade into the result
+		ibl_update(m_CubemapAsync[m_ResourceIndex].Commands);
 
 		m_SpecularLUT[m_ResourceIndex].Image->TransferOwnership(m_CubemapAsync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
-		m_DiffuseIrradience[m_ResourceIndex].Image->TransferOwnership(m_CubemapAsync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
 
 		vkEndCommandBuffer(m_CubemapAsync[m_ResourceIndex].Commands);
 
@@ -661,7 +629,7 @@ bool VulkanBase::BeginFrame()
 		ComputePipeline* Pipeline = Re < Rcbb ? m_VolumetricsUnderPipeline.get() : (Re > Rctb ? m_VolumetricsAbovePipeline.get() : m_VolumetricsBetweenPipeline.get());
 
 		m_UBOTempSets[m_ResourceIndex]->BindSet(0, m_BackgroundAsync[m_ResourceIndex].Commands, *Pipeline);
-		m_VolumetricsDescriptor->BindSet(1, m_BackgroundAsync[m_ResourceIndex].Commands, *Pipeline);
+		m_VolumetricsDescriptors[m_AtmosphereIndex]->BindSet(1, m_BackgroundAsync[m_ResourceIndex].Commands, *Pipeline);
 		m_TemporalVolumetrics[m_ResourceIndex]->BindSet(2, m_BackgroundAsync[m_ResourceIndex].Commands, *Pipeline);
 
 		int Order = 0; // m_ResourceIndex
@@ -719,9 +687,9 @@ bool VulkanBase::BeginFrame()
 			if (m_TerrainCompute.get())
 			{
 				m_TerrainLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_DeferredSync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
-				// m_WaterLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_DeferredSync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
+				m_WaterLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_DeferredSync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
 				m_TerrainLUT[WRAPR(m_ResourceIndex)].Image->TransferOwnership(m_DeferredSync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
-				// m_WaterLUT[WRAPR(m_ResourceIndex)].Image->TransferOwnership(m_DeferredSync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
+				m_WaterLUT[WRAPR(m_ResourceIndex)].Image->TransferOwnership(m_DeferredSync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
 			}
 
 			m_HdrAttachmentsHR[m_ResourceIndex]->TransitionLayout(m_DeferredSync[m_ResourceIndex].Commands, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_QUEUE_GRAPHICS_BIT);
@@ -789,6 +757,9 @@ void VulkanBase::EndFrame()
 
 	{
 		vkCmdEndRenderPass(m_DeferredSync[m_ResourceIndex].Commands);
+
+		hiz_update(m_DeferredSync[m_ResourceIndex].Commands);
+
 		vkEndCommandBuffer(m_DeferredSync[m_ResourceIndex].Commands);
 
 		m_DeferredSync[m_ResourceIndex].waitStages = { };
@@ -807,9 +778,12 @@ void VulkanBase::EndFrame()
 		submitInfo.pWaitDstStageMask = m_DeferredSync[m_ResourceIndex].waitStages.data();
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &m_DeferredSync[m_ResourceIndex].Commands;
-		submitInfo.signalSemaphoreCount = m_DeferredSync[m_ResourceIndex].Semaphores.size();
+		// second semaphore hands the pyramid to the grass culling on async compute
+		submitInfo.signalSemaphoreCount = m_GrassOcclude ? 2 : 1;
 		submitInfo.pSignalSemaphores = m_DeferredSync[m_ResourceIndex].Semaphores.data();
 		m_GraphicsSubmits.push_back(submitInfo);
+
+		m_HiZPending = m_GrassOcclude != nullptr;
 	}
 
 	VkCommandBufferBeginInfo beginInfo{};
@@ -820,7 +794,12 @@ void VulkanBase::EndFrame()
 		vkBeginCommandBuffer(m_ComposeSync[m_ResourceIndex].Commands, &beginInfo);
 
 		m_SpecularLUT[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_ComposeSync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
-		m_DiffuseIrradience[m_ResourceIndex].Image->TransferOwnership(VK_NULL_HANDLE, m_ComposeSync[m_ResourceIndex].Commands, m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex());
+
+		// finished tables of a new atmosphere are converted once no frame in flight samples the spare ones, compute steps are ordered by the cubemap semaphore
+		if (m_AtmosphereBuild && m_AtmosphereBuild->Step == atmosphere_step_count() && !m_AtmosphereBuild->Converted && m_FrameCount >= m_AtmosphereSwapFrame + m_ResourceCount)
+		{
+			atmosphere_convert(m_ComposeSync[m_ResourceIndex].Commands);
+		}
 
 		std::array<VkClearValue, 1> clearValues;
 		clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
@@ -850,13 +829,12 @@ void VulkanBase::EndFrame()
 
 		vkCmdBeginRenderPass(m_ComposeSync[m_ResourceIndex].Commands, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-		m_CompositionDescriptors[m_ResourceIndex]->BindSet(0, m_ComposeSync[m_ResourceIndex].Commands, *m_CompositionPipeline);
+		m_CompositionDescriptors[2 * m_ResourceIndex + m_AtmosphereIndex]->BindSet(0, m_ComposeSync[m_ResourceIndex].Commands, *m_CompositionPipeline);
 		m_CompositionPipeline->BindPipeline(m_ComposeSync[m_ResourceIndex].Commands);
 		vkCmdDraw(m_ComposeSync[m_ResourceIndex].Commands, 3, 1, 0, 0);
 		vkCmdEndRenderPass(m_ComposeSync[m_ResourceIndex].Commands);
 
 		m_SpecularLUT[m_ResourceIndex].Image->TransferOwnership(m_ComposeSync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
-		m_DiffuseIrradience[m_ResourceIndex].Image->TransferOwnership(m_ComposeSync[m_ResourceIndex].Commands, VK_NULL_HANDLE, m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex());
 
 		vkEndCommandBuffer(m_ComposeSync[m_ResourceIndex].Commands);
 
@@ -1135,6 +1113,28 @@ void VulkanBase::_beginTerrainPass() const
 	vkCmdBeginRenderPass(m_DeferredSync[m_ResourceIndex].Commands, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 }
 
+void VulkanBase::hiz_update(VkCommandBuffer cmd)
+{
+	VulkanImage& HiZ = *m_HiZ[m_ResourceIndex].Image;
+	int32_t levels = static_cast<int32_t>(HiZ.GetMipLevelsCount());
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	HiZ.TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+	// every workgroup covers 32x32 texels of the first level, the last one to finish reduces the rest of the chain
+	m_HiZPipeline->BindPipeline(cmd);
+	m_HiZDescriptors[m_ResourceIndex]->BindSet(0, cmd, *m_HiZPipeline);
+	m_HiZPipeline->PushConstants(cmd, &levels, sizeof(int32_t), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+	vkCmdDispatch(cmd, HiZ.GetExtent().width / 32, HiZ.GetExtent().height / 32, 1u);
+
+	HiZ.TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+}
+
 void VulkanBase::_handleResize()
 {
 	Wait();
@@ -1177,6 +1177,7 @@ void VulkanBase::_handleResize()
 	m_NormalViews.resize(0);
 
 	m_DepthHR.resize(0);
+	m_HiZ.resize(0);
 
 	m_HdrAttachmentsLR.resize(0);
 	m_HdrViewsLR.resize(0);
@@ -1227,13 +1228,47 @@ void VulkanBase::SetCloudLayerSettings(CloudLayerProfile settings)
 	m_CloudLayer->Update(&cloudParams, sizeof(CloudParameters));
 }
 
-void VulkanBase::SetTerrainLayerSettings(float Scale, int Count, TerrainLayerProfile* settings)
+void VulkanBase::SetTerrainLayerSettings(float Scale, int Count, TerrainLayerProfile* settings, float PixelError, int RefineOctaves)
 {
 	assert(Count < 100, "Too many layers!");
 
+	m_TerrainPixelError = PixelError;
+	m_TerrainRefineOctaves = glm::max(RefineOctaves, 0);
+
 	m_TerrainLayer->Update(&Count, sizeof(int));
 	m_TerrainLayer->Update(&Scale, sizeof(float), sizeof(int));
 	m_TerrainLayer->Update(settings, Count * sizeof(TerrainLayerProfile), 16u);
+	m_TerrainLayerHash = GR::Utils::Hash64(settings, Count * sizeof(TerrainLayerProfile), GR::Utils::Hash64(&Scale, sizeof(float)));
+
+	// heights no longer match the stored ones, every layer is evaluated from scratch
+	for (std::vector<TerrainLevelState>& levels : m_TerrainLevels)
+	{
+		for (TerrainLevelState& level : levels)
+			level.Valid = false;
+	}
+
+	// stored tiles are keyed by the layer hash
+	if (!m_TerrainTileSlotUse.empty())
+		terrain_cache_open();
+
+	m_ErosionReset = true;
+}
+
+void VulkanBase::SetTerrainTileCache(const std::string& directory)
+{
+	m_TerrainCachePath = directory;
+
+	// without terrain there is nothing to open yet, terrain_init picks the path up
+	if (!m_TerrainTileSlotUse.empty())
+		terrain_cache_open();
+}
+
+void VulkanBase::SetTerrainErosion(uint32_t DropletsPerFrame)
+{
+	m_ErosionDroplets = DropletsPerFrame;
+
+	// pass length depends on the budget, so the running pass is started over
+	m_ErosionReset = true;
 }
 
 #pragma region Initialization
@@ -1299,6 +1334,9 @@ VkBool32 VulkanBase::create_swapchain_images()
 	m_SwapchainViews.resize(imagesCount);
 
 	m_DepthHR.resize(m_ResourceCount);
+	m_HiZ.resize(m_ResourceCount);
+	m_HiZCounters.resize(m_ResourceCount);
+	m_FrameViewProjection.resize(m_ResourceCount, glm::dmat4(0.0));
 
 	m_HdrAttachmentsHR.resize(m_ResourceCount);
 	m_HdrViewsHR.resize(m_ResourceCount);
@@ -1402,6 +1440,43 @@ VkBool32 VulkanBase::create_swapchain_images()
 		depthRange.baseMipLevel = 1;
 		m_DepthHR[i].Views.push_back(std::make_unique<VulkanImageView>(m_Scope, *m_DepthHR[i].Image, depthRange));
 
+		// built on the graphics queue and read by async compute every frame, concurrent sharing saves the ownership transfers
+		// first level is padded to whole workgroup tiles, so the levels built inside a tile halve exactly
+		VkImageCreateInfo hizInfo = hdrInfo;
+		hizInfo.format = VK_FORMAT_R32G32_SFLOAT;
+		hizInfo.extent = { (m_Scope.GetSwapchainExtent().width + 63) / 64 * 32, (m_Scope.GetSwapchainExtent().height + 63) / 64 * 32, 1 };
+		hizInfo.mipLevels = glm::min(static_cast<uint32_t>(std::floor(std::log2(std::max(hizInfo.extent.width, hizInfo.extent.height)))) + 1, HiZMaxLevels);
+		hizInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		hizInfo.sharingMode = queueFamilies.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+		hizInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		m_HiZ[i].Image = std::make_unique<VulkanImage>(m_Scope, hizInfo, allocCreateInfo);
+
+		// nothing is occluded until the first pyramid is built
+		m_HiZ[i].Image->TransitionLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL).ClearImage(0.f);
+		m_HiZ[i].Views.push_back(std::make_unique<VulkanImageView>(m_Scope, *m_HiZ[i].Image));
+
+		VkImageSubresourceRange hizRange = m_HiZ[i].Image->GetSubResourceRange();
+		hizRange.levelCount = 1;
+		for (uint32_t mip = 0; mip < hizInfo.mipLevels; mip++)
+		{
+			hizRange.baseMipLevel = mip;
+			m_HiZ[i].Views.push_back(std::make_unique<VulkanImageView>(m_Scope, *m_HiZ[i].Image, hizRange));
+		}
+
+		// workgroups count themselves here to find the last one, which resets it afterwards
+		VkBufferCreateInfo counterInfo{};
+		counterInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		counterInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		counterInfo.size = sizeof(uint32_t);
+		counterInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+		VmaAllocationCreateInfo counterAllocInfo{};
+		counterAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+		uint32_t counter = 0u;
+		m_HiZCounters[i] = std::make_unique<Buffer>(m_Scope, counterInfo, counterAllocInfo);
+		m_HiZCounters[i]->Update(&counter, sizeof(uint32_t));
+
 		hdrInfo.extent.width /= LRr;
 		hdrInfo.extent.height /= LRr;
 		hdrInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
@@ -1468,6 +1543,16 @@ VkBool32 VulkanBase::create_frame_pipelines()
 		.SetShaderName("blur_setup_comp")
 		.Construct(m_Scope);
 
+	VkPushConstantRange ConstantHiZ{};
+	ConstantHiZ.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	ConstantHiZ.size = sizeof(int32_t);
+
+	m_HiZPipeline = ComputePipelineDescriptor()
+		.AddDescriptorLayout(m_HiZDescriptors[0]->GetLayout())
+		.AddPushConstant(ConstantHiZ)
+		.SetShaderName("hiz_build_comp")
+		.Construct(m_Scope);
+
 	m_BlurHorizontalPipeline = ComputePipelineDescriptor()
 		.AddDescriptorLayout(m_BlurDescriptors[0]->GetLayout())
 		.SetShaderName("blur_horizontal_comp")
@@ -1568,31 +1653,38 @@ VkBool32 VulkanBase::create_frame_descriptors()
 	VkSampler SamplerRepeat = m_Scope.GetSampler(ESamplerType::LinearRepeat, 1);
 
 	m_BlendingDescriptors.resize(m_ResourceCount);
-	m_CompositionDescriptors.resize(m_ResourceCount);
+	m_CompositionDescriptors.resize(2 * m_ResourceCount);
 	m_PostProcessDescriptors.resize(m_ResourceCount);
 	m_TemporalVolumetrics.resize(m_ResourceCount);
 	m_BlurDescriptors.resize(m_ResourceCount);
 	m_SubpassDescriptors.resize(m_ResourceCount);
 
+	m_HiZDescriptors.resize(m_ResourceCount);
+	m_HiZSets.resize(m_ResourceCount);
+
 	for (uint32_t i = 0; i < m_ResourceCount; i++)
 	{
-		m_CompositionDescriptors[i] = DescriptorSetDescriptor()
-			.AddUniformBuffer(0, VK_SHADER_STAGE_FRAGMENT_BIT, *m_UBOBuffers[i])
-			.AddImageSampler(1, VK_SHADER_STAGE_FRAGMENT_BIT, m_HdrViewsHR[i]->GetImageView(), SamplerPoint, VK_IMAGE_LAYOUT_GENERAL)
-			.AddImageSampler(2, VK_SHADER_STAGE_FRAGMENT_BIT, m_NormalViews[i]->GetImageView(), SamplerPoint)
-			.AddImageSampler(3, VK_SHADER_STAGE_FRAGMENT_BIT, m_DeferredViews[i]->GetImageView(), SamplerPoint)
-			.AddImageSampler(4, VK_SHADER_STAGE_FRAGMENT_BIT, m_DepthHR[i].Views[0]->GetImageView(), SamplerPoint)
-			.AddImageSampler(5, VK_SHADER_STAGE_FRAGMENT_BIT, m_TransmittanceLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(6, VK_SHADER_STAGE_FRAGMENT_BIT, m_IrradianceLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(7, VK_SHADER_STAGE_FRAGMENT_BIT, m_ScatteringLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(8, VK_SHADER_STAGE_FRAGMENT_BIT, m_DiffuseIrradience[i].View->GetImageView(), SamplerLinear)
-			.AddImageSampler(9, VK_SHADER_STAGE_FRAGMENT_BIT, m_SpecularLUT[i].Views[0]->GetImageView(), m_Scope.GetSampler(ESamplerType::LinearClamp, m_SpecularLUT[i].Views[0]->GetSubresourceRange().levelCount))
-			.AddImageSampler(10, VK_SHADER_STAGE_FRAGMENT_BIT, m_BRDFLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(11, VK_SHADER_STAGE_FRAGMENT_BIT, m_VolumeShape.View->GetImageView(), m_Scope.GetSampler(ESamplerType::LinearClamp, m_VolumeShape.View->GetSubresourceRange().levelCount))
-			.AddImageSampler(12, VK_SHADER_STAGE_FRAGMENT_BIT, m_VolumeWeather.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeather.View->GetSubresourceRange().levelCount))
-			.AddImageSampler(13, VK_SHADER_STAGE_FRAGMENT_BIT, m_VolumeWeatherCube.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeatherCube.View->GetSubresourceRange().levelCount))
-			.AddUniformBuffer(14, VK_SHADER_STAGE_FRAGMENT_BIT, *m_CloudLayer)
-			.Allocate(m_Scope);
+		// a set per atmosphere tables
+		for (uint32_t k = 0; k < 2; k++)
+		{
+			m_CompositionDescriptors[2 * i + k] = DescriptorSetDescriptor()
+				.AddUniformBuffer(0, VK_SHADER_STAGE_FRAGMENT_BIT, *m_UBOBuffers[i])
+				.AddImageSampler(1, VK_SHADER_STAGE_FRAGMENT_BIT, m_HdrViewsHR[i]->GetImageView(), SamplerPoint, VK_IMAGE_LAYOUT_GENERAL)
+				.AddImageSampler(2, VK_SHADER_STAGE_FRAGMENT_BIT, m_NormalViews[i]->GetImageView(), SamplerPoint)
+				.AddImageSampler(3, VK_SHADER_STAGE_FRAGMENT_BIT, m_DeferredViews[i]->GetImageView(), SamplerPoint)
+				.AddImageSampler(4, VK_SHADER_STAGE_FRAGMENT_BIT, m_DepthHR[i].Views[0]->GetImageView(), SamplerPoint)
+				.AddImageSampler(5, VK_SHADER_STAGE_FRAGMENT_BIT, m_TransmittanceLUT[k].View->GetImageView(), SamplerLinear)
+				.AddImageSampler(6, VK_SHADER_STAGE_FRAGMENT_BIT, m_IrradianceLUT[k].View->GetImageView(), SamplerLinear)
+				.AddImageSampler(7, VK_SHADER_STAGE_FRAGMENT_BIT, m_ScatteringLUT[k].View->GetImageView(), SamplerLinear)
+				.AddStorageBuffer(8, VK_SHADER_STAGE_FRAGMENT_BIT, *m_IrradianceSH[i])
+				.AddImageSampler(9, VK_SHADER_STAGE_FRAGMENT_BIT, m_SpecularLUT[i].Views[0]->GetImageView(), m_Scope.GetSampler(ESamplerType::LinearClamp, m_SpecularLUT[i].Views[0]->GetSubresourceRange().levelCount))
+				.AddImageSampler(10, VK_SHADER_STAGE_FRAGMENT_BIT, m_BRDFLUT.View->GetImageView(), SamplerLinear)
+				.AddImageSampler(11, VK_SHADER_STAGE_FRAGMENT_BIT, m_VolumeShape.View->GetImageView(), m_Scope.GetSampler(ESamplerType::LinearClamp, m_VolumeShape.View->GetSubresourceRange().levelCount))
+				.AddImageSampler(12, VK_SHADER_STAGE_FRAGMENT_BIT, m_VolumeWeather.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeather.View->GetSubresourceRange().levelCount))
+				.AddImageSampler(13, VK_SHADER_STAGE_FRAGMENT_BIT, m_VolumeWeatherCube.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeatherCube.View->GetSubresourceRange().levelCount))
+				.AddUniformBuffer(14, VK_SHADER_STAGE_FRAGMENT_BIT, *m_CloudLayer)
+				.Allocate(m_Scope);
+		}
 
 		m_PostProcessDescriptors[i] = DescriptorSetDescriptor()
 			.AddImageSampler(0, VK_SHADER_STAGE_FRAGMENT_BIT, m_HdrViewsHR[i]->GetImageView(), SamplerLinear)
@@ -1627,13 +1719,31 @@ VkBool32 VulkanBase::create_frame_descriptors()
 			.AddSubpassAttachment(3, VK_SHADER_STAGE_FRAGMENT_BIT, m_DepthHR[i].Views[0]->GetImageView(), VK_IMAGE_LAYOUT_GENERAL)
 			.Allocate(m_Scope);
 
-		if (m_GrassDrawSet.size() > 0)
+		// levels past the end of the chain repeat the last one, so the whole array is valid
+		std::vector<VkImageView> hizLevels(HiZMaxLevels);
+		for (uint32_t mip = 0; mip < HiZMaxLevels; mip++)
+		{
+			hizLevels[mip] = m_HiZ[i].Views[glm::min<size_t>(mip + 1, m_HiZ[i].Views.size() - 1)]->GetImageView();
+		}
+
+		m_HiZDescriptors[i] = DescriptorSetDescriptor()
+			.AddImageSampler(0, VK_SHADER_STAGE_COMPUTE_BIT, m_DepthHR[i].Views[0]->GetImageView(), SamplerPoint)
+			.AddStorageImages(1, VK_SHADER_STAGE_COMPUTE_BIT, hizLevels)
+			.AddStorageBuffer(2, VK_SHADER_STAGE_COMPUTE_BIT, *m_HiZCounters[i])
+			.Allocate(m_Scope);
+
+		m_HiZSets[i] = DescriptorSetDescriptor()
+			.AddImageSampler(0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, m_HiZ[i].Views[0]->GetImageView(), m_Scope.GetSampler(ESamplerType::PointClamp, m_HiZ[i].Image->GetMipLevelsCount()))
+			.Allocate(m_Scope);
+
+		if (m_GrassOcclude)
 		{
 			m_GrassDrawSet[i] = DescriptorSetDescriptor()
-				.AddImageSampler(0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearClamp, 1))
-				.AddStorageBuffer(1, VK_SHADER_STAGE_VERTEX_BIT, *TerrainVBs[i])
-				.AddStorageBuffer(2, VK_SHADER_STAGE_VERTEX_BIT, *m_GrassPositions[i])
+				.AddImageSampler(0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, 1))
+				.AddStorageBuffer(1, VK_SHADER_STAGE_VERTEX_BIT, *m_TerrainReference)
+				.AddStorageBuffer(2, VK_SHADER_STAGE_VERTEX_BIT, *m_GrassInstances[i])
 				.AddImageSampler(3, VK_SHADER_STAGE_VERTEX_BIT, m_DepthHR[i].Views[1]->GetImageView(), m_Scope.GetSampler(ESamplerType::PointClamp, 1))
+				.AddStorageBuffer(4, VK_SHADER_STAGE_VERTEX_BIT, *m_TerrainOrigins[i])
 				.Allocate(m_Scope);
 		}
 	}
@@ -1695,9 +1805,30 @@ std::unique_ptr<VulkanTexture> VulkanBase::_loadImage(const std::vector<std::str
 entt::entity VulkanBase::_constructShape(entt::entity ent, entt::registry& registry, const GR::Shapes::GeoClipmap& shape)
 {
 	PBRObject& gro = registry.emplace_or_replace<PBRObject>(ent);
-	gro.mesh = shape.Generate(m_Scope, nullptr);
+	std::vector<TerrainVertex> lattice;
+	gro.mesh = shape.GenerateFootprints(m_Scope, m_TerrainFootprints, m_TerrainLevelVertices, &lattice);
+
+	// only vertices of the reference lattice are used, heights are evaluated for them and footprints read the result
+	std::vector<uint32_t> queueFamilies = FindDeviceQueues(m_Scope.GetPhysicalDevice(), { VK_QUEUE_GRAPHICS_BIT, VK_QUEUE_COMPUTE_BIT });
+	std::sort(queueFamilies.begin(), queueFamilies.end());
+	queueFamilies.resize(std::distance(queueFamilies.begin(), std::unique(queueFamilies.begin(), queueFamilies.end())));
+
+	VkBufferCreateInfo referenceInfo{};
+	referenceInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	referenceInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	referenceInfo.sharingMode = queueFamilies.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+	referenceInfo.queueFamilyIndexCount = queueFamilies.size();
+	referenceInfo.pQueueFamilyIndices = queueFamilies.data();
+	referenceInfo.size = sizeof(TerrainVertex) * lattice.size();
+
+	VmaAllocationCreateInfo referenceAlloc{};
+	referenceAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-	const_cast<VulkanBase*>(this)->terrain_init(*gro.mesh->GetVertexBuffer(), shape);
+	std::shared_ptr<Buffer> reference = std::make_shared<Buffer>(m_Scope, referenceInfo, referenceAlloc);
+	reference->Update(lattice.data());
+	m_TerrainReference = reference;
+
+	const_cast<VulkanBase*>(this)->terrain_init(*m_TerrainReference, shape);
 
 	gro.descriptorSet = create_terrain_set(*m_DefaultWhite->Views[1], *m_DefaultNormal->Views[1], *m_DefaultARM->Views[1]);
 	gro.pipeline = create_terrain_pipeline(*gro.descriptorSet, shape);
@@ -1713,9 +1844,19 @@ entt::entity VulkanBase::_constructShape(entt::entity ent, entt::registry& regis
 {
 	PBRObject& gro = registry.emplace_or_replace<PBRObject>(ent);
 	gro.descriptorSet = create_pbr_set(*m_DefaultWhite->Views[0], *m_DefaultNormal->Views[0], *m_DefaultARM->Views[0]);
-	gro.pipeline = create_pbr_pipeline(*gro.descriptorSet);
 	gro.mesh = shape.Generate(m_Scope, geometry);
 
+	// layout is the same for every pbr object, so is the pipeline, only vertex format differs
+	std::shared_ptr<GraphicsPipeline>& pipeline = gro.mesh->IsPacked() ? m_PBRPackedPipeline : m_PBRPipeline;
+	if (!pipeline)
+	{
+		pipeline = create_pbr_pipeline(*gro.descriptorSet, gro.mesh->IsPacked());
+	}
+
+	gro.pipeline = pipeline;
+
+	registry.emplace_or_replace<GR::Components::LODGroup>(ent).Levels = gro.mesh->GetLODCount();
+
 	registry.emplace_or_replace<GR::Components::AlbedoMap>(ent, m_DefaultWhite, &gro.dirty);
 	registry.emplace_or_replace<GR::Components::NormalDisplacementMap>(ent, m_DefaultNormal, &gro.dirty);
 	registry.emplace_or_replace<GR::Components::AORoughnessMetallicMapTransmittance>(ent, m_DefaultWhite, &gro.dirty);
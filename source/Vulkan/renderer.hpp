@@ -13,6 +13,8 @@
 #include "Engine/structs.hpp"
 #include "Engine/shapes.hpp"
 #include "Engine/world.hpp"
+#include "Engine/terrain_cache.hpp"
+#include "Engine/atmosphere_cache.hpp"
 
 #ifdef INCLUDE_GUI
 #include "imgui/imgui.h"
@@ -176,7 +178,13 @@ namespace GR
 
 		virtual void SetCloudLayerSettings(CloudLayerProfile settings) = 0;
 
-		virtual void SetTerrainLayerSettings(float Scale, int Count, TerrainLayerProfile* settings) = 0;
+		virtual void SetAtmosphereProfile(AtmosphereProfile profile) = 0;
+
+		virtual void SetTerrainLayerSettings(float Scale, int Count, TerrainLayerProfile* settings, float PixelError = 0.5f, int RefineOctaves = 1) = 0;
+
+		virtual void SetTerrainTileCache(const std::string& directory) = 0;
+
+		virtual void SetTerrainErosion(uint32_t DropletsPerFrame) = 0;
 
 #ifdef INCLUDE_GUI
 		ImGuiContext* GetImguiContext() const { return m_GuiContext; }
@@ -228,9 +236,30 @@ private:
 		float TopBound;
 		float BoundDelta;
 	} cloudParams;
+	/*
+	* !@brief Placement of a clipmap level, recorded when its LUT layer is evaluated
+	*/
+	struct TerrainLevelState
+	{
+		glm::dvec3 Center = glm::dvec3(0.0);
+		glm::dvec3 Up = glm::dvec3(0.0);
+		glm::ivec2 Origin = glm::ivec2(0);
+		float VertexScale = 0.f;
+		// lowest octave budget among the stored texels, -1 if octaves are scaled by level only
+		int Octaves = 0;
+		// quadtree depth of the cached tiles the layer was read from, -1 if it was evaluated directly
+		int TileLevel = -1;
+		bool Valid = false;
+	};
 
 	const uint32_t LRr = 2;
 	const uint32_t CubeR = 128;
+	const uint32_t TerrainTileSize = 64;
+	const uint32_t TerrainTileSlots = 256;
+	const uint32_t TerrainTileBudget = 8;
+	const uint32_t TerrainTileProbes = 16;
+	const uint32_t GrassLODs = 3;
+	const uint32_t HiZMaxLevels = 16;
 
 	friend class GR::Window;
 
@@ -250,6 +279,16 @@ private:
 	std::vector<VkImageView> m_SwapchainViews = {};
 
 	std::vector<VulkanTextureMultiView> m_DepthHR = {};
+	// min/max depth pyramid of the deferred pass, layout is described in hiz.glsl, view 0 holds every mip, view 1 + n only mip n
+	std::vector<VulkanTextureMultiView> m_HiZ = {};
+	std::vector<std::unique_ptr<Buffer>> m_HiZCounters = {};
+	std::vector<std::unique_ptr<DescriptorSet>> m_HiZDescriptors = {};
+	// pyramid of every resource for the passes reading it, a single sampler at binding 0
+	std::vector<std::unique_ptr<DescriptorSet>> m_HiZSets = {};
+	// view projection every resource was rendered with
+	std::vector<glm::dmat4> m_FrameViewProjection = {};
+	// last deferred pass signaled the pyramid semaphore, the next terrain pass has to wait for it
+	bool m_HiZPending = false;
 	
 	// std::vector<std::unique_ptr<VulkanImage>> m_DepthAttachmentsHR = {};
 	// std::vector<std::unique_ptr<VulkanImageView>> m_DepthViewsHR = {};
@@ -285,6 +324,7 @@ private:
 	std::unique_ptr<ComputePipeline> m_BlurSetupPipeline = VK_NULL_HANDLE;
 	std::unique_ptr<ComputePipeline> m_BlurHorizontalPipeline = VK_NULL_HANDLE;
 	std::unique_ptr<ComputePipeline> m_BlurVerticalPipeline = VK_NULL_HANDLE;
+	std::unique_ptr<ComputePipeline> m_HiZPipeline = VK_NULL_HANDLE;
 
 	std::vector<std::unique_ptr<DescriptorSet>> m_SubpassDescriptors = {};
 	std::vector<std::unique_ptr<DescriptorSet>> m_BlendingDescriptors = {};
@@ -307,7 +347,8 @@ private:
 	*/
 	std::vector<std::unique_ptr<DescriptorSet>> m_TemporalVolumetrics = {};
 
-	std::unique_ptr<DescriptorSet> m_VolumetricsDescriptor = VK_NULL_HANDLE;
+	// one per set of atmosphere tables
+	std::vector<std::unique_ptr<DescriptorSet>> m_VolumetricsDescriptors = {};
 	std::vector<std::unique_ptr<DescriptorSet>> m_UBOSkySets = {};
 
 	std::vector<std::unique_ptr<Buffer>> m_UBOSkyBuffers = {};
@@ -325,30 +366,142 @@ private:
 	/*
 	* Atmosphere resources
 	*/
-	VulkanTexture m_ScatteringLUT = {};
-	VulkanTexture m_IrradianceLUT = {};
-	VulkanTexture m_TransmittanceLUT = {};
+	// two sets of tables, new frames sample m_AtmosphereIndex while the spare one receives the next profile
+	std::vector<VulkanTexture> m_ScatteringLUT = {};
+	std::vector<VulkanTexture> m_IrradianceLUT = {};
+	std::vector<VulkanTexture> m_TransmittanceLUT = {};
+	uint32_t m_AtmosphereIndex = 0u;
+	// frame the current tables were swapped in with, frames recorded before it sample the spare ones
+	uint64_t m_AtmosphereSwapFrame = 0u;
+	// scattering model the current tables were computed with
+	AtmosphereParameters m_Atmosphere = {};
+	// cache file of the last published tables, written off the render thread
+	std::future<bool> m_AtmosphereStore = {};
+#if DEBUG == 1
+	// error of the current tables against the fp32 ones they were converted from
+	std::array<AtmosphereFormatError, 3> m_AtmosphereFormatErrors = {};
+#endif
+	/*
+	* !@brief Tables of the next profile, they are computed a step per frame, converted into the spare tables and swapped in once complete
+	*/
+	struct AtmosphereBuild
+	{
+		AtmosphereParameters Parameters = {};
+		GR::AtmosphereCache::Key Key = {};
+		std::string CachePath = {};
+		// false if the tables were read from the cache
+		bool Store = true;
+		uint32_t Step = 0u;
+		// conversion into the spare tables was recorded
+		bool Converted = false;
+		// first frame after the fences of the last cache upload or conversion, nothing in use is touched before it
+		uint64_t IdleFrame = 0u;
+
+		// cache file contents uploaded by the first step
+		std::unique_ptr<Buffer> Staging = {};
+		// fp32 tables copied by the conversion, followed by the converted ones in debug
+		std::unique_ptr<Buffer> Readback = {};
+
+		VulkanTexture Scattering = {};
+		VulkanTexture Irradiance = {};
+		VulkanTexture Transmittance = {};
+
+		VulkanTexture DeltaE = {};
+		VulkanTexture DeltaSR = {};
+		VulkanTexture DeltaSM = {};
+		VulkanTexture DeltaJ = {};
+
+		std::unique_ptr<DescriptorSet> TrDSO;
+		std::unique_ptr<DescriptorSet> DeltaEDSO;
+		std::unique_ptr<DescriptorSet> DeltaSRSMDSO;
+		std::unique_ptr<DescriptorSet> SingleScatterDSO;
+		std::unique_ptr<DescriptorSet> DeltaJDSO;
+		std::unique_ptr<DescriptorSet> DeltaEnDSO;
+		std::unique_ptr<DescriptorSet> DeltaSDSO;
+		std::unique_ptr<DescriptorSet> AddEDSO;
+		std::unique_ptr<DescriptorSet> AddSDSO;
+
+		std::unique_ptr<ComputePipeline> GenTrLUT;
+		std::unique_ptr<ComputePipeline> GenDeltaELUT;
+		std::unique_ptr<ComputePipeline> GenDeltaSRSMLUT;
+		std::unique_ptr<ComputePipeline> GenSingleScatterLUT;
+		std::unique_ptr<ComputePipeline> GenDeltaJLUT;
+		std::unique_ptr<ComputePipeline> GenDeltaEnLUT;
+		std::unique_ptr<ComputePipeline> GenDeltaSLUT;
+		std::unique_ptr<ComputePipeline> AddE;
+		std::unique_ptr<ComputePipeline> AddS;
+	};
+	std::unique_ptr<AtmosphereBuild> m_AtmosphereBuild = {};
+	// push constants of the precompute shaders, see LUT.glsl
+	struct AtmospherePushConstants
+	{
+		AtmosphereParameters Atmosphere;
+		int Sample;
+		int Layer;
+	};
+	const uint32_t AtmosphereOrders = 4;
+	// slices of the R axis every multiple scattering order is split into
+	const uint32_t AtmosphereSlices = 4;
 	/*
 	* PBR resources
 	*/
 	std::unique_ptr<ComputePipeline> m_CubemapPipeline = VK_NULL_HANDLE;
 	std::unique_ptr<ComputePipeline> m_CubemapMipPipeline = VK_NULL_HANDLE;
-	std::unique_ptr<ComputePipeline> m_ConvolutionPipeline = VK_NULL_HANDLE;
+	std::unique_ptr<ComputePipeline> m_IrradianceSHPipeline = VK_NULL_HANDLE;
 	std::unique_ptr<ComputePipeline> m_SpecularIBLPipeline = VK_NULL_HANDLE;
 
+	std::unique_ptr<ComputePipeline> m_IBLBlendPipeline = VK_NULL_HANDLE;
+
 	std::vector<std::unique_ptr<DescriptorSet>> m_CubemapDescriptors = {};
 	std::vector<std::unique_ptr<DescriptorSet>> m_CubemapMipDescriptors = {};
 	std::vector<std::unique_ptr<DescriptorSet>> m_ConvolutionDescriptors = {};
 	std::vector<std::unique_ptr<DescriptorSet>> m_SpecularDescriptors = {};
-	std::vector<std::unique_ptr<DescriptorSet>> m_DiffuseDescriptors = {};
+	std::unique_ptr<DescriptorSet> m_IrradianceSHDescriptors = VK_NULL_HANDLE;
+	std::vector<std::unique_ptr<DescriptorSet>> m_IBLBlendDescriptors = {};
 
-	std::unique_ptr<Buffer> m_DiffusePrecompute = VK_NULL_HANDLE;
 	std::unique_ptr<Buffer> m_SpecularPrecompute = VK_NULL_HANDLE;
+	// first sample and sample count of every specular mip in m_SpecularPrecompute
+	std::vector<glm::uvec2> m_SpecularSampleRanges = {};
 
 	VulkanTexture m_BRDFLUT = {};
-	std::vector<VulkanTexture> m_DiffuseIrradience = {};
-	std::vector<VulkanTextureMultiView> m_CubemapLUT = {};
+	// sampled by the frames in flight, every copy fades towards the targets on its own
+	std::vector<std::unique_ptr<Buffer>> m_IrradianceSH = {};
 	std::vector<VulkanTextureMultiView> m_SpecularLUT = {};
+	// only used on compute queue, rebuilt a slice per frame
+	VulkanTextureMultiView m_CubemapLUT = {};
+	std::unique_ptr<Buffer> m_IrradianceSHTarget = VK_NULL_HANDLE;
+	VulkanTextureMultiView m_SpecularTarget = {};
+	/*
+	* !@brief Progress of the amortized IBL update
+	*/
+	struct IBLState
+	{
+		// sky the targets were last built for
+		glm::vec3 SunDirection = glm::vec3(0.0);
+		glm::vec3 Up = glm::vec3(0.0);
+		double Radius = 0.0;
+		// next slice of the running update, 0 if there is none
+		uint32_t Slice = 0u;
+		// sky moved or the atmosphere changed since the targets were built
+		bool Dirty = true;
+		// fade of the sampled copies towards the latest targets, in [0, 1], negative until the first update finished
+		float Fade = -1.0;
+		// fade every copy has reached, negative if it was never written
+		std::vector<float> CopyFade = {};
+	} m_IBL;
+	struct IBLBlendPushConstants
+	{
+		float Blend;
+		int Irradiance;
+	};
+	// cos of the sun or zenith rotation and relative change of the altitude which start a new update
+	const float IBLAngleThreshold = 0.99995f;
+	const double IBLAltitudeThreshold = 0.01;
+	// frames the sampled copies take to fade into the new targets
+	const uint32_t IBLFadeFrames = 16;
+	// importance samples of the first prefiltered specular mip, doubled for every next one
+	const uint32_t IBLSpecularSamples = 16;
+	const uint32_t IBLSpecularMaxSamples = 1024;
 	/*
 	* Terrain resources
 	*/
@@ -357,12 +510,16 @@ private:
 	std::unique_ptr<ComputePipeline> m_TerrainCompose = {};
 	std::unique_ptr<ComputePipeline> m_GrassOcclude   = {};
 	std::unique_ptr<GraphicsPipeline> m_GrassPipeline = {};
+	// compute stage supports subgroup ballot and arithmetic
+	bool m_SubgroupCompaction = false;
 
 	std::unique_ptr<Buffer> m_TerrainLayer = {};
-	std::unique_ptr<Buffer> m_GrassIndirectRef = {};
+	// draw command of every grass ring and blade LOD, each one has room for all instances of its ring
 	std::vector<std::unique_ptr<Buffer>> m_GrassIndirect  = {};
-	std::vector<std::unique_ptr<Buffer>> m_GrassPositions = {};
-	std::vector<std::unique_ptr<Buffer>> TerrainVBs = {};
+	std::vector<std::unique_ptr<Buffer>> m_GrassInstances = {};
+	std::vector<std::unique_ptr<Buffer>> m_GrassCounters  = {};
+	std::shared_ptr<const Buffer> m_TerrainReference = {};
+	std::vector<GR::Shapes::GeoClipmap::FootprintDraw> m_TerrainFootprints = {};
 
 	std::vector<VulkanTexture> m_TerrainLUT = {};
 
@@ -371,7 +528,50 @@ private:
 	std::vector<std::unique_ptr<DescriptorSet>> m_GrassSet = {};
 	std::vector<std::unique_ptr<DescriptorSet>> m_GrassDrawSet = {};
 
-	uint32_t m_TerrainDispatches = 0u;
+	std::vector<std::unique_ptr<Buffer>> m_TerrainOrigins = {};
+	// first reference vertex of every level, followed by the vertex count
+	std::vector<uint32_t> m_TerrainLevelVertices = {};
+	// placement of every level for the current camera and for each LUT in flight
+	std::vector<TerrainLevelState> m_TerrainTracking = {};
+	std::vector<std::vector<TerrainLevelState>> m_TerrainLevels = {};
+	GR::Shapes::GeoClipmap m_TerrainShape = {};
+	float m_TerrainPixelError = 0.5f;
+	int m_TerrainRefineOctaves = 1;
+	/*
+	* Terrain tile cache
+	*/
+	std::unique_ptr<ComputePipeline> m_TerrainTileCompute = {};
+	std::unique_ptr<GR::TerrainCache> m_TerrainCache = {};
+	std::string m_TerrainCachePath = {};
+	uint64_t m_TerrainLayerHash = 0u;
+
+	VulkanTexture m_TerrainTiles = {};
+	std::unique_ptr<Buffer> m_TerrainTileTable = {};
+	std::vector<std::unique_ptr<Buffer>> m_TerrainTileStaging = {};
+	std::vector<std::unique_ptr<DescriptorSet>> m_TerrainTileSet = {};
+	// tiles generated with each staging buffer, stored once its frame is finished
+	std::vector<std::vector<std::pair<uint64_t, uint32_t>>> m_TerrainTileReadback = {};
+	// tile key and the last frame it was needed in for every slot of m_TerrainTiles
+	std::vector<std::pair<uint64_t, uint64_t>> m_TerrainTileSlotUse = {};
+	std::unordered_map<uint64_t, uint32_t> m_TerrainTileResident = {};
+	uint64_t m_TerrainTileFrame = 0u;
+	bool m_TerrainTileTableDirty = false;
+	/*
+	* Terrain erosion
+	*/
+	std::unique_ptr<ComputePipeline> m_WaterCompute = {};
+	// compute queue only, running pass is accumulated in the first half of the layers, finished pass is kept in the second
+	VulkanTexture m_ErosionMap = {};
+	std::vector<VulkanTexture> m_WaterLUT = {};
+	std::vector<std::unique_ptr<DescriptorSet>> m_WaterSet = {};
+	// finished pass each water LUT holds a copy of
+	std::vector<uint64_t> m_WaterVersion = {};
+	uint64_t m_ErosionVersion = 0u;
+	uint32_t m_ErosionDroplets = 4096u;
+	uint32_t m_ErosionFrame = 0u;
+	bool m_ErosionReset = true;
+	// placement of every level the erosion map is addressed with
+	std::vector<TerrainLevelState> m_ErosionPlacement = {};
 	/*
 	* Common
 	*/
@@ -381,6 +581,12 @@ private:
 	std::vector<std::unique_ptr<DescriptorSet>> m_UBOSets = {};
 	std::vector<std::unique_ptr<DescriptorSet>> m_UBOTempSets = {};
 
+	std::shared_ptr<GraphicsPipeline> m_PBRPipeline = {};
+	std::shared_ptr<GraphicsPipeline> m_PBRPackedPipeline = {};
+	mutable std::vector<DrawPacket> m_DrawQueue = {};
+	mutable std::vector<std::pair<uint64_t, uint32_t>> m_DrawKeys = {};
+	mutable std::vector<std::pair<uint64_t, uint32_t>> m_DrawKeysScratch = {};
+
 	VkInstance m_VkInstance = VK_NULL_HANDLE;
 	VkSurfaceKHR m_Surface = VK_NULL_HANDLE;
 
@@ -426,8 +632,45 @@ public:
 	* @param[in] settings - new parameters of cloud rendering
 	*/
 	GRAPI void SetCloudLayerSettings(CloudLayerProfile settings) override;
+	/*
+	* !@brief Change the scattering model of the atmosphere, tables are computed over the next frames on the async compute queue and replace the current ones once complete
+	* 
+	* Planet and atmosphere radii are not part of the profile, they are the Rg and Rt specialization constants shared with terrain and clouds and switching planets is not supported
+	*
+	* @param[in] profile - new scattering model
+	*/
+	GRAPI void SetAtmosphereProfile(AtmosphereProfile profile) override;
+#if DEBUG == 1
+	/*
+	* !@brief Error of the compact atmosphere tables in use against the fp32 ones they were converted from
+	*
+	* @return transmittance, irradiance and scattering errors, updated every time a new profile is swapped in
+	*/
+	GRAPI const std::array<AtmosphereFormatError, 3>& GetAtmosphereFormatErrors() const { return m_AtmosphereFormatErrors; }
+#endif
 
-	GRAPI void SetTerrainLayerSettings(float Scale, int Count, TerrainLayerProfile* settings) override;
+	/*
+	* !@brief Customize terrain noise
+	*
+	* @param[in] Scale - tiling scale of the layer blend mask
+	* @param[in] Count - number of layers in settings
+	* @param[in] settings - parameters of each noise layer
+	* @param[in] PixelError - octaves are dropped once the rest of them projects below this many pixels, 0 disables the budget
+	* @param[in] RefineOctaves - how many octaves the budget may grow by before cached layers are evaluated again
+	*/
+	GRAPI void SetTerrainLayerSettings(float Scale, int Count, TerrainLayerProfile* settings, float PixelError = 0.5f, int RefineOctaves = 1) override;
+	/*
+	* !@brief Keep generated terrain heights on disk and read them back when the same area is visited again
+	*
+	* @param[in] directory - folder to store cache files in, empty string disables the cache
+	*/
+	GRAPI void SetTerrainTileCache(const std::string& directory) override;
+	/*
+	* !@brief Trace erosion droplets over the terrain a few at a time, every texel of the clipmap starts one droplet per pass
+	*
+	* @param[in] DropletsPerFrame - droplets traced each frame on the async compute queue, 0 disables erosion
+	*/
+	GRAPI void SetTerrainErosion(uint32_t DropletsPerFrame) override;
 	/*
 	* !@brief INTERNAL. Import image file into the memory using specified format
 	*
@@ -446,9 +689,17 @@ public:
 	*/
 	entt::entity _constructShape(entt::entity ent, entt::registry& registry, const GR::Shapes::Shape& shape, GR::Shapes::GeometryDescriptor* geometry);
 	/*
-	* 
+	* !@brief INTERNAL. Queues object for the deferred pass, nothing is recorded until _flushObjects
+	*
+	* @param[in] gro - object to draw
+	* @param[in] constants - per draw push constants
+	* @param[in] lod - level of detail of the mesh to draw
+	*/
+	void _drawObject(const PBRObject& gro, const PBRConstants& constants, uint32_t lod = 0u) const;
+	/*
+	* !@brief INTERNAL. Sorts queued objects by state and depth and records them skipping redundant binds
 	*/
-	void _drawObject(const PBRObject& gro, const PBRConstants& constants) const;
+	void _flushObjects() const;
 	/*
 	*
 	*/
@@ -477,21 +728,65 @@ private:
 
 	VkBool32 create_frame_descriptors();
 
+	void hiz_update(VkCommandBuffer cmd);
+
+	void ibl_update(VkCommandBuffer cmd);
+
+	uint32_t ibl_slice_count() const;
+
+	void ibl_slice(VkCommandBuffer cmd, uint32_t slice);
+
+	void ibl_blend(VkCommandBuffer cmd);
+
 	VkBool32 prepare_renderer_resources();
 
 	std::vector<const char*> getRequiredExtensions();
 
 	VkBool32 atmosphere_precompute();
 
+	VkBool32 atmosphere_build(const AtmosphereParameters& parameters);
+
+	uint32_t atmosphere_step_count() const;
+
+	void atmosphere_step(VkCommandBuffer cmd);
+
+	void atmosphere_publish();
+
+	void atmosphere_convert(VkCommandBuffer cmd);
+
+	std::vector<VulkanImage*> atmosphere_build_images() const;
+
+	std::vector<VulkanImage*> atmosphere_front_images(uint32_t index) const;
+
+	std::vector<GR::AtmosphereCache::Table> atmosphere_cache_tables(const std::vector<VulkanImage*>& images) const;
+
+	VkBool32 atmosphere_cache_load(VkCommandBuffer cmd, const std::string& path, const GR::AtmosphereCache::Key& key, const std::vector<VulkanImage*>& images);
+
+	void atmosphere_cache_store(std::string path, GR::AtmosphereCache::Key key, std::vector<GR::AtmosphereCache::Table> tables, std::vector<uint8_t> data);
+
+	uint32_t atmosphere_texel_size(VkFormat format) const;
+
+#if DEBUG == 1
+	std::array<AtmosphereFormatError, 3> atmosphere_format_error(const std::vector<VulkanImage*>& reference, const std::vector<VulkanImage*>& compact, const uint8_t* data) const;
+#endif
+
 	VkBool32 volumetric_precompute();
 
 	VkBool32 brdf_precompute();
 
 	VkBool32 terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap& shape);
 
+	void terrain_update(VkCommandBuffer cmd);
+
+	void terrain_cache_open();
+
+	void terrain_tiles_update(VkCommandBuffer cmd, const std::vector<TerrainLevelState>& levels, float VertexScale, std::vector<int32_t>& outTileLevel);
+
+	void terrain_erosion(VkCommandBuffer cmd);
+
 	std::unique_ptr<DescriptorSet> create_pbr_set(const VulkanImageView& albedo, const VulkanImageView& nh, const VulkanImageView& arm) const;
 	
-	std::unique_ptr<GraphicsPipeline> create_pbr_pipeline(const DescriptorSet& set) const;
+	std::unique_ptr<GraphicsPipeline> create_pbr_pipeline(const DescriptorSet& set, bool packed) const;
 
 	std::unique_ptr<DescriptorSet> create_terrain_set(const VulkanImageView& albedo, const VulkanImageView& nh, const VulkanImageView& arm) const;
 
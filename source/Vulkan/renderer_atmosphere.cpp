@@ -1,48 +1,178 @@
 #include "pch.hpp"
 #include "renderer.hpp"
+#include "Engine/utils.hpp"
+#include <filesystem>
+#include <glm/gtc/packing.hpp>
 
 #define WRAPL(i) (i == 0 ? m_ResourceCount : i) - 1
 #define WRAPR(i) i == m_ResourceCount - 1 ? 0 : i + 1
 
 VkBool32 VulkanBase::atmosphere_precompute()
 {
-	VulkanTexture DeltaE{};
-	VulkanTexture DeltaSR{};
-	VulkanTexture DeltaSM{};
-	VulkanTexture DeltaJ{};
-
-	std::unique_ptr<DescriptorSet> TrDSO;
-	std::unique_ptr<DescriptorSet> DeltaEDSO;
-	std::unique_ptr<DescriptorSet> DeltaSRSMDSO;
-	std::unique_ptr<DescriptorSet> SingleScatterDSO;
-
-	std::unique_ptr<DescriptorSet> DeltaJDSO;
-	std::unique_ptr<DescriptorSet> DeltaEnDSO;
-	std::unique_ptr<DescriptorSet> DeltaSDSO;
-	std::unique_ptr<DescriptorSet> AddEDSO;
-	std::unique_ptr<DescriptorSet> AddSDSO;
-
-	std::unique_ptr<ComputePipeline> GenTrLUT;
-	std::unique_ptr<ComputePipeline> GenDeltaELUT;
-	std::unique_ptr<ComputePipeline> GenDeltaSRSMLUT;
-	std::unique_ptr<ComputePipeline> GenSingleScatterLUT;
-	std::unique_ptr<ComputePipeline> GenDeltaJLUT;
-	std::unique_ptr<ComputePipeline> GenDeltaEnLUT;
-	std::unique_ptr<ComputePipeline> GenDeltaSLUT;
-	std::unique_ptr<ComputePipeline> AddE;
-	std::unique_ptr<ComputePipeline> AddS;
-
-	VkImageSubresourceRange subRes{};
-	subRes.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	subRes.baseArrayLayer = 0;
-	subRes.baseMipLevel = 0;
-	subRes.layerCount = 1;
-	subRes.levelCount = 1;
+	// tables are sampled on both graphics and compute queues, the conversion writes them on graphics
+	std::vector<uint32_t> queueFamilies = { m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_TRANSFER_BIT).GetFamilyIndex() };
+	std::sort(queueFamilies.begin(), queueFamilies.end());
+	queueFamilies.resize(std::distance(queueFamilies.begin(), std::unique(queueFamilies.begin(), queueFamilies.end())));
 
 	VkImageCreateInfo imageCI{};
 	imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	imageCI.arrayLayers = 1;
-	imageCI.extent = { 256, 64, 1u };
+	imageCI.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageCI.mipLevels = 1;
+	imageCI.flags = 0;
+	imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCI.sharingMode = queueFamilies.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+	imageCI.queueFamilyIndexCount = queueFamilies.size();
+	imageCI.pQueueFamilyIndices = queueFamilies.data();
+	// sampled only, the tables are computed in fp32 by the build and converted on publish
+	imageCI.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+	VmaAllocationCreateInfo imageAlloc{};
+	imageAlloc.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+	// ground irradiance is positive rgb, alpha is never read
+	const VkFormat irradianceFormat = m_Scope.GetSupportedFormat({ VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_R16G16B16A16_SFLOAT }, VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT);
+
+	m_TransmittanceLUT.resize(2);
+	m_IrradianceLUT.resize(2);
+	m_ScatteringLUT.resize(2);
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.extent = { 256, 64, 1u };
+		imageCI.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+		m_TransmittanceLUT[i].Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+		m_TransmittanceLUT[i].View = std::make_unique<VulkanImageView>(m_Scope, *m_TransmittanceLUT[i].Image);
+
+		imageCI.extent = { 64u, 16u, 1u };
+		imageCI.format = irradianceFormat;
+		m_IrradianceLUT[i].Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+		m_IrradianceLUT[i].View = std::make_unique<VulkanImageView>(m_Scope, *m_IrradianceLUT[i].Image);
+
+		imageCI.imageType = VK_IMAGE_TYPE_3D;
+		imageCI.extent = { 256u, 128u, 32u };
+		imageCI.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+		m_ScatteringLUT[i].Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+		m_ScatteringLUT[i].View = std::make_unique<VulkanImageView>(m_Scope, *m_ScatteringLUT[i].Image);
+	}
+
+	SetAtmosphereProfile(AtmosphereProfile());
+
+	// nothing is in flight yet, so the first tables are computed and converted right away
+	VkCommandBuffer cmd;
+	const Queue& Compute = m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT);
+	Compute.AllocateCommandBuffers(1, &cmd);
+
+	while (m_AtmosphereBuild->Step < atmosphere_step_count())
+	{
+		::BeginOneTimeSubmitCmd(cmd);
+		atmosphere_step(cmd);
+		::EndCommandBuffer(cmd);
+
+		Compute.Submit(cmd)
+			.Wait();
+	}
+
+	Compute.FreeCommandBuffers(1, &cmd);
+
+	const Queue& Graphics = m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT);
+	Graphics.AllocateCommandBuffers(1, &cmd);
+
+	::BeginOneTimeSubmitCmd(cmd);
+	atmosphere_convert(cmd);
+	::EndCommandBuffer(cmd);
+
+	Graphics.Submit(cmd)
+		.Wait()
+		.FreeCommandBuffers(1, &cmd);
+
+	atmosphere_publish();
+
+	return 1;
+}
+
+void VulkanBase::SetAtmosphereProfile(AtmosphereProfile profile)
+{
+	AtmosphereParameters parameters{};
+	parameters.Rayleigh = glm::vec4(profile.RayleighScattering, profile.RayleighHeight);
+	parameters.Mie = glm::vec4(profile.MieScattering, profile.MieHeight);
+	parameters.MieExtinction = glm::vec4(profile.MieScattering / glm::max(profile.MieAlbedo, 1e-3f), profile.MieG);
+	parameters.Ozone = glm::vec4(profile.OzoneAbsorption, profile.OzoneCenter);
+	parameters.Light = glm::vec4(profile.OzoneWidth, profile.SunIntensity, 0.0, 0.0);
+
+	// a build in progress starts over with the new parameters
+	atmosphere_build(parameters);
+}
+
+VkBool32 VulkanBase::atmosphere_build(const AtmosphereParameters& parameters)
+{
+	// tables in progress are reused, every step is ordered after the ones already submitted on the compute queue
+	if (!m_AtmosphereBuild)
+	{
+		m_AtmosphereBuild = std::make_unique<AtmosphereBuild>();
+
+		// computed on async compute, converted on graphics
+		std::vector<uint32_t> queueFamilies = { m_Scope.GetQueue(VK_QUEUE_GRAPHICS_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT).GetFamilyIndex(), m_Scope.GetQueue(VK_QUEUE_TRANSFER_BIT).GetFamilyIndex() };
+		std::sort(queueFamilies.begin(), queueFamilies.end());
+		queueFamilies.resize(std::distance(queueFamilies.begin(), std::unique(queueFamilies.begin(), queueFamilies.end())));
+
+		VkImageCreateInfo imageCI{};
+		imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCI.arrayLayers = 1;
+		imageCI.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		imageCI.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageCI.mipLevels = 1;
+		imageCI.flags = 0;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.sharingMode = queueFamilies.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+		imageCI.queueFamilyIndexCount = queueFamilies.size();
+		imageCI.pQueueFamilyIndices = queueFamilies.data();
+		imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+		VmaAllocationCreateInfo imageAlloc{};
+		imageAlloc.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+		for (std::pair<VulkanTexture*, const VulkanTexture*> table : { std::make_pair(&m_AtmosphereBuild->Transmittance, &m_TransmittanceLUT[0]),
+			std::make_pair(&m_AtmosphereBuild->Irradiance, &m_IrradianceLUT[0]), std::make_pair(&m_AtmosphereBuild->Scattering, &m_ScatteringLUT[0]) })
+		{
+			imageCI.extent = table.second->Image->GetExtent();
+			imageCI.imageType = imageCI.extent.depth > 1u ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+
+			table.first->Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+			table.first->View = std::make_unique<VulkanImageView>(m_Scope, *table.first->Image);
+		}
+	}
+
+	AtmosphereBuild& build = *m_AtmosphereBuild;
+	build.Parameters = parameters;
+	build.Step = 0u;
+	build.Store = true;
+	build.Converted = false;
+
+	// tables only depend on the planet and the scattering model, so known profiles skip the whole precompute
+	build.Key = GR::AtmosphereCache::MakeKey(Rg, Rt, { "transmittance_comp", "deltaE_comp", "deltaSRSM_comp", "singleScattering_comp",
+		"deltaJ_comp", "deltaEn_comp", "deltaS_comp", "addE_comp", "addS_comp" });
+	build.Key.ProfileHash = GR::Utils::Hash64(&parameters, sizeof(AtmosphereParameters));
+
+	char cacheName[64];
+	snprintf(cacheName, sizeof(cacheName), "atmosphere_%016llx.bin", static_cast<unsigned long long>(GR::Utils::Hash64(&build.Key, sizeof(build.Key))));
+	build.CachePath = (std::filesystem::path("cache") / cacheName).string();
+
+	if (build.GenTrLUT)
+	{
+		return 1;
+	}
+
+	VkSampler ImageSampler = m_Scope.GetSampler(ESamplerType::PointClamp, 1);
+	VkSampler ImageSampler2 = m_Scope.GetSampler(ESamplerType::BillinearClamp, 1);
+
+	VkImageCreateInfo imageCI{};
+	imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCI.arrayLayers = 1;
+	imageCI.extent = { 64u, 16u, 1u };
 	imageCI.format = VK_FORMAT_R32G32B32A32_SFLOAT;
 	imageCI.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
 	imageCI.mipLevels = 1;
@@ -53,267 +183,534 @@ VkBool32 VulkanBase::atmosphere_precompute()
 	imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	imageCI.imageType = VK_IMAGE_TYPE_2D;
 
-	VkImageViewCreateInfo imageViewCI{};
-	imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	imageViewCI.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	imageViewCI.subresourceRange = subRes;
-
 	VmaAllocationCreateInfo imageAlloc{};
 	imageAlloc.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
 
-	VkSampler ImageSampler = m_Scope.GetSampler(ESamplerType::PointClamp, 1);
-	VkSampler ImageSampler2 = m_Scope.GetSampler(ESamplerType::BillinearClamp, 1);
-
-	m_TransmittanceLUT.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
-	m_TransmittanceLUT.View = std::make_unique<VulkanImageView>(m_Scope, *m_TransmittanceLUT.Image);
+	const VkPushConstantRange pushConstants = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(AtmospherePushConstants) };
 
-	TrDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView())
+	build.TrDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.Transmittance.View->GetImageView())
 		.Allocate(m_Scope);
 
-	GenTrLUT = ComputePipelineDescriptor()
+	build.GenTrLUT = ComputePipelineDescriptor()
 		.SetShaderName("transmittance_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(TrDSO->GetLayout())
+		.AddDescriptorLayout(build.TrDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	imageCI.extent = { 64u, 16u, 1u };
-	DeltaE.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
-	DeltaE.View = std::make_unique<VulkanImageView>(m_Scope, *DeltaE.Image);
-
-	m_IrradianceLUT.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
-	m_IrradianceLUT.View = std::make_unique<VulkanImageView>(m_Scope, *m_IrradianceLUT.Image);
+	build.DeltaE.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+	build.DeltaE.View = std::make_unique<VulkanImageView>(m_Scope, *build.DeltaE.Image);
 
-	DeltaEDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT.View->GetImageView())
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView(), ImageSampler)
+	build.DeltaEDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.Irradiance.View->GetImageView())
+		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, build.Transmittance.View->GetImageView(), ImageSampler)
 		.Allocate(m_Scope);
 
-	GenDeltaELUT = ComputePipelineDescriptor()
+	build.GenDeltaELUT = ComputePipelineDescriptor()
 		.SetShaderName("deltaE_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(DeltaEDSO->GetLayout())
+		.AddDescriptorLayout(build.DeltaEDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
 	imageCI.imageType = VK_IMAGE_TYPE_3D;
-	imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_3D;
 	imageCI.extent = { 256u, 128u, 32u };
-	DeltaSR.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
-	DeltaSR.View = std::make_unique<VulkanImageView>(m_Scope, *DeltaSR.Image);
+	build.DeltaSR.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+	build.DeltaSR.View = std::make_unique<VulkanImageView>(m_Scope, *build.DeltaSR.Image);
 
-	DeltaSM.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
-	DeltaSM.View = std::make_unique<VulkanImageView>(m_Scope, *DeltaSM.Image);
+	build.DeltaSM.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+	build.DeltaSM.View = std::make_unique<VulkanImageView>(m_Scope, *build.DeltaSM.Image);
 
-	DeltaSRSMDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSR.View->GetImageView())
-		.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSM.View->GetImageView())
-		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView(), ImageSampler2)
+	build.DeltaSRSMDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSR.View->GetImageView())
+		.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSM.View->GetImageView())
+		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, build.Transmittance.View->GetImageView(), ImageSampler2)
 		.Allocate(m_Scope);
 
-	GenDeltaSRSMLUT = ComputePipelineDescriptor()
+	build.GenDeltaSRSMLUT = ComputePipelineDescriptor()
 		.SetShaderName("deltaSRSM_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(DeltaSRSMDSO->GetLayout())
+		.AddDescriptorLayout(build.DeltaSRSMDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	// imageCI.mipLevels = static_cast<uint32_t>(std::floor(std::log2(256u))) + 1;
-	m_ScatteringLUT.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
-	m_ScatteringLUT.View = std::make_unique<VulkanImageView>(m_Scope, *m_ScatteringLUT.Image);
-	// imageCI.mipLevels = 1;
-
-	SingleScatterDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT.View->GetImageView())
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSR.View->GetImageView(), ImageSampler2)
-		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSM.View->GetImageView(), ImageSampler2)
+	build.SingleScatterDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.Scattering.View->GetImageView())
+		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSR.View->GetImageView(), ImageSampler2)
+		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSM.View->GetImageView(), ImageSampler2)
 		.Allocate(m_Scope);
 
-	GenSingleScatterLUT = ComputePipelineDescriptor()
+	build.GenSingleScatterLUT = ComputePipelineDescriptor()
 		.SetShaderName("singleScattering_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(SingleScatterDSO->GetLayout())
+		.AddDescriptorLayout(build.SingleScatterDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	DeltaJ.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
-	DeltaJ.View = std::make_unique<VulkanImageView>(m_Scope, *DeltaJ.Image);
+	build.DeltaJ.Image = std::make_unique<VulkanImage>(m_Scope, imageCI, imageAlloc);
+	build.DeltaJ.View = std::make_unique<VulkanImageView>(m_Scope, *build.DeltaJ.Image);
 
-	DeltaJDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, DeltaJ.View->GetImageView())
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView(), ImageSampler)
-		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT.View->GetImageView(), ImageSampler)
-		.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSR.View->GetImageView(), ImageSampler)
-		.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSM.View->GetImageView(), ImageSampler)
+	build.DeltaJDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaJ.View->GetImageView())
+		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, build.Transmittance.View->GetImageView(), ImageSampler)
+		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, build.Irradiance.View->GetImageView(), ImageSampler)
+		.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSR.View->GetImageView(), ImageSampler)
+		.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSM.View->GetImageView(), ImageSampler)
 		.Allocate(m_Scope);
 
-	GenDeltaJLUT = ComputePipelineDescriptor()
+	build.GenDeltaJLUT = ComputePipelineDescriptor()
 		.SetShaderName("deltaJ_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(DeltaJDSO->GetLayout())
-		.AddPushConstant({ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int) })
+		.AddDescriptorLayout(build.DeltaJDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	DeltaEnDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, DeltaE.View->GetImageView())
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSR.View->GetImageView(), ImageSampler)
-		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSM.View->GetImageView(), ImageSampler)
+	build.DeltaEnDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaE.View->GetImageView())
+		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSR.View->GetImageView(), ImageSampler)
+		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSM.View->GetImageView(), ImageSampler)
 		.Allocate(m_Scope);
 
-	GenDeltaEnLUT = ComputePipelineDescriptor()
+	build.GenDeltaEnLUT = ComputePipelineDescriptor()
 		.SetShaderName("deltaEn_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(DeltaEnDSO->GetLayout())
-		.AddPushConstant({ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int) })
+		.AddDescriptorLayout(build.DeltaEnDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	DeltaSDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSR.View->GetImageView())
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView(), ImageSampler)
-		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, DeltaJ.View->GetImageView(), ImageSampler)
+	build.DeltaSDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSR.View->GetImageView())
+		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, build.Transmittance.View->GetImageView(), ImageSampler)
+		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaJ.View->GetImageView(), ImageSampler)
 		.Allocate(m_Scope);
 
-	GenDeltaSLUT = ComputePipelineDescriptor()
+	build.GenDeltaSLUT = ComputePipelineDescriptor()
 		.SetShaderName("deltaS_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(DeltaSDSO->GetLayout())
+		.AddDescriptorLayout(build.DeltaSDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	AddEDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT.View->GetImageView())
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, DeltaE.View->GetImageView(), ImageSampler)
+	build.AddEDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.Irradiance.View->GetImageView())
+		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaE.View->GetImageView(), ImageSampler)
 		.Allocate(m_Scope);
 
-	AddE = ComputePipelineDescriptor()
+	build.AddE = ComputePipelineDescriptor()
 		.SetShaderName("addE_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(AddEDSO->GetLayout())
+		.AddDescriptorLayout(build.AddEDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	AddSDSO = DescriptorSetDescriptor()
-		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT.View->GetImageView())
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, DeltaSR.View->GetImageView(), ImageSampler)
+	build.AddSDSO = DescriptorSetDescriptor()
+		.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, build.Scattering.View->GetImageView())
+		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, build.DeltaSR.View->GetImageView(), ImageSampler)
 		.Allocate(m_Scope);
 
-	AddS = ComputePipelineDescriptor()
+	build.AddS = ComputePipelineDescriptor()
 		.SetShaderName("addS_comp")
 		.AddSpecializationConstant(0, Rg * 1e-3f)
 		.AddSpecializationConstant(1, Rt * 1e-3f)
-		.AddDescriptorLayout(AddSDSO->GetLayout())
+		.AddDescriptorLayout(build.AddSDSO->GetLayout())
+		.AddPushConstant(pushConstants)
 		.Construct(m_Scope);
 
-	VkCommandBuffer cmd;
-	const Queue& Queue = m_Scope.GetQueue(VK_QUEUE_COMPUTE_BIT);
-
-	Queue.AllocateCommandBuffers(1, &cmd);
-	VkCommandBufferBeginInfo cmdBegin{};
-	cmdBegin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	Queue.AllocateCommandBuffers2(1, &cmd);
-	vkBeginCommandBuffer(cmd, &cmdBegin);
-
-	GenTrLUT->BindPipeline(cmd);
-	TrDSO->BindSet(0, cmd, *GenTrLUT);
-	vkCmdDispatch(cmd, m_TransmittanceLUT.Image->GetExtent().width / 8u + uint32_t(m_TransmittanceLUT.Image->GetExtent().width % 8u > 0)
-		, m_TransmittanceLUT.Image->GetExtent().height / 8u + uint32_t(m_TransmittanceLUT.Image->GetExtent().height % 8u > 0)
-		, 1u);
-
-	m_TransmittanceLUT.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-
-	GenDeltaELUT->BindPipeline(cmd);
-	DeltaEDSO->BindSet(0, cmd, *GenDeltaELUT);
-	vkCmdDispatch(cmd, m_IrradianceLUT.Image->GetExtent().width / 8u + uint32_t(m_IrradianceLUT.Image->GetExtent().width % 8u > 0),
-		m_IrradianceLUT.Image->GetExtent().height / 8u + uint32_t(m_IrradianceLUT.Image->GetExtent().height % 8u > 0),
-		1u);
-
-	GenDeltaSRSMLUT->BindPipeline(cmd);
-	DeltaSRSMDSO->BindSet(0, cmd, *GenDeltaSRSMLUT);
-	vkCmdDispatch(cmd, DeltaSR.Image->GetExtent().width / 4u + uint32_t(DeltaSR.Image->GetExtent().width % 4u > 0),
-		DeltaSR.Image->GetExtent().height / 4u + uint32_t(DeltaSR.Image->GetExtent().height % 4u > 0),
-		DeltaSR.Image->GetExtent().depth / 4u + uint32_t(DeltaSR.Image->GetExtent().depth % 4u > 0));
-
-	DeltaSM.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-	DeltaSR.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-
-	GenSingleScatterLUT->BindPipeline(cmd);
-	SingleScatterDSO->BindSet(0, cmd, *GenSingleScatterLUT);
-	vkCmdDispatch(cmd, m_ScatteringLUT.Image->GetExtent().width / 4u + uint32_t(m_ScatteringLUT.Image->GetExtent().width % 4u > 0),
-		m_ScatteringLUT.Image->GetExtent().height / 4u + uint32_t(m_ScatteringLUT.Image->GetExtent().height % 4u > 0),
-		m_ScatteringLUT.Image->GetExtent().depth / 4u + uint32_t(m_ScatteringLUT.Image->GetExtent().depth % 4u > 0));
+	return 1;
+}
 
-	::EndCommandBuffer(cmd);
-	Queue.Submit(cmd)
-		.Wait();
+uint32_t VulkanBase::atmosphere_step_count() const
+{
+	// single scattering takes 4 steps, then every order is made of the DeltaJ slices, DeltaEn, DeltaS, AddE and AddS
+	return 4u + AtmosphereOrders * (AtmosphereSlices + 4u);
+}
+
+void VulkanBase::atmosphere_step(VkCommandBuffer cmd)
+{
+	AtmosphereBuild& build = *m_AtmosphereBuild;
+	const uint32_t step = build.Step++;
 
-	for (uint32_t Sample = 2; Sample <= 5; Sample++)
+	// known profiles are uploaded from the cache instead of the whole precompute
+	if (step == 0u && atmosphere_cache_load(cmd, build.CachePath, build.Key, atmosphere_build_images()))
 	{
-		Queue.Wait();
-		vkBeginCommandBuffer(cmd, &cmdBegin);
+		build.Step = atmosphere_step_count();
+		build.Store = false;
+		build.IdleFrame = m_FrameCount + m_ResourceCount + 1u;
+		return;
+	}
 
-		DeltaJ.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+	AtmospherePushConstants constants{};
+	constants.Atmosphere = build.Parameters;
 
-		GenDeltaJLUT->PushConstants(cmd, &Sample, sizeof(int), 0, VK_SHADER_STAGE_COMPUTE_BIT);
-		GenDeltaJLUT->BindPipeline(cmd);
+	// previous step could have been submitted with an earlier frame
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
 
-		m_IrradianceLUT.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+	auto dispatch = [&](ComputePipeline& pipeline, DescriptorSet& set, const VkExtent3D& extent, uint32_t groupXY, uint32_t groupZ)
+	{
+		pipeline.BindPipeline(cmd);
+		pipeline.PushConstants(cmd, &constants, sizeof(AtmospherePushConstants), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		set.BindSet(0, cmd, pipeline);
+		vkCmdDispatch(cmd, extent.width / groupXY + uint32_t(extent.width % groupXY > 0),
+			extent.height / groupXY + uint32_t(extent.height % groupXY > 0),
+			extent.depth / groupZ + uint32_t(extent.depth % groupZ > 0));
+	};
+
+	switch (step)
+	{
+	case 0:
+		build.Transmittance.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.GenTrLUT, *build.TrDSO, build.Transmittance.Image->GetExtent(), 8u, 1u);
+		build.Transmittance.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		return;
+	case 1:
+		build.Irradiance.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.GenDeltaELUT, *build.DeltaEDSO, build.Irradiance.Image->GetExtent(), 8u, 1u);
+		return;
+	case 2:
+		build.DeltaSR.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		build.DeltaSM.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.GenDeltaSRSMLUT, *build.DeltaSRSMDSO, build.DeltaSR.Image->GetExtent(), 4u, 4u);
+		return;
+	case 3:
+		build.DeltaSM.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		build.DeltaSR.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		build.Scattering.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.GenSingleScatterLUT, *build.SingleScatterDSO, build.Scattering.Image->GetExtent(), 4u, 4u);
+		return;
+	default:
+		break;
+	}
 
-		DeltaJDSO->BindSet(0, cmd, *GenDeltaJLUT);
-		vkCmdDispatch(cmd, DeltaJ.Image->GetExtent().width / 4u + uint32_t(DeltaJ.Image->GetExtent().width % 4u > 0),
-			DeltaJ.Image->GetExtent().height / 4u + uint32_t(DeltaJ.Image->GetExtent().height % 4u > 0),
-			DeltaJ.Image->GetExtent().depth / 4u + uint32_t(DeltaJ.Image->GetExtent().depth % 4u > 0));
+	const uint32_t order = (step - 4u) / (AtmosphereSlices + 4u);
+	const uint32_t stage = (step - 4u) % (AtmosphereSlices + 4u);
+	constants.Sample = static_cast<int>(order + 2u);
 
-		DeltaE.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+	if (stage < AtmosphereSlices)
+	{
+		if (stage == 0u)
+		{
+			build.DeltaJ.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+			build.Irradiance.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		}
+
+		VkExtent3D slice = build.DeltaJ.Image->GetExtent();
+		slice.depth = slice.depth / AtmosphereSlices + uint32_t(slice.depth % AtmosphereSlices > 0);
+		constants.Layer = static_cast<int>(stage * slice.depth);
+
+		dispatch(*build.GenDeltaJLUT, *build.DeltaJDSO, slice, 4u, 4u);
+		return;
+	}
 
-		GenDeltaEnLUT->PushConstants(cmd, &Sample, sizeof(int), 0, VK_SHADER_STAGE_COMPUTE_BIT);
-		GenDeltaEnLUT->BindPipeline(cmd);
-		DeltaEnDSO->BindSet(0, cmd, *GenDeltaEnLUT);
-		vkCmdDispatch(cmd, DeltaE.Image->GetExtent().width / 8u + uint32_t(DeltaE.Image->GetExtent().width % 8u > 0),
-			DeltaE.Image->GetExtent().height / 8u + uint32_t(DeltaE.Image->GetExtent().height % 8u > 0),
-			1u);
+	switch (stage - AtmosphereSlices)
+	{
+	case 0:
+		build.DeltaE.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.GenDeltaEnLUT, *build.DeltaEnDSO, build.DeltaE.Image->GetExtent(), 8u, 1u);
+		break;
+	case 1:
+		build.DeltaSR.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		build.DeltaJ.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.GenDeltaSLUT, *build.DeltaSDSO, build.DeltaSR.Image->GetExtent(), 4u, 4u);
+		break;
+	case 2:
+		build.DeltaE.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		build.Irradiance.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.AddE, *build.AddEDSO, build.Irradiance.Image->GetExtent(), 8u, 1u);
+		break;
+	case 3:
+		build.DeltaSR.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		dispatch(*build.AddS, *build.AddSDSO, build.DeltaSR.Image->GetExtent(), 4u, 4u);
+		break;
+	}
+}
 
-		DeltaSR.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
-		DeltaJ.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+void VulkanBase::atmosphere_publish()
+{
+	AtmosphereBuild& build = *m_AtmosphereBuild;
 
-		GenDeltaSLUT->BindPipeline(cmd);
-		DeltaSDSO->BindSet(0, cmd, *GenDeltaSLUT);
-		vkCmdDispatch(cmd, DeltaSR.Image->GetExtent().width / 4u + uint32_t(DeltaSR.Image->GetExtent().width % 4u > 0),
-			DeltaSR.Image->GetExtent().height / 4u + uint32_t(DeltaSR.Image->GetExtent().height % 4u > 0),
-			DeltaSR.Image->GetExtent().depth / 4u + uint32_t(DeltaSR.Image->GetExtent().depth % 4u > 0));
+	// frames recorded from now on sample the converted tables, the previous ones become spare once these frames retire
+	m_AtmosphereIndex = 1u - m_AtmosphereIndex;
+	m_AtmosphereSwapFrame = m_FrameCount;
+	m_Atmosphere = build.Parameters;
+	m_IBL.Dirty = true;
 
-		DeltaE.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
-		m_IrradianceLUT.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+	if (build.Readback)
+	{
+		build.Readback->Invalidate();
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(build.Readback->mappedMemory);
+
+#if DEBUG == 1
+		m_AtmosphereFormatErrors = atmosphere_format_error(atmosphere_build_images(), atmosphere_front_images(m_AtmosphereIndex), data);
+#endif
+
+		if (build.Store)
+		{
+			std::vector<GR::AtmosphereCache::Table> tables = atmosphere_cache_tables(atmosphere_build_images());
+			std::vector<uint8_t> contents(data, data + GR::AtmosphereCache::DataSize(tables));
+			atmosphere_cache_store(build.CachePath, build.Key, std::move(tables), std::move(contents));
+		}
+	}
 
-		AddE->BindPipeline(cmd);
-		AddEDSO->BindSet(0, cmd, *AddE);
-		vkCmdDispatch(cmd, m_IrradianceLUT.Image->GetExtent().width / 8u + uint32_t(m_IrradianceLUT.Image->GetExtent().width % 8u > 0),
-			m_IrradianceLUT.Image->GetExtent().height / 8u + uint32_t(m_IrradianceLUT.Image->GetExtent().height % 8u > 0),
-			1u);
+	m_AtmosphereBuild.reset();
+}
 
-		DeltaSR.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+void VulkanBase::atmosphere_convert(VkCommandBuffer cmd)
+{
+	AtmosphereBuild& build = *m_AtmosphereBuild;
 
-		AddS->BindPipeline(cmd);
-		AddSDSO->BindSet(0, cmd, *AddS);
-		vkCmdDispatch(cmd, DeltaSR.Image->GetExtent().width / 4u + uint32_t(DeltaSR.Image->GetExtent().width % 4u > 0),
-			DeltaSR.Image->GetExtent().height / 4u + uint32_t(DeltaSR.Image->GetExtent().height % 4u > 0),
-			DeltaSR.Image->GetExtent().depth / 4u + uint32_t(DeltaSR.Image->GetExtent().depth % 4u > 0));
+	const std::vector<VulkanImage*> source = atmosphere_build_images();
+	const std::vector<VulkanImage*> target = atmosphere_front_images(1u - m_AtmosphereIndex);
 
-		vkEndCommandBuffer(cmd);
-		Queue.Submit(cmd);
+	// fp32 tables go to the cache file, converted ones are compared against them in debug
+	std::vector<VulkanImage*> readback = build.Store ? source : std::vector<VulkanImage*>();
+#if DEBUG == 1
+	readback = source;
+	readback.insert(readback.end(), target.begin(), target.end());
+#endif
+
+	// blit converts fp32 tables into the compact formats, it is only available on graphics queue
+	for (size_t i = 0; i < target.size(); i++)
+	{
+		const VkExtent3D extent = target[i]->GetExtent();
+
+		VkImageBlit region{};
+		region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.srcOffsets[1] = { int32_t(extent.width), int32_t(extent.height), int32_t(extent.depth) };
+		region.dstOffsets[1] = region.srcOffsets[1];
+
+		source[i]->TransitionLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_QUEUE_GRAPHICS_BIT);
+		target[i]->TransitionLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_GRAPHICS_BIT);
+		vkCmdBlitImage(cmd, source[i]->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target[i]->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1u, &region, VK_FILTER_NEAREST);
+		target[i]->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_GRAPHICS_BIT);
 	}
 
-	Queue.Wait()
-		.FreeCommandBuffers(1, &cmd);
+	if (!readback.empty())
+	{
+		VkDeviceSize size = 0u;
+		for (const VulkanImage* image : readback)
+		{
+			size += VkDeviceSize(image->GetExtent().width) * image->GetExtent().height * image->GetExtent().depth * atmosphere_texel_size(image->GetFormat());
+		}
+
+		// kept with the build, a restarted one converts into the same tables
+		if (!build.Readback)
+		{
+			VkBufferCreateInfo readbackInfo{};
+			readbackInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			readbackInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			readbackInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			readbackInfo.size = size;
+
+			VmaAllocationCreateInfo readbackAlloc{};
+			readbackAlloc.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+			readbackAlloc.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+			build.Readback = std::make_unique<Buffer>(m_Scope, readbackInfo, readbackAlloc);
+		}
+
+		VkDeviceSize offset = 0u;
+		for (VulkanImage* image : readback)
+		{
+			VkBufferImageCopy region{};
+			region.bufferOffset = offset;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.imageExtent = image->GetExtent();
+
+			const VkImageLayout layout = image->GetImageLayout();
+			image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_QUEUE_GRAPHICS_BIT);
+			vkCmdCopyImageToBuffer(cmd, image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, build.Readback->GetBuffer(), 1u, &region);
+			image->TransitionLayout(cmd, layout, VK_QUEUE_GRAPHICS_BIT);
+
+			offset += VkDeviceSize(region.imageExtent.width) * region.imageExtent.height * region.imageExtent.depth * atmosphere_texel_size(image->GetFormat());
+		}
+
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+	}
+
+	// sources and readback stay in use until the fence of this frame is waited
+	build.Converted = true;
+	build.IdleFrame = m_FrameCount + m_ResourceCount + 1u;
+}
+
+std::vector<VulkanImage*> VulkanBase::atmosphere_build_images() const
+{
+	return { m_AtmosphereBuild->Transmittance.Image.get(), m_AtmosphereBuild->Irradiance.Image.get(), m_AtmosphereBuild->Scattering.Image.get() };
+}
 
-	m_TransmittanceLUT.Image->GenerateMipMaps();
+std::vector<VulkanImage*> VulkanBase::atmosphere_front_images(uint32_t index) const
+{
+	return { m_TransmittanceLUT[index].Image.get(), m_IrradianceLUT[index].Image.get(), m_ScatteringLUT[index].Image.get() };
+}
 
-	m_TransmittanceLUT.Image->TransitionLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	m_ScatteringLUT.Image->TransitionLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	m_IrradianceLUT.Image->TransitionLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+std::vector<GR::AtmosphereCache::Table> VulkanBase::atmosphere_cache_tables(const std::vector<VulkanImage*>& images) const
+{
+	std::vector<GR::AtmosphereCache::Table> tables;
+	for (const VulkanImage* image : images)
+	{
+		tables.push_back({ image->GetExtent().width, image->GetExtent().height, image->GetExtent().depth, static_cast<uint32_t>(sizeof(glm::vec4)) });
+	}
+
+	return tables;
+}
+
+VkBool32 VulkanBase::atmosphere_cache_load(VkCommandBuffer cmd, const std::string& path, const GR::AtmosphereCache::Key& key, const std::vector<VulkanImage*>& images)
+{
+	std::error_code err;
+	if (!std::filesystem::exists(path, err))
+		return 0;
+
+	AtmosphereBuild& build = *m_AtmosphereBuild;
+	const std::vector<GR::AtmosphereCache::Table> tables = atmosphere_cache_tables(images);
+
+	// kept with the build, it is only rewritten once the previous upload retired
+	if (!build.Staging)
+	{
+		VkBufferCreateInfo stagingInfo{};
+		stagingInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		stagingInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		stagingInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		stagingInfo.size = GR::AtmosphereCache::DataSize(tables);
+
+		VmaAllocationCreateInfo stagingAlloc{};
+		stagingAlloc.usage = VMA_MEMORY_USAGE_AUTO;
+		stagingAlloc.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+
+		build.Staging = std::make_unique<Buffer>(m_Scope, stagingInfo, stagingAlloc);
+	}
+
+	if (!GR::AtmosphereCache::Load(path, key, tables, build.Staging->mappedMemory))
+		return 0;
+
+	build.Staging->Flush();
+
+	VkDeviceSize offset = 0u;
+	for (VulkanImage* image : images)
+	{
+		VkBufferImageCopy region{};
+		region.bufferOffset = offset;
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = image->GetExtent();
+
+		image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		vkCmdCopyBufferToImage(cmd, build.Staging->GetBuffer(), image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1u, &region);
+		image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+
+		offset += VkDeviceSize(region.imageExtent.width) * region.imageExtent.height * region.imageExtent.depth * sizeof(glm::vec4);
+	}
 
 	return 1;
-}
\ No newline at end of file
+}
+
+void VulkanBase::atmosphere_cache_store(std::string path, GR::AtmosphereCache::Key key, std::vector<GR::AtmosphereCache::Table> tables, std::vector<uint8_t> data)
+{
+	// writes of consecutive profiles are not interleaved
+	if (m_AtmosphereStore.valid())
+	{
+		m_AtmosphereStore.wait();
+	}
+
+	m_AtmosphereStore = std::async(std::launch::async, [path = std::move(path), key, tables = std::move(tables), data = std::move(data)]()
+	{
+		return GR::AtmosphereCache::Store(path, key, tables, data.data());
+	});
+}
+
+uint32_t VulkanBase::atmosphere_texel_size(VkFormat format) const
+{
+	switch (format)
+	{
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return 16u;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return 8u;
+	case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+		return 4u;
+	default:
+		assert(false && "Unexpected atmosphere table format");
+		return 0u;
+	}
+}
+
+#if DEBUG == 1
+std::array<AtmosphereFormatError, 3> VulkanBase::atmosphere_format_error(const std::vector<VulkanImage*>& reference, const std::vector<VulkanImage*>& compact, const uint8_t* data) const
+{
+	std::array<AtmosphereFormatError, 3> errors{};
+
+	// converted tables follow the reference ones
+	size_t expectedOffset = 0u, actualOffset = 0u;
+	for (const VulkanImage* image : reference)
+	{
+		actualOffset += size_t(image->GetExtent().width) * image->GetExtent().height * image->GetExtent().depth * sizeof(glm::vec4);
+	}
+
+	for (size_t i = 0; i < compact.size(); i++)
+	{
+		const VkExtent3D extent = compact[i]->GetExtent();
+		const size_t texels = size_t(extent.width) * extent.height * extent.depth;
+		const VkFormat format = compact[i]->GetFormat();
+		// packed float has no alpha
+		const int channels = format == VK_FORMAT_B10G11R11_UFLOAT_PACK32 ? 3 : 4;
+
+		double maxAbs = 0.0, maxRel = 0.0, sumAbs = 0.0, sumRel = 0.0;
+		for (size_t t = 0; t < texels; t++)
+		{
+			glm::vec4 a, b = glm::vec4(0.0);
+			memcpy(&a, data + expectedOffset + t * sizeof(glm::vec4), sizeof(glm::vec4));
+
+			if (format == VK_FORMAT_B10G11R11_UFLOAT_PACK32)
+			{
+				uint32_t packed;
+				memcpy(&packed, data + actualOffset + t * sizeof(uint32_t), sizeof(uint32_t));
+				b = glm::vec4(glm::unpackF2x11_1x10(packed), 0.0);
+			}
+			else
+			{
+				glm::uint64 packed;
+				memcpy(&packed, data + actualOffset + t * sizeof(glm::uint64), sizeof(glm::uint64));
+				b = glm::unpackHalf4x16(packed);
+			}
+
+			for (int c = 0; c < channels; c++)
+			{
+				// relative error of values close to zero is meaningless, absolute one covers them
+				const double err = glm::abs(double(a[c]) - double(b[c]));
+				const double rel = err / glm::max(glm::abs(double(a[c])), 1e-4);
+
+				maxAbs = glm::max(maxAbs, err);
+				maxRel = glm::max(maxRel, rel);
+				sumAbs += err;
+				sumRel += rel;
+			}
+		}
+
+		const double count = double(texels * channels);
+		errors[i].MaxAbs = float(maxAbs);
+		errors[i].MeanAbs = float(sumAbs / count);
+		errors[i].MaxRel = float(maxRel);
+		errors[i].MeanRel = float(sumRel / count);
+
+		expectedOffset += texels * sizeof(glm::vec4);
+		actualOffset += texels * atmosphere_texel_size(format);
+	}
+
+	return errors;
+}
+#endif
@@ -4,25 +4,133 @@
 #define WRAPL(i) (i == 0 ? m_ResourceCount : i) - 1
 #define WRAPR(i) i == m_ResourceCount - 1 ? 0 : i + 1
 
-void VulkanBase::_drawObject(const PBRObject& gro, const PBRConstants& constants) const
+// Folds pointer into a short id, collisions only affect the order, not the state tracking
+static uint64_t sort_id(const void* ptr, uint32_t bits)
+{
+	return ((reinterpret_cast<uint64_t>(ptr) >> 4) * 0x9E3779B97F4A7C15ull) >> (64u - bits);
+}
+
+// LSD radix sort by 8 bit digits, digits that are equal for all keys are skipped
+static void radix_sort(std::vector<std::pair<uint64_t, uint32_t>>& keys, std::vector<std::pair<uint64_t, uint32_t>>& scratch)
+{
+	if (keys.size() < 2)
+		return;
+
+	scratch.resize(keys.size());
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		size_t offsets[257] = {};
+		for (const auto& key : keys)
+		{
+			offsets[((key.first >> shift) & 0xFF) + 1]++;
+		}
+
+		if (offsets[((keys[0].first >> shift) & 0xFF) + 1] == keys.size())
+			continue;
+
+		for (uint32_t i = 1; i < 257; i++)
+		{
+			offsets[i] += offsets[i - 1];
+		}
+
+		for (const auto& key : keys)
+		{
+			scratch[offsets[(key.first >> shift) & 0xFF]++] = key;
+		}
+
+		keys.swap(scratch);
+	}
+}
+
+void VulkanBase::_drawObject(const PBRObject& gro, const PBRConstants& constants, uint32_t lod) const
 {
 	if (m_Scope.GetSwapchainExtent().width == 0 || m_Scope.GetSwapchainExtent().height == 0)
 		return;
 
 	assert(m_InFrame, "Call BeginFrame first!");
 
+	// distance is positive, so it's float bits are ordered the same way, closer objects go first for early depth rejection
+	const float distance = static_cast<float>(glm::distance2(m_Camera.Transform.offset, constants.Offset));
+	uint32_t depth = 0;
+	memcpy(&depth, &distance, sizeof(float));
+
+	// pipeline (8) | depth (24) | material (16) | mesh (16)
+	// every object owns its descriptor set, so depth goes before material for the order to matter at all
+	const uint64_t key = (sort_id(gro.pipeline.get(), 8) << 56)
+		| (static_cast<uint64_t>(depth >> 8) << 32)
+		| (sort_id(gro.descriptorSet.get(), 16) << 16)
+		| sort_id(gro.mesh.get(), 16);
+
+	m_DrawKeys.push_back({ key, static_cast<uint32_t>(m_DrawQueue.size()) });
+	m_DrawQueue.push_back({ &gro, lod, constants });
+
+	// packed positions are in [0, 1] inside mesh bounds, dequantization is folded into the world matrix
+	if (gro.mesh->IsPacked())
+	{
+		PBRConstants& folded = m_DrawQueue.back().constants;
+		const glm::mat3 orientation = glm::mat3(constants.Orientation);
+
+		folded.Offset += glm::dvec3(orientation * gro.mesh->GetDequantizeOffset());
+		folded.Orientation = glm::mat3x4(orientation * glm::mat3(glm::scale(glm::mat4(1.0), gro.mesh->GetDequantizeScale())));
+	}
+}
+
+void VulkanBase::_flushObjects() const
+{
+	if (m_DrawQueue.empty())
+		return;
+
 	const VkCommandBuffer& cmd = m_DeferredSync[m_ResourceIndex].Commands;
 	const VkDeviceSize offsets[] = { 0 };
 
-	m_UBOSets[m_ResourceIndex]->BindSet(0, cmd, *gro.pipeline);
-	gro.descriptorSet->BindSet(1, cmd, *gro.pipeline);
-	gro.pipeline->PushConstants(cmd, &constants.Offset, PBRConstants::VertexSize(), 0u, VK_SHADER_STAGE_VERTEX_BIT);
-	gro.pipeline->PushConstants(cmd, &constants.Color, PBRConstants::FragmentSize(), PBRConstants::VertexSize(), VK_SHADER_STAGE_FRAGMENT_BIT);
-	gro.pipeline->BindPipeline(cmd);
+	radix_sort(m_DrawKeys, m_DrawKeysScratch);
+
+	const GraphicsPipeline* boundPipeline = nullptr;
+	const DescriptorSet* boundSet = nullptr;
+	VkBuffer boundVB = VK_NULL_HANDLE;
+	VkBuffer boundIB = VK_NULL_HANDLE;
+
+	for (const auto& [key, index] : m_DrawKeys)
+	{
+		const DrawPacket& packet = m_DrawQueue[index];
+		const PBRObject& gro = *packet.object;
+
+		if (gro.pipeline.get() != boundPipeline)
+		{
+			gro.pipeline->BindPipeline(cmd);
+			m_UBOSets[m_ResourceIndex]->BindSet(0, cmd, *gro.pipeline);
+
+			boundPipeline = gro.pipeline.get();
+			boundSet = nullptr;
+		}
 
-	vkCmdBindVertexBuffers(cmd, 0, 1, &gro.mesh->GetVertexBuffer()->GetBuffer(), offsets);
-	vkCmdBindIndexBuffer(cmd, gro.mesh->GetIndexBuffer()->GetBuffer(), 0, gro.mesh->GetIndexType());
-	vkCmdDrawIndexed(cmd, gro.mesh->GetIndicesCount(), 1, 0, 0, 0);
+		if (gro.descriptorSet.get() != boundSet)
+		{
+			gro.descriptorSet->BindSet(1, cmd, *gro.pipeline);
+			boundSet = gro.descriptorSet.get();
+		}
+
+		gro.pipeline->PushConstants(cmd, &packet.constants.Offset, PBRConstants::VertexSize(), 0u, VK_SHADER_STAGE_VERTEX_BIT);
+		gro.pipeline->PushConstants(cmd, &packet.constants.Color, PBRConstants::FragmentSize(), PBRConstants::VertexSize(), VK_SHADER_STAGE_FRAGMENT_BIT);
+
+		if (gro.mesh->GetVertexBuffer()->GetBuffer() != boundVB)
+		{
+			boundVB = gro.mesh->GetVertexBuffer()->GetBuffer();
+			vkCmdBindVertexBuffers(cmd, 0, 1, &boundVB, offsets);
+		}
+
+		if (gro.mesh->GetIndexBuffer()->GetBuffer() != boundIB)
+		{
+			boundIB = gro.mesh->GetIndexBuffer()->GetBuffer();
+			vkCmdBindIndexBuffer(cmd, boundIB, 0, gro.mesh->GetIndexType());
+		}
+
+		const VulkanMesh::LOD& range = gro.mesh->GetLOD(packet.lod);
+		vkCmdDrawIndexed(cmd, range.indexCount, 1, range.firstIndex, 0, 0);
+	}
+
+	m_DrawQueue.clear();
+	m_DrawKeys.clear();
 }
 
 void VulkanBase::_updateObject(entt::entity ent, entt::registry& registry) const
@@ -47,17 +155,17 @@ std::unique_ptr<DescriptorSet> VulkanBase::create_pbr_set(const VulkanImageView&
 		.Allocate(m_Scope);
 }
 
-std::unique_ptr<GraphicsPipeline> VulkanBase::create_pbr_pipeline(const DescriptorSet& set) const
+std::unique_ptr<GraphicsPipeline> VulkanBase::create_pbr_pipeline(const DescriptorSet& set, bool packed) const
 {
-	auto vertAttributes = MeshVertex::getAttributeDescriptions();
-	auto vertBindings = MeshVertex::getBindingDescription();
+	auto vertAttributes = packed ? PackedMeshVertex::getAttributeDescriptions() : MeshVertex::getAttributeDescriptions();
+	auto vertBindings = packed ? PackedMeshVertex::getBindingDescription() : MeshVertex::getBindingDescription();
 
 	return GraphicsPipelineDescriptor()
 		.SetCullMode(VK_CULL_MODE_BACK_BIT)
 		.SetBlendAttachments(3, nullptr)
 		.SetVertexInputBindings(1, &vertBindings)
 		.SetVertexAttributeBindings(vertAttributes.size(), vertAttributes.data())
-		.SetShaderStage("default_vert", VK_SHADER_STAGE_VERTEX_BIT)
+		.SetShaderStage(packed ? "default_packed_vert" : "default_vert", VK_SHADER_STAGE_VERTEX_BIT)
 		.SetShaderStage("default_frag", VK_SHADER_STAGE_FRAGMENT_BIT)
 		.AddDescriptorLayout(m_UBOSets[0]->GetLayout())
 		.AddDescriptorLayout(set.GetLayout())
@@ -77,52 +185,64 @@ VkBool32 VulkanBase::brdf_precompute()
 	VmaAllocationCreateInfo allocCreateInfo{};
 	allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
 
-	m_DiffuseIrradience.resize(m_ResourceCount);
 	m_SpecularLUT.resize(m_ResourceCount);
-	m_CubemapLUT.resize(m_ResourceCount);
+	m_IrradianceSH.resize(m_ResourceCount);
+
+	VkImageCreateInfo hdrInfo{};
+	hdrInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	hdrInfo.format = m_Scope.GetIBLFormat();
+	hdrInfo.arrayLayers = 6;
+	hdrInfo.extent = { CubeR, CubeR, 1 };
+	hdrInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	hdrInfo.imageType = VK_IMAGE_TYPE_2D;
+	hdrInfo.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	hdrInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	hdrInfo.mipLevels = 1;
+	hdrInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+	hdrInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	hdrInfo.queueFamilyIndexCount = queueFamilies.size();
+	hdrInfo.pQueueFamilyIndices = queueFamilies.data();
+	hdrInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+
+	const uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(CubeR))) + 1;
+	VkImageSubresourceRange subRes = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6 };
 
 	for (size_t i = 0; i < m_ResourceCount; i++)
 	{
-		VkImageCreateInfo hdrInfo{};
-		hdrInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		hdrInfo.format = m_Scope.GetHDRFormat();
-		hdrInfo.arrayLayers = 6;
-		hdrInfo.extent = { CubeR, CubeR, 1 };
-		hdrInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		hdrInfo.imageType = VK_IMAGE_TYPE_2D;
-		hdrInfo.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		hdrInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		hdrInfo.mipLevels = 1;
-		hdrInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
-		hdrInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		hdrInfo.queueFamilyIndexCount = queueFamilies.size();
-		hdrInfo.pQueueFamilyIndices = queueFamilies.data();
-		hdrInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-
-		m_DiffuseIrradience[i].Image = std::make_unique<VulkanImage>(m_Scope, hdrInfo, allocCreateInfo);
-		m_DiffuseIrradience[i].View = std::make_unique<VulkanImageView>(m_Scope, *m_DiffuseIrradience[i].Image);
-
-		hdrInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-		hdrInfo.mipLevels = static_cast<uint32_t>(std::floor(std::log2(CubeR))) + 1;
+		hdrInfo.mipLevels = mipLevels;
 		m_SpecularLUT[i].Image = std::make_unique<VulkanImage>(m_Scope, hdrInfo, allocCreateInfo);
+		m_SpecularLUT[i].Views.reserve(hdrInfo.mipLevels + 1);
 		m_SpecularLUT[i].Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_SpecularLUT[i].Image));
 
-		hdrInfo.arrayLayers = 12;
-		m_CubemapLUT[i].Image = std::make_unique<VulkanImage>(m_Scope, hdrInfo, allocCreateInfo);
-		m_CubemapLUT[i].Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_CubemapLUT[i].Image));
-
-		m_SpecularLUT[i].Views.reserve(hdrInfo.mipLevels + 1);
-		m_CubemapLUT[i].Views.reserve(hdrInfo.mipLevels + 1);
-		VkImageSubresourceRange subRes = m_SpecularLUT[i].Image->GetSubResourceRange();
 		for (uint32_t j = 0; j < hdrInfo.mipLevels; j++)
 		{
 			subRes.baseMipLevel = j;
-			subRes.levelCount = 1u;
 			m_SpecularLUT[i].Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_SpecularLUT[i].Image, subRes));
-			m_CubemapLUT[i].Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_CubemapLUT[i].Image, subRes));
 		}
 	}
 
+	// targets never leave compute queue and stay in general layout
+	hdrInfo.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+	hdrInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	hdrInfo.mipLevels = mipLevels;
+	m_SpecularTarget.Image = std::make_unique<VulkanImage>(m_Scope, hdrInfo, allocCreateInfo);
+	m_SpecularTarget.Views.reserve(hdrInfo.mipLevels + 1);
+	m_SpecularTarget.Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_SpecularTarget.Image));
+
+	hdrInfo.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	hdrInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	hdrInfo.arrayLayers = 12;
+	m_CubemapLUT.Image = std::make_unique<VulkanImage>(m_Scope, hdrInfo, allocCreateInfo);
+	m_CubemapLUT.Views.reserve(hdrInfo.mipLevels + 1);
+	m_CubemapLUT.Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_CubemapLUT.Image));
+
+	for (uint32_t j = 0; j < hdrInfo.mipLevels; j++)
+	{
+		subRes.baseMipLevel = j;
+		m_SpecularTarget.Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_SpecularTarget.Image, subRes));
+		m_CubemapLUT.Views.emplace_back(std::make_unique<VulkanImageView>(m_Scope, *m_CubemapLUT.Image, subRes));
+	}
+
 	std::unique_ptr<GraphicsPipeline> m_IntegrationPipeline = GraphicsPipelineDescriptor()
 		.SetShaderStage("fullscreen", VK_SHADER_STAGE_VERTEX_BIT)
 		.SetShaderStage("brdf_integrate_frag", VK_SHADER_STAGE_FRAGMENT_BIT)
@@ -131,7 +251,7 @@ VkBool32 VulkanBase::brdf_precompute()
 
 	VkImageCreateInfo bimageInfo{};
 	bimageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	bimageInfo.format = m_Scope.GetHDRFormat();
+	bimageInfo.format = m_Scope.GetBRDFFormat();
 	bimageInfo.arrayLayers = 1;
 	bimageInfo.extent = { 512, 512, 1 };
 	bimageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -198,70 +318,76 @@ VkBool32 VulkanBase::brdf_precompute()
 
 	vkDestroyFramebuffer(m_Scope.GetDevice(), Framebuffer, VK_NULL_HANDLE);
 
-	m_CubemapDescriptors.resize(m_ResourceCount);
-	m_DiffuseDescriptors.resize(m_ResourceCount);
-	m_ConvolutionDescriptors.resize(m_ResourceCount);
-	m_SpecularDescriptors.resize(m_SpecularLUT[0].Image->GetMipLevelsCount() * m_ResourceCount);
-	m_CubemapMipDescriptors.resize(m_SpecularLUT[0].Image->GetMipLevelsCount() * m_ResourceCount);
-
-	struct
-	{
-		int Count = 0;
-		float ColorNorm = 0.0;
-		std::vector<glm::vec4> data = {};
-	} diffuseData;
-	diffuseData.data.reserve(663);
-
-	float sampleDelta = 0.25;
-	for (float phi = 0.0; phi < 2.0 * glm::pi<float>(); phi += sampleDelta)
-	{
-		float sinPhi = sin(phi);
-		float cosPhi = cos(phi);
-
-		for (float theta = 0.0; theta < 0.5 * glm::pi<float>(); theta += sampleDelta)
-		{
-			float sinTheta = sin(theta);
-			float cosTheta = cos(theta);
-
-			diffuseData.data.emplace_back(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta, sinTheta * cosTheta);
-			diffuseData.Count++;
-		}
-	}
-	diffuseData.ColorNorm = glm::pi<float>() / float(diffuseData.Count);
+	m_CubemapDescriptors.resize(2 * m_ResourceCount);
+	m_ConvolutionDescriptors.resize(2 * m_ResourceCount);
+	m_SpecularDescriptors.resize(mipLevels);
+	m_CubemapMipDescriptors.resize(mipLevels);
+	m_IBLBlendDescriptors.resize(mipLevels * m_ResourceCount);
 
 	VmaAllocationCreateInfo bufallocCreateInfo{};
 	bufallocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
+	// diffuse irradiance is 9 rgb coefficients, copies are written on async compute and read by composition, concurrent sharing saves the ownership transfers
 	VkBufferCreateInfo bufInfo{};
 	bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	bufInfo.size = sizeof(glm::vec4) * diffuseData.data.size();
+	bufInfo.sharingMode = queueFamilies.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+	bufInfo.size = sizeof(glm::vec4) * 9;
 	bufInfo.queueFamilyIndexCount = queueFamilies.size();
 	bufInfo.pQueueFamilyIndices = queueFamilies.data();
 	bufInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-	m_DiffusePrecompute = std::make_unique<Buffer>(m_Scope, bufInfo, bufallocCreateInfo);
-	m_DiffusePrecompute->Update(diffuseData.data.data(), sizeof(glm::vec4) * diffuseData.data.size());
 
+	for (size_t i = 0; i < m_ResourceCount; i++)
+	{
+		m_IrradianceSH[i] = std::make_unique<Buffer>(m_Scope, bufInfo, bufallocCreateInfo);
+	}
+
+	bufInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	m_IrradianceSHTarget = std::make_unique<Buffer>(m_Scope, bufInfo, bufallocCreateInfo);
+
+	// importance samples of every specular mip, in tangent space of the normal which is also the view and the reflection direction
+	// xyz is the light direction and w the source mip the pdf of the sample asks for, so sharp lobes keep detail and wide ones do not alias into fireflies
 	std::vector<glm::vec4> specSamples;
-	const int specSamplesCount = 32;
-	specSamples.reserve(specSamplesCount);
-	for (int i = 0; i < specSamplesCount; i++)
+	m_SpecularSampleRanges.assign(mipLevels, glm::uvec2(0u));
+	const float texelSolidAngle = 4.0 * glm::pi<float>() / float(6.0 * CubeR * CubeR);
+	for (uint32_t mip = 1; mip < mipLevels; mip++)
 	{
-		glm::vec4 sample;
-		sample.x = float(i) / float(specSamplesCount);
-
-		// radical inverse
-		uint32_t N = static_cast<uint32_t>(specSamplesCount);
-		N = (N << 16u) | (N >> 16u);
-		N = ((N & 0x55555555u) << 1u) | ((N & 0xAAAAAAAAu) >> 1u);
-		N = ((N & 0x33333333u) << 2u) | ((N & 0xCCCCCCCCu) >> 2u);
-		N = ((N & 0x0F0F0F0Fu) << 4u) | ((N & 0xF0F0F0F0u) >> 4u);
-		N = ((N & 0x00FF00FFu) << 8u) | ((N & 0xFF00FF00u) >> 8u);
-		sample.y = float(N) * 2.3283064365386963e-10; // / 0x100000000
-		sample.z = 4.0 * glm::pi<float>() / float(6.0 * CubeR * CubeR);
-
-		specSamples.emplace_back(sample);
+		// lobes widen with roughness while the mips shrink, so rougher mips afford more samples
+		const uint32_t count = glm::min(IBLSpecularSamples << (mip - 1u), IBLSpecularMaxSamples);
+		const float roughness = float(mip) / float(mipLevels - 1u);
+		const float a = roughness * roughness;
+		const float a2 = a * a;
+
+		m_SpecularSampleRanges[mip].x = static_cast<uint32_t>(specSamples.size());
+		for (uint32_t i = 0; i < count; i++)
+		{
+			// radical inverse
+			uint32_t N = i;
+			N = (N << 16u) | (N >> 16u);
+			N = ((N & 0x55555555u) << 1u) | ((N & 0xAAAAAAAAu) >> 1u);
+			N = ((N & 0x33333333u) << 2u) | ((N & 0xCCCCCCCCu) >> 2u);
+			N = ((N & 0x0F0F0F0Fu) << 4u) | ((N & 0xF0F0F0F0u) >> 4u);
+			N = ((N & 0x00FF00FFu) << 8u) | ((N & 0xFF00FF00u) >> 8u);
+			const glm::vec2 Xi = glm::vec2(float(i) / float(count), float(N) * 2.3283064365386963e-10); // / 0x100000000
+
+			const float phi = 2.0 * glm::pi<float>() * Xi.x;
+			const float cosTheta = glm::sqrt((1.0 - Xi.y) / (1.0 + (a2 - 1.0) * Xi.y));
+			const float sinTheta = glm::sqrt(1.0 - cosTheta * cosTheta);
+			const glm::vec3 H = glm::vec3(glm::cos(phi) * sinTheta, glm::sin(phi) * sinTheta, cosTheta);
+			const glm::vec3 L = 2.0f * H.z * H - glm::vec3(0.0, 0.0, 1.0);
+
+			if (L.z <= 0.0)
+				continue;
+
+			// view is along the normal, so the pdf of L is D(H) / 4
+			const float det = cosTheta * cosTheta * (a2 - 1.0) + 1.0;
+			const float pdf = a2 / (4.0 * glm::pi<float>() * det * det);
+			const float sampleSolidAngle = 1.0 / (float(count) * pdf);
+
+			specSamples.emplace_back(L, glm::max(0.5f * glm::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f));
+		}
+		m_SpecularSampleRanges[mip].y = static_cast<uint32_t>(specSamples.size()) - m_SpecularSampleRanges[mip].x;
 	}
+
 	bufInfo.size = sizeof(glm::vec4) * specSamples.size();
 	m_SpecularPrecompute = std::make_unique<Buffer>(m_Scope, bufInfo, bufallocCreateInfo);
 	m_SpecularPrecompute->Update(specSamples.data(), sizeof(glm::vec4) * specSamples.size());
@@ -271,44 +397,65 @@ VkBool32 VulkanBase::brdf_precompute()
 	VkSampler SamplerRepeat = m_Scope.GetSampler(ESamplerType::LinearRepeat, 1);
 	for (size_t i = 0; i < m_ResourceCount; i++)
 	{
-		m_CubemapDescriptors[i] = DescriptorSetDescriptor()
-			.AddUniformBuffer(0, VK_SHADER_STAGE_COMPUTE_BIT, *m_UBOBuffers[i])
-			.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT[i].Views[0]->GetImageView())
-			.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT.View->GetImageView(), SamplerLinear)
-			.Allocate(m_Scope);
-
-		m_ConvolutionDescriptors[i] = DescriptorSetDescriptor()
-			.AddUniformBuffer(0, VK_SHADER_STAGE_COMPUTE_BIT, *m_UBOBuffers[i])
-			.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT.View->GetImageView(), SamplerLinear)
-			.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT[i].Views[0]->GetImageView(), m_Scope.GetSampler(ESamplerType::LinearClamp, m_CubemapLUT[i].Views[0]->GetSubresourceRange().levelCount))
-			.Allocate(m_Scope);
+		// a set per atmosphere tables
+		for (uint32_t k = 0; k < 2; k++)
+		{
+			m_CubemapDescriptors[2 * i + k] = DescriptorSetDescriptor()
+				.AddUniformBuffer(0, VK_SHADER_STAGE_COMPUTE_BIT, *m_UBOBuffers[i])
+				.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT.Views[0]->GetImageView())
+				.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT[k].View->GetImageView(), SamplerLinear)
+				.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT[k].View->GetImageView(), SamplerLinear)
+				.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT[k].View->GetImageView(), SamplerLinear)
+				.Allocate(m_Scope);
 
-		m_DiffuseDescriptors[i] = DescriptorSetDescriptor()
-			.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_DiffuseIrradience[i].View->GetImageView())
-			.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, *m_DiffusePrecompute)
-			.Allocate(m_Scope);
+			m_ConvolutionDescriptors[2 * i + k] = DescriptorSetDescriptor()
+				.AddUniformBuffer(0, VK_SHADER_STAGE_COMPUTE_BIT, *m_UBOBuffers[i])
+				.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT[k].View->GetImageView(), SamplerLinear)
+				.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT[k].View->GetImageView(), SamplerLinear)
+				.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT[k].View->GetImageView(), SamplerLinear)
+				.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT.Views[0]->GetImageView(), m_Scope.GetSampler(ESamplerType::LinearClamp, mipLevels))
+				.Allocate(m_Scope);
+		}
 
-		uint32_t mips = m_SpecularLUT[i].Image->GetMipLevelsCount();
-		for (uint32_t j = 0; j < mips; j++)
+		for (uint32_t j = 0; j < mipLevels; j++)
 		{
-			m_SpecularDescriptors[i * mips + j] = DescriptorSetDescriptor()
-				.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_SpecularLUT[i].Views[j + 1]->GetImageView())
-				.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, *m_SpecularPrecompute)
+			m_IBLBlendDescriptors[i * mipLevels + j] = DescriptorSetDescriptor()
+				.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_SpecularTarget.Views[j + 1]->GetImageView())
+				.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, m_SpecularLUT[i].Views[j + 1]->GetImageView())
+				.AddStorageBuffer(2, VK_SHADER_STAGE_COMPUTE_BIT, *m_IrradianceSHTarget)
+				.AddStorageBuffer(3, VK_SHADER_STAGE_COMPUTE_BIT, *m_IrradianceSH[i])
 				.Allocate(m_Scope);
+		}
+	}
 
-			m_CubemapMipDescriptors[i * mips + j] = DescriptorSetDescriptor()
-				.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT[i].Views[j]->GetImageView())
-				.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT[i].Views[j + 1]->GetImageView())
+	m_IrradianceSHDescriptors = DescriptorSetDescriptor()
+		.AddImageSampler(0, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT.Views[0]->GetImageView(), m_Scope.GetSampler(ESamplerType::LinearClamp, mipLevels))
+		.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, *m_IrradianceSHTarget)
+		.Allocate(m_Scope);
+
+	for (uint32_t j = 0; j < mipLevels; j++)
+	{
+		m_SpecularDescriptors[j] = DescriptorSetDescriptor()
+			.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_SpecularTarget.Views[j + 1]->GetImageView())
+			.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, *m_SpecularPrecompute)
+			.Allocate(m_Scope);
+
+		// last mip has nothing to reduce into
+		if (j + 1 < mipLevels)
+		{
+			m_CubemapMipDescriptors[j] = DescriptorSetDescriptor()
+				.AddStorageImage(0, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT.Views[j + 1]->GetImageView())
+				.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, m_CubemapLUT.Views[j + 2]->GetImageView())
 				.Allocate(m_Scope);
 		}
 	}
 
+	VkPushConstantRange facePushConstants{};
+	facePushConstants.size = sizeof(int);
+	facePushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 	m_CubemapPipeline = ComputePipelineDescriptor()
 		.AddDescriptorLayout(m_CubemapDescriptors[0]->GetLayout())
+		.AddPushConstant(facePushConstants)
 		.AddSpecializationConstant(0, Rg)
 		.AddSpecializationConstant(1, Rt)
 		.SetShaderName("cubemap_comp")
@@ -319,16 +466,15 @@ VkBool32 VulkanBase::brdf_precompute()
 		.SetShaderName("cubemap_mip_comp")
 		.Construct(m_Scope);
 
-	m_ConvolutionPipeline = ComputePipelineDescriptor()
-		.AddDescriptorLayout(m_ConvolutionDescriptors[0]->GetLayout())
-		.AddDescriptorLayout(m_DiffuseDescriptors[0]->GetLayout())
-		.SetShaderName("cube_convolution_comp")
-		.AddSpecializationConstant(0, diffuseData.Count)
-		.AddSpecializationConstant(1, diffuseData.ColorNorm)
+	m_IrradianceSHPipeline = ComputePipelineDescriptor()
+		.AddDescriptorLayout(m_IrradianceSHDescriptors->GetLayout())
+		// only the first mip of the radiance cube is built
+		.AddSpecializationConstant(0, CubeR)
+		.SetShaderName("sh_project_comp")
 		.Construct(m_Scope);
 
 	VkPushConstantRange pushContants{};
-	pushContants.size = sizeof(float);
+	pushContants.size = sizeof(glm::uvec2);
 	pushContants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 	m_SpecularIBLPipeline = ComputePipelineDescriptor()
 		.AddDescriptorLayout(m_ConvolutionDescriptors[0]->GetLayout())
@@ -337,8 +483,199 @@ VkBool32 VulkanBase::brdf_precompute()
 		.AddPushConstant(pushContants)
 		.AddSpecializationConstant(0, Rg)
 		.AddSpecializationConstant(1, Rt)
-		.AddSpecializationConstant(2, specSamplesCount)
 		.Construct(m_Scope);
 
+	VkPushConstantRange blendPushConstants{};
+	blendPushConstants.size = sizeof(IBLBlendPushConstants);
+	blendPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	m_IBLBlendPipeline = ComputePipelineDescriptor()
+		.AddDescriptorLayout(m_IBLBlendDescriptors[0]->GetLayout())
+		.AddPushConstant(blendPushConstants)
+		.SetShaderName("ibl_blend_comp")
+		.Construct(m_Scope);
+
+	m_IBL.CopyFade.assign(m_ResourceCount, -1.0);
+
 	return 1;
-}
\ No newline at end of file
+}
+
+void VulkanBase::ibl_update(VkCommandBuffer cmd)
+{
+	const glm::dvec3 Position = m_Camera.Transform.GetOffset();
+	const glm::vec3 Sun = glm::normalize(m_SunDirection);
+	const glm::vec3 Up = glm::normalize(glm::vec3(Position));
+	const double Radius = glm::length(Position);
+
+	// sky only depends on the sun and the camera placement, small moves are not worth the convolutions
+	const double Altitude = glm::max(m_IBL.Radius - double(Rg), 1e3);
+	m_IBL.Dirty = m_IBL.Dirty
+		|| glm::dot(Sun, m_IBL.SunDirection) < IBLAngleThreshold
+		|| glm::dot(Up, m_IBL.Up) < IBLAngleThreshold
+		|| glm::abs(Radius - m_IBL.Radius) > IBLAltitudeThreshold * Altitude;
+
+	// targets are rewritten only once every copy has faded into them, otherwise copies would blend towards a half built sky
+	const bool settled = m_IBL.Fade < 0.0 || std::all_of(m_IBL.CopyFade.begin(), m_IBL.CopyFade.end(), [](float fade) { return fade >= 1.0f; });
+
+	if (m_IBL.Slice > 0u || (m_IBL.Dirty && settled))
+	{
+		// changes during the running update or the fade are picked up by the next one
+		if (m_IBL.Slice == 0u)
+		{
+			m_IBL.SunDirection = Sun;
+			m_IBL.Up = Up;
+			m_IBL.Radius = Radius;
+			m_IBL.Dirty = false;
+		}
+
+		// there is no previous sky to show while the first update runs, so it is built at once
+		const bool first = m_IBL.Fade < 0.0;
+		do
+		{
+			ibl_slice(cmd, m_IBL.Slice);
+			m_IBL.Slice = (m_IBL.Slice + 1u) % ibl_slice_count();
+		} while (first && m_IBL.Slice > 0u);
+
+		if (m_IBL.Slice == 0u)
+		{
+			m_IBL.Fade = 0.0;
+			for (float& fade : m_IBL.CopyFade)
+			{
+				fade = glm::min(fade, 0.0f);
+			}
+		}
+	}
+
+	if (m_IBL.Fade >= 0.0)
+	{
+		m_IBL.Fade = glm::min(m_IBL.Fade + 1.0f / float(IBLFadeFrames), 1.0f);
+	}
+
+	ibl_blend(cmd);
+}
+
+uint32_t VulkanBase::ibl_slice_count() const
+{
+	// 6 faces of the sky, its mip chain, diffuse irradiance and every specular mip but the first one
+	return 7u + m_SpecularTarget.Image->GetMipLevelsCount();
+}
+
+void VulkanBase::ibl_slice(VkCommandBuffer cmd, uint32_t slice)
+{
+	const uint32_t mips = m_SpecularTarget.Image->GetMipLevelsCount();
+	const uint32_t X = CubeR / 8 + uint32_t(CubeR % 8 > 0);
+	const uint32_t Y = CubeR / 4 + uint32_t(CubeR % 4 > 0);
+
+	// previous slice could have been submitted with an earlier frame
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	if (slice < 6u)
+	{
+		const int face = int(slice);
+
+		m_CubemapLUT.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+		m_CubemapPipeline->BindPipeline(cmd);
+		m_CubemapDescriptors[2 * m_ResourceIndex + m_AtmosphereIndex]->BindSet(0, cmd, *m_CubemapPipeline);
+		m_CubemapPipeline->PushConstants(cmd, &face, sizeof(int), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		vkCmdDispatch(cmd, X, Y, 1u);
+
+		m_CubemapLUT.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+	}
+	else if (slice == 6u)
+	{
+		m_CubemapLUT.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+		m_CubemapMipPipeline->BindPipeline(cmd);
+		for (uint32_t mip = 1; mip < mips; mip++)
+		{
+			uint32_t ScaledR = CubeR >> mip;
+			uint32_t scaledX = ScaledR / 8 + uint32_t(ScaledR % 8 > 0);
+			uint32_t scaledY = ScaledR / 4 + uint32_t(ScaledR % 4 > 0);
+
+			m_CubemapMipDescriptors[mip - 1]->BindSet(0, cmd, *m_CubemapMipPipeline);
+			vkCmdDispatch(cmd, scaledX, scaledY, 6u);
+
+			m_CubemapLUT.Image->TransitionLayout(cmd, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, mip, 1, 0, 6), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		}
+
+		m_CubemapLUT.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+	}
+	else if (slice == 7u)
+	{
+		// diffuse irradiance is low frequency, a single workgroup projects it onto spherical harmonics
+		m_IrradianceSHPipeline->BindPipeline(cmd);
+		m_IrradianceSHDescriptors->BindSet(0, cmd, *m_IrradianceSHPipeline);
+		vkCmdDispatch(cmd, 1u, 1u, 1u);
+
+		// top mip of specular is the sky itself
+		m_CubemapLUT.Image->TransitionLayout(cmd, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+
+		VkImageCopy copy{};
+		copy.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copy.dstSubresource.layerCount = 6;
+		copy.dstSubresource.mipLevel = 0;
+		copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copy.srcSubresource.layerCount = 6;
+		copy.srcSubresource.mipLevel = 0;
+		copy.extent = { CubeR, CubeR, 1 };
+		vkCmdCopyImage(cmd, m_CubemapLUT.Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_SpecularTarget.Image->GetImage(), VK_IMAGE_LAYOUT_GENERAL, 1, &copy);
+
+		m_CubemapLUT.Image->TransitionLayout(cmd, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+	}
+	else
+	{
+		const uint32_t mip = slice - 7u;
+		uint32_t ScaledR = CubeR >> mip;
+		uint32_t scaledX = ScaledR / 8 + uint32_t(ScaledR % 8 > 0);
+		uint32_t scaledY = ScaledR / 4 + uint32_t(ScaledR % 4 > 0);
+
+		m_SpecularIBLPipeline->BindPipeline(cmd);
+		m_ConvolutionDescriptors[2 * m_ResourceIndex + m_AtmosphereIndex]->BindSet(0, cmd, *m_SpecularIBLPipeline);
+		m_SpecularDescriptors[mip]->BindSet(1, cmd, *m_SpecularIBLPipeline);
+
+		m_SpecularIBLPipeline->PushConstants(cmd, &m_SpecularSampleRanges[mip], sizeof(glm::uvec2), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		vkCmdDispatch(cmd, scaledX, scaledY, 6u);
+	}
+}
+
+void VulkanBase::ibl_blend(VkCommandBuffer cmd)
+{
+	float& copyFade = m_IBL.CopyFade[m_ResourceIndex];
+	if (m_IBL.Fade < 0.0 || copyFade >= m_IBL.Fade)
+		return;
+
+	// copy holds the old sky faded by copyFade already, the rest of the way to Fade is scaled accordingly
+	IBLBlendPushConstants constants{};
+	constants.Blend = copyFade < 0.0 ? 1.0f : (m_IBL.Fade - copyFade) / (1.0f - copyFade);
+	copyFade = copyFade < 0.0 ? 1.0f : m_IBL.Fade;
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	m_SpecularLUT[m_ResourceIndex].Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+	const uint32_t mips = m_SpecularLUT[m_ResourceIndex].Image->GetMipLevelsCount();
+	m_IBLBlendPipeline->BindPipeline(cmd);
+	for (uint32_t mip = 0; mip < mips; mip++)
+	{
+		uint32_t ScaledR = CubeR >> mip;
+		uint32_t scaledX = ScaledR / 8 + uint32_t(ScaledR % 8 > 0);
+		uint32_t scaledY = ScaledR / 4 + uint32_t(ScaledR % 4 > 0);
+
+		// spherical harmonics are blended once, next to the top mip
+		constants.Irradiance = int(mip == 0);
+
+		m_IBLBlendDescriptors[m_ResourceIndex * mips + mip]->BindSet(0, cmd, *m_IBLBlendPipeline);
+		m_IBLBlendPipeline->PushConstants(cmd, &constants, sizeof(IBLBlendPushConstants), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		vkCmdDispatch(cmd, scaledX, scaledY, 6u);
+	}
+
+	m_SpecularLUT[m_ResourceIndex].Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+}
@@ -1,5 +1,7 @@
 #include "pch.hpp"
 #include "renderer.hpp"
+#include "Engine/utils.hpp"
+#include <filesystem>
 
 #define WRAPL(i) (i == 0 ? m_ResourceCount : i) - 1
 #define WRAPR(i) i == m_ResourceCount - 1 ? 0 : i + 1
@@ -20,9 +22,14 @@ void VulkanBase::_drawTerrain(const PBRObject& gro, const PBRConstants& constant
 	gro.pipeline->PushConstants(cmd, &constants.Offset, PBRConstants::VertexSize(), 0u, VK_SHADER_STAGE_VERTEX_BIT);
 	gro.pipeline->BindPipeline(cmd);
 
-	vkCmdBindVertexBuffers(cmd, 0, 1, &TerrainVBs[m_ResourceIndex]->GetBuffer(), offsets);
-	vkCmdBindIndexBuffer(cmd, gro.mesh->GetIndexBuffer()->GetBuffer(), 0, VK_INDEX_TYPE_UINT32);
-	vkCmdDrawIndexed(cmd, gro.mesh->GetIndicesCount(), 1, 0, 0, 0);
+	vkCmdBindVertexBuffers(cmd, 0, 1, &gro.mesh->GetVertexBuffer()->GetBuffer(), offsets);
+	vkCmdBindIndexBuffer(cmd, gro.mesh->GetIndexBuffer()->GetBuffer(), 0, gro.mesh->GetIndexType());
+
+	// instance index selects the level, so shared footprints are drawn once for all levels using them
+	for (const GR::Shapes::GeoClipmap::FootprintDraw& draw : m_TerrainFootprints)
+	{
+		vkCmdDrawIndexed(cmd, draw.indexCount, draw.levelCount, draw.firstIndex, draw.vertexOffset, draw.firstLevel);
+	}
 
 	// grass
 	if (glm::length(m_Camera.Transform.offset) < Rt && m_GrassPipeline)
@@ -30,7 +37,7 @@ void VulkanBase::_drawTerrain(const PBRObject& gro, const PBRConstants& constant
 		m_GrassPipeline->BindPipeline(cmd);
 		m_UBOSets[m_ResourceIndex]->BindSet(0, cmd, *m_GrassPipeline);
 		m_GrassDrawSet[m_ResourceIndex]->BindSet(1, cmd, *m_GrassPipeline);
-		vkCmdDrawIndirectCount(m_DeferredSync[m_ResourceIndex].Commands, m_GrassIndirect[m_ResourceIndex]->GetBuffer(), 0, m_GrassIndirect[m_ResourceIndex]->GetBuffer(), m_GrassIndirect[m_ResourceIndex]->GetSize() - sizeof(uint32_t), m_TerrainLUT[0].Image->GetArrayLayers(), sizeof(VkDrawIndirectCommand));
+		vkCmdDrawIndirect(m_DeferredSync[m_ResourceIndex].Commands, m_GrassIndirect[m_ResourceIndex]->GetBuffer(), 0, static_cast<uint32_t>(m_GrassIndirect[m_ResourceIndex]->GetSize() / sizeof(VkDrawIndirectCommand)), sizeof(VkDrawIndirectCommand));
 	}
 
 	vkCmdNextSubpass(m_DeferredSync[m_ResourceIndex].Commands, VK_SUBPASS_CONTENTS_INLINE);
@@ -68,8 +75,8 @@ std::unique_ptr<DescriptorSet> VulkanBase::create_terrain_set(const VulkanImageV
 
 std::unique_ptr<GraphicsPipeline> VulkanBase::create_terrain_pipeline(const DescriptorSet& set, const GR::Shapes::GeoClipmap& shape) const
 {
-	auto vertAttributes = TerrainVertex::getAttributeDescriptions();
-	auto vertBindings = TerrainVertex::getBindingDescription();
+	auto vertAttributes = ClipmapVertex::getAttributeDescriptions();
+	auto vertBindings = ClipmapVertex::getBindingDescription();
 
 	return GraphicsPipelineDescriptor()
 		.SetCullMode(VK_CULL_MODE_BACK_BIT)
@@ -118,48 +125,16 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 	m_TerrainLayer->Update(&Layers, sizeof(int));
 	m_TerrainLayer->Update(&Layers, Scale, sizeof(int));
 	m_TerrainLayer->Update(&defaultTerrain, 100 * sizeof(TerrainLayerProfile), 16u);
-
-	TerrainVBs.resize(m_ResourceCount);
-
-	VkCommandBuffer cmd;
-	m_Scope.GetQueue(VK_QUEUE_TRANSFER_BIT)
-		.AllocateCommandBuffers(1, &cmd);
-
-	::BeginOneTimeSubmitCmd(cmd);
-
-	for (uint32_t i = 0; i < TerrainVBs.size(); i++)
-	{
-		VkBufferCreateInfo sbInfo{};
-		sbInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		sbInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-		sbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		sbInfo.queueFamilyIndexCount = queueFamilies.size();
-		sbInfo.pQueueFamilyIndices = queueFamilies.data();
-		sbInfo.size = VB.GetDescriptor().range;
-
-		VmaAllocationCreateInfo sbAlloc{};
-		sbAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-
-		TerrainVBs[i] = std::make_unique<Buffer>(m_Scope, sbInfo, sbAlloc);
-
-		VkBufferCopy region{};
-		region.size = VB.GetDescriptor().range;
-		vkCmdCopyBuffer(cmd, VB.GetBuffer(), TerrainVBs[i]->GetBuffer(), 1, &region);
-	}
-
-	::EndCommandBuffer(cmd);
-
-	m_Scope.GetQueue(VK_QUEUE_TRANSFER_BIT)
-		.Submit(cmd)
-		.Wait()
-		.FreeCommandBuffers(1, &cmd);
+	m_TerrainLayerHash = GR::Utils::Hash64(&defaultTerrain, sizeof(TerrainLayerProfile), GR::Utils::Hash64(&Scale, sizeof(float)));
 
 	const uint32_t VertexCount = VB.GetDescriptor().range / sizeof(TerrainVertex);
 
 	const uint32_t m = (glm::max(shape.m_VerPerRing, 7u) + 1) / 4;
 	const uint32_t LUTExtent = static_cast<uint32_t>(2 * (m + 2) + 1);
 
-	m_TerrainDispatches = VertexCount / 32 + static_cast<uint32_t>(VertexCount % 32 > 0);
+	m_TerrainShape = shape;
+	m_TerrainTracking.assign(shape.m_Rings, TerrainLevelState{});
+	m_TerrainLevels.assign(m_ResourceCount, std::vector<TerrainLevelState>(shape.m_Rings));
 
 	VkImageCreateInfo noiseInfo{};
 	noiseInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -201,8 +176,16 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 	m_TerrainSet.resize(m_ResourceCount);
 	m_GrassDrawSet.resize(m_ResourceCount);
 	m_GrassIndirect.resize(m_ResourceCount);
-	m_GrassPositions.resize(m_ResourceCount);
+	m_GrassInstances.resize(m_ResourceCount);
+	m_GrassCounters.resize(m_ResourceCount);
 	m_TerrainDrawSet.resize(m_ResourceCount);
+	m_TerrainOrigins.resize(m_ResourceCount);
+	m_TerrainTileSet.resize(m_ResourceCount);
+	m_TerrainTileStaging.resize(m_ResourceCount);
+	m_TerrainTileReadback.assign(m_ResourceCount, {});
+	m_WaterLUT.resize(m_ResourceCount);
+	m_WaterSet.resize(m_ResourceCount);
+	m_WaterVersion.assign(m_ResourceCount, 0u);
 
 	VkCommandBuffer clearCMD;
 	VkClearColorValue Color;
@@ -223,6 +206,13 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 		vkCmdClearColorImage(clearCMD, m_TerrainLUT[i].Image->GetImage(), VK_IMAGE_LAYOUT_GENERAL, &Color, 1, &m_TerrainLUT[i].Image->GetSubResourceRange());
 
 		m_TerrainLUT[i].Image->TransitionLayout(clearCMD, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_GRAPHICS_BIT);
+
+		m_WaterLUT[i].Image = std::make_unique<VulkanImage>(m_Scope, waterInfo, noiseAllocCreateInfo);
+		m_WaterLUT[i].View = std::make_unique<VulkanImageView>(m_Scope, *m_WaterLUT[i].Image);
+
+		vkCmdClearColorImage(clearCMD, m_WaterLUT[i].Image->GetImage(), VK_IMAGE_LAYOUT_GENERAL, &Color, 1, &m_WaterLUT[i].Image->GetSubResourceRange());
+
+		m_WaterLUT[i].Image->TransitionLayout(clearCMD, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_GRAPHICS_BIT);
 	}
 	::EndCommandBuffer(clearCMD);
 
@@ -231,73 +221,146 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 		.Wait()
 		.FreeCommandBuffers(1, &clearCMD);
 
-	uint32_t firstRing = m_TerrainLUT[0].Image->GetExtent().width * m_TerrainLUT[0].Image->GetExtent().height;
-	uint32_t nextRings = firstRing - glm::ceil(float(m_TerrainLUT[0].Image->GetExtent().width) / 2.0) * glm::ceil(float(m_TerrainLUT[0].Image->GetExtent().height) / 2.0);
+	// instances are bucketed by ring and blade LOD, the budget cuts the outermost rings, so every bucket fits all of its ring
+	const uint32_t grassRings = glm::min(shape.m_GrassRings, shape.m_Rings);
+	const uint32_t grassInstances = shape.m_GrassBudget > 0 ? glm::min(shape.m_GrassBudget, m_TerrainLevelVertices[grassRings]) : m_TerrainLevelVertices[grassRings];
+
+	uint32_t grassBuckets = 0u;
+	while (grassBuckets < grassRings && m_TerrainLevelVertices[grassBuckets] < grassInstances)
+	{
+		grassBuckets++;
+	}
+
+	// counts are written by the culling, first vertex selects the blade LOD
+	std::vector<VkDrawIndirectCommand> grassCommands(grassBuckets * GrassLODs);
+	// finished workgroups, followed by visible instances of every bucket
+	std::vector<uint32_t> grassCounters(1 + grassBuckets * GrassLODs, 0u);
+	for (uint32_t i = 0; i < grassBuckets; i++)
+	{
+		const uint32_t capacity = glm::min(m_TerrainLevelVertices[i + 1], grassInstances) - m_TerrainLevelVertices[i];
+		for (uint32_t lod = 0; lod < GrassLODs; lod++)
+		{
+			VkDrawIndirectCommand& command = grassCommands[i * GrassLODs + lod];
+			command.vertexCount = 0;
+			command.instanceCount = 0;
+			command.firstVertex = lod;
+			command.firstInstance = GrassLODs * m_TerrainLevelVertices[i] + lod * capacity;
+		}
+	}
 
 	VmaAllocationCreateInfo grassAllocCreateInfo{};
-	grassAllocCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	grassAllocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
 	VkBufferCreateInfo grassInfo{};
 	grassInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	grassInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	grassInfo.size = sizeof(VkDrawIndirectCommand) * (shape.m_Rings + 2);
 	grassInfo.queueFamilyIndexCount = queueFamilies.size();
 	grassInfo.pQueueFamilyIndices = queueFamilies.data();
-	grassInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
-
-	if (shape.m_GrassRings > 0)
-	{
-		m_GrassIndirectRef = std::make_unique<Buffer>(m_Scope, grassInfo, grassAllocCreateInfo);
 
-		VkDispatchIndirectCommand computeCommand = { 0, 1, 1 };
-		VkDrawIndirectCommand* commandsDraw = new VkDrawIndirectCommand[shape.m_Rings];
-
-		uint32_t vtx_offset = 0u;
-		for (uint32_t i = 0; i < shape.m_Rings; i++)
-		{
-			commandsDraw[i].vertexCount = i == 0 ? 27 : (i == 1 ? 15 : 3);
-			commandsDraw[i].instanceCount = 0;
-			commandsDraw[i].firstVertex = i;
-			commandsDraw[i].firstInstance = vtx_offset;
-
-			vtx_offset += i == 0 ? firstRing : nextRings;
-			computeCommand.x += i < shape.m_GrassRings ? vtx_offset : 0;
-		}
-		computeCommand.x /= 32u;
-
-		m_GrassIndirectRef->Update(&computeCommand, sizeof(VkDispatchIndirectCommand), 0u);
-		m_GrassIndirectRef->Update(commandsDraw, sizeof(VkDrawIndirectCommand) * shape.m_Rings, sizeof(VkDrawIndirectCommand));
-		m_GrassIndirectRef->Update((void*)&shape.m_GrassRings, sizeof(uint32_t), m_GrassIndirectRef->GetSize() - sizeof(uint32_t));
-
-		delete[] commandsDraw;
-	}
-
-	grassAllocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	VkBufferCreateInfo originsInfo{};
+	originsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	originsInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	originsInfo.size = sizeof(glm::ivec4) * shape.m_Rings;
+	originsInfo.queueFamilyIndexCount = queueFamilies.size();
+	originsInfo.pQueueFamilyIndices = queueFamilies.data();
+	originsInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	// tiles only live on the compute queue, two height samples are packed into every word of the staging buffer
+	const uint32_t TileExtent = TerrainTileSize + 1u;
+	const VkDeviceSize TileStride = sizeof(uint32_t) * ((TileExtent * TileExtent + 1u) / 2u);
+
+	VkImageCreateInfo tileInfo{};
+	tileInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	tileInfo.arrayLayers = TerrainTileSlots;
+	tileInfo.extent = { TileExtent, TileExtent, 1 };
+	tileInfo.format = VK_FORMAT_R16_UNORM;
+	tileInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	tileInfo.mipLevels = 1;
+	tileInfo.flags = 0u;
+	tileInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	tileInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	tileInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	tileInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	tileInfo.imageType = VK_IMAGE_TYPE_2D;
+
+	// erosion passes outlive the frames in flight, so they are accumulated in a single image and copied into the water LUTs
+	waterInfo.arrayLayers = 2 * shape.m_Rings;
+	waterInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	waterInfo.queueFamilyIndexCount = 0u;
+	waterInfo.pQueueFamilyIndices = VK_NULL_HANDLE;
+	waterInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	m_ErosionMap.Image = std::make_unique<VulkanImage>(m_Scope, waterInfo, noiseAllocCreateInfo);
+	m_ErosionMap.Image->TransitionLayout(VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+	m_ErosionMap.View = std::make_unique<VulkanImageView>(m_Scope, *m_ErosionMap.Image);
+	m_ErosionReset = true;
+
+	m_TerrainTiles.Image = std::make_unique<VulkanImage>(m_Scope, tileInfo, noiseAllocCreateInfo);
+	m_TerrainTiles.Image->TransitionLayout(VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+	m_TerrainTiles.View = std::make_unique<VulkanImageView>(m_Scope, *m_TerrainTiles.Image);
+
+	VkBufferCreateInfo tileTableInfo{};
+	tileTableInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	tileTableInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	tileTableInfo.size = sizeof(glm::uvec4) * 2 * TerrainTileSlots;
+	tileTableInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	m_TerrainTileTable = std::make_unique<Buffer>(m_Scope, tileTableInfo, grassAllocCreateInfo);
+
+	std::vector<glm::uvec4> emptyTable(2 * TerrainTileSlots, glm::uvec4(UINT32_MAX));
+	m_TerrainTileTable->Update(emptyTable.data(), sizeof(glm::uvec4) * emptyTable.size());
+
+	VmaAllocationCreateInfo stagingAllocCreateInfo{};
+	stagingAllocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+	stagingAllocCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	VkBufferCreateInfo tileStagingInfo{};
+	tileStagingInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	tileStagingInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	tileStagingInfo.size = TileStride * TerrainTileBudget;
+	tileStagingInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	terrain_cache_open();
 
 	for (uint32_t i = 0; i < m_TerrainLUT.size(); i++)
 	{
+		m_TerrainOrigins[i] = std::make_unique<Buffer>(m_Scope, originsInfo, grassAllocCreateInfo);
+		m_TerrainTileStaging[i] = std::make_unique<Buffer>(m_Scope, tileStagingInfo, stagingAllocCreateInfo);
+
+		m_TerrainTileSet[i] = DescriptorSetDescriptor()
+			.AddStorageBuffer(0, VK_SHADER_STAGE_COMPUTE_BIT, *m_TerrainTileStaging[i])
+			.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, *m_TerrainLayer)
+			.Allocate(m_Scope);
+
 		if (shape.m_GrassRings > 0)
 		{
-			grassInfo.size = sizeof(VkDrawIndirectCommand) * (shape.m_Rings + 1);
+			grassInfo.size = sizeof(VkDrawIndirectCommand) * grassBuckets;
 			grassInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
 			m_GrassIndirect[i] = std::make_unique<Buffer>(m_Scope, grassInfo, grassAllocCreateInfo);
+			m_GrassIndirect[i]->Update(grassCommands.data(), grassInfo.size);
 
-			grassInfo.size = sizeof(glm::ivec4) * (firstRing + nextRings * (shape.m_GrassRings - 1));
+			grassInfo.size = sizeof(glm::uvec2) * grassInstances * GrassLODs;
 			grassInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-			m_GrassPositions[i] = std::make_unique<Buffer>(m_Scope, grassInfo, grassAllocCreateInfo);
+			m_GrassInstances[i] = std::make_unique<Buffer>(m_Scope, grassInfo, grassAllocCreateInfo);
+
+			grassInfo.size = sizeof(uint32_t) * grassCounters.size();
+			m_GrassCounters[i] = std::make_unique<Buffer>(m_Scope, grassInfo, grassAllocCreateInfo);
+			m_GrassCounters[i]->Update(grassCounters.data(), grassInfo.size);
 
 			m_GrassSet[i] = DescriptorSetDescriptor()
 				.AddImageSampler(0, VK_SHADER_STAGE_COMPUTE_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearClamp, 1))
-				.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, *TerrainVBs[i])
-				.AddStorageBuffer(2, VK_SHADER_STAGE_COMPUTE_BIT, *m_GrassPositions[i])
+				.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, VB)
+				.AddStorageBuffer(2, VK_SHADER_STAGE_COMPUTE_BIT, *m_GrassInstances[i])
 				.AddStorageBuffer(3, VK_SHADER_STAGE_COMPUTE_BIT, *m_GrassIndirect[i])
+				.AddStorageBuffer(4, VK_SHADER_STAGE_COMPUTE_BIT, *m_TerrainOrigins[i])
+				.AddStorageBuffer(5, VK_SHADER_STAGE_COMPUTE_BIT, *m_GrassCounters[i])
 				.Allocate(m_Scope);
 
 			m_GrassDrawSet[i] = DescriptorSetDescriptor()
-				.AddImageSampler(0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearClamp, 1))
-				.AddStorageBuffer(1, VK_SHADER_STAGE_VERTEX_BIT, *TerrainVBs[i])
-				.AddStorageBuffer(2, VK_SHADER_STAGE_VERTEX_BIT, *m_GrassPositions[i])
+				.AddImageSampler(0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, 1))
+				.AddStorageBuffer(1, VK_SHADER_STAGE_VERTEX_BIT, VB)
+				.AddStorageBuffer(2, VK_SHADER_STAGE_VERTEX_BIT, *m_GrassInstances[i])
 				.AddImageSampler(3, VK_SHADER_STAGE_VERTEX_BIT, m_DepthHR[i].Views[1]->GetImageView(), m_Scope.GetSampler(ESamplerType::PointClamp, 1))
+				.AddStorageBuffer(4, VK_SHADER_STAGE_VERTEX_BIT, *m_TerrainOrigins[i])
 				.Allocate(m_Scope);
 		}
 
@@ -306,20 +369,34 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 			.AddStorageBuffer(1, VK_SHADER_STAGE_COMPUTE_BIT, *m_TerrainLayer)
 			.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_TerrainLUT[(i == 0 ? m_TerrainLUT.size() : i) - 1].View->GetImageView(), m_Scope.GetSampler(ESamplerType::PointClamp, 1))
 			.AddStorageBuffer(3, VK_SHADER_STAGE_COMPUTE_BIT, VB)
-			.AddStorageBuffer(4, VK_SHADER_STAGE_COMPUTE_BIT, *TerrainVBs[i])
-			.AddStorageBuffer(5, VK_SHADER_STAGE_COMPUTE_BIT, *TerrainVBs[(i == 0 ? m_TerrainLUT.size() : i) - 1])
+			.AddStorageBuffer(4, VK_SHADER_STAGE_COMPUTE_BIT, *m_TerrainOrigins[i])
+			.AddImageSampler(5, VK_SHADER_STAGE_COMPUTE_BIT, m_TerrainTiles.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearClamp, 1), VK_IMAGE_LAYOUT_GENERAL)
+			.AddStorageBuffer(6, VK_SHADER_STAGE_COMPUTE_BIT, *m_TerrainTileTable)
 			.Allocate(m_Scope);
 
+		// layers wrap around toroidally, so filtering has to wrap as well
 		m_TerrainDrawSet[i] = DescriptorSetDescriptor()
-			.AddImageSampler(0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearClamp, 1))
-			// .AddImageSampler(1, VK_SHADER_STAGE_FRAGMENT_BIT, m_WaterLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearClamp, 1))
+			.AddImageSampler(0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, 1))
+			.AddImageSampler(1, VK_SHADER_STAGE_VERTEX_BIT, m_WaterLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::PointClamp, 1))
+			.AddStorageBuffer(2, VK_SHADER_STAGE_VERTEX_BIT, *m_TerrainOrigins[i])
+			.Allocate(m_Scope);
+
+		m_WaterSet[i] = DescriptorSetDescriptor()
+			.AddImageSampler(0, VK_SHADER_STAGE_COMPUTE_BIT, m_TerrainLUT[i].View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, 1))
+			.AddStorageImage(1, VK_SHADER_STAGE_COMPUTE_BIT, m_ErosionMap.View->GetImageView())
+			.AddStorageBuffer(2, VK_SHADER_STAGE_COMPUTE_BIT, *m_TerrainOrigins[i])
 			.Allocate(m_Scope);
 	}
 
 	{
+		VkPushConstantRange ConstantNoise{};
+		ConstantNoise.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		ConstantNoise.size = 5 * sizeof(uint32_t);
+
 		m_TerrainCompute = ComputePipelineDescriptor()
 			.AddDescriptorLayout(m_UBOSets[0]->GetLayout())
 			.AddDescriptorLayout(m_TerrainSet[0]->GetLayout())
+			.AddPushConstant(ConstantNoise)
 			.AddSpecializationConstant(0, Rg)
 			.AddSpecializationConstant(1, Rt)
 			.AddSpecializationConstant(2, VertexCount)
@@ -329,9 +406,43 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 			.AddSpecializationConstant(6, shape.m_NoiseSeed)
 			.AddSpecializationConstant(7, float(glm::ceil(float(shape.m_Rings) / 3.f) + 1.f))
 			.AddSpecializationConstant(8, shape.m_Rings)
+			.AddSpecializationConstant(9, TerrainTileSize)
+			.AddSpecializationConstant(10, 2 * TerrainTileSlots)
+			.AddSpecializationConstant(11, TerrainTileProbes)
 			.SetShaderName("terrain_noise_comp")
 			.Construct(m_Scope);
 
+		VkPushConstantRange ConstantTile{};
+		ConstantTile.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		ConstantTile.size = 6 * sizeof(uint32_t);
+
+		m_TerrainTileCompute = ComputePipelineDescriptor()
+			.AddDescriptorLayout(m_UBOSets[0]->GetLayout())
+			.AddDescriptorLayout(m_TerrainTileSet[0]->GetLayout())
+			.AddPushConstant(ConstantTile)
+			.AddSpecializationConstant(0, Rg)
+			.AddSpecializationConstant(1, Rt)
+			.AddSpecializationConstant(4, shape.m_MinHeight)
+			.AddSpecializationConstant(5, glm::max(shape.m_MaxHeight, shape.m_MinHeight + 1))
+			.AddSpecializationConstant(6, shape.m_NoiseSeed)
+			.AddSpecializationConstant(9, TerrainTileSize)
+			.SetShaderName("terrain_tile_comp")
+			.Construct(m_Scope);
+
+		VkPushConstantRange ConstantWater{};
+		ConstantWater.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		ConstantWater.size = 3 * sizeof(uint32_t);
+
+		m_WaterCompute = ComputePipelineDescriptor()
+			.AddDescriptorLayout(m_WaterSet[0]->GetLayout())
+			.AddPushConstant(ConstantWater)
+			.AddSpecializationConstant(2, shape.m_Scale)
+			.AddSpecializationConstant(3, shape.m_MinHeight)
+			.AddSpecializationConstant(4, glm::max(shape.m_MaxHeight, shape.m_MinHeight + 1))
+			.AddSpecializationConstant(5, shape.m_NoiseSeed)
+			.SetShaderName("erosion_comp")
+			.Construct(m_Scope);
+
 		VkPushConstantRange ConstantCompose{};
 		ConstantCompose.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 		ConstantCompose.size = sizeof(int);
@@ -370,16 +481,23 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 				.AddSpecializationConstant(6, shape.m_NoiseSeed, VK_SHADER_STAGE_VERTEX_BIT)
 				.Construct(m_Scope);
 
+			VkPushConstantRange ConstantHiZ{};
+			ConstantHiZ.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			ConstantHiZ.size = sizeof(glm::dmat4);
+
 			m_GrassOcclude = ComputePipelineDescriptor()
 				.AddDescriptorLayout(m_UBOSets[0]->GetLayout())
 				.AddDescriptorLayout(m_GrassSet[0]->GetLayout())
+				.AddDescriptorLayout(m_HiZSets[0]->GetLayout())
+				.AddPushConstant(ConstantHiZ)
 				.AddSpecializationConstant(0, Rg)
 				.AddSpecializationConstant(1, Rt)
-				.AddSpecializationConstant(2, shape.m_GrassRings)
+				.AddSpecializationConstant(2, grassBuckets)
 				.AddSpecializationConstant(3, shape.m_Scale)
 				.AddSpecializationConstant(4, shape.m_MinHeight)
 				.AddSpecializationConstant(5, glm::max(shape.m_MaxHeight, shape.m_MinHeight + 1))
-				.SetShaderName("grass_indirect_comp")
+				.AddSpecializationConstant(6, grassInstances)
+				.SetShaderName(m_SubgroupCompaction ? "grass_indirect_comp" : "grass_indirect_atomic_comp")
 				.Construct(m_Scope);
 		}
 
@@ -407,7 +525,7 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 
 		ComputePipelineDescriptor VolumetricPSO{};
 		VolumetricPSO.AddDescriptorLayout(m_UBOSets[0]->GetLayout())
-			.AddDescriptorLayout(m_VolumetricsDescriptor->GetLayout())
+			.AddDescriptorLayout(m_VolumetricsDescriptors[0]->GetLayout())
 			.AddDescriptorLayout(dummy)
 			.AddPushConstant(ConstantOrder)
 			.AddSpecializationConstant(0, float(Rg + shape.m_MinHeight))
@@ -426,4 +544,498 @@ VkBool32 VulkanBase::terrain_init(const Buffer& VB, const GR::Shapes::GeoClipmap
 	}
 
 	return 1;
-}
\ No newline at end of file
+}
+
+void VulkanBase::terrain_update(VkCommandBuffer cmd)
+{
+	const GR::Shapes::GeoClipmap& shape = m_TerrainShape;
+	const int32_t Size = static_cast<int32_t>(m_TerrainLUT[0].Image->GetExtent().width);
+	const float MaxHeight = glm::max(shape.m_MaxHeight, shape.m_MinHeight + 1);
+	const float deltaS = float(glm::ceil(float(shape.m_Rings) / 3.f) + 1.f);
+
+	// same placement as the uniform buffer and terrain_noise use
+	const glm::dvec3 CameraPosition = m_Camera.Transform.GetOffset();
+	const glm::dvec3 WorldUp = glm::dvec3(glm::normalize(glm::round(glm::vec3(CameraPosition))));
+	const glm::mat3 WorldOrientation = glm::mat3_cast(GR::Utils::OrientationFromNormal(glm::vec3(WorldUp)));
+	const double Altitude = glm::length(CameraPosition) - Rg;
+	const float VertexScale = shape.m_Scale * (Altitude > MaxHeight ? glm::exp2(glm::mix(5.f, 0.f, glm::clamp(float(MaxHeight - shape.m_MinHeight) / float(Altitude), 0.f, 1.f))) : 1.f);
+
+	// pixels covered by one unit of height at unit distance, the octave amplitude falls off by GainA of terrain_fbm
+	const double GainA = 0.54;
+	const double PixelsPerUnit = 0.5 * double(m_Scope.GetSwapchainExtent().height) * glm::abs(double(m_Camera.GetProjectionMatrix()[1][1]));
+	const double HeightAbove = glm::max(Altitude - double(MaxHeight), double(VertexScale));
+
+	std::vector<TerrainLevelState>& levels = m_TerrainLevels[m_ResourceIndex];
+	const std::vector<TerrainLevelState>& previous = m_TerrainLevels[WRAPL(m_ResourceIndex)];
+
+	std::vector<glm::ivec4> origins(levels.size());
+	std::vector<uint32_t> force(levels.size(), 0u);
+	std::vector<int32_t> octaves(levels.size(), -1);
+	std::vector<bool> evaluate(levels.size(), false);
+
+	for (uint32_t level = 0; level < levels.size(); level++)
+	{
+		const double AdjustScale = VertexScale * glm::exp2(glm::max(float(level), deltaS));
+		const double Spacing = VertexScale * glm::exp2(float(level));
+		const glm::dvec3 Center = glm::round(glm::round(WorldUp * double(Rg) * (1.0 / AdjustScale)) * AdjustScale);
+
+		// level center moved by whole increments, shift the origin by the same amount of texels along the grid,
+		// so texels which stay on the surface keep their address and only exposed rows and columns are evaluated
+		TerrainLevelState& tracking = m_TerrainTracking[level];
+		if (tracking.Valid && tracking.VertexScale == VertexScale && tracking.Center != Center)
+		{
+			const glm::dvec3 Delta = Center - tracking.Center;
+			const glm::ivec2 Shift = glm::ivec2(glm::round(glm::dvec2(glm::dot(Delta, glm::dvec3(WorldOrientation[0])), glm::dot(Delta, glm::dvec3(WorldOrientation[2]))) / Spacing));
+
+			tracking.Origin = ((tracking.Origin + Shift) % Size + Size) % Size;
+		}
+
+		tracking.Center = Center;
+		tracking.Up = WorldUp;
+		tracking.VertexScale = VertexScale;
+		tracking.Valid = true;
+	}
+
+	// cached tiles for the current placement, a level switches between tiles and noise only as a whole
+	std::vector<int32_t> tileLevel;
+	terrain_tiles_update(cmd, m_TerrainTracking, VertexScale, tileLevel);
+
+	for (uint32_t level = 0; level < levels.size(); level++)
+	{
+		const double Spacing = VertexScale * glm::exp2(float(level));
+		const glm::dvec3& Center = m_TerrainTracking[level].Center;
+		const TerrainLevelState& tracking = m_TerrainTracking[level];
+
+		// grid turns with the camera, so even with the same center the layer goes stale once its border drifts by half a unit
+		TerrainLevelState& state = levels[level];
+		const double Drift = glm::length(WorldUp - state.Up) * Spacing * double(Size / 2);
+
+		// octaves left after the budget sum up to at most GainA^(n + 1) / (1 - GainA) of the height range,
+		// the budget holds for the closest point of the level, which is the inner border of its ring
+		if (m_TerrainPixelError > 0.f && PixelsPerUnit > 0.0)
+		{
+			const double Inner = level == 0 ? 0.0 : 0.25 * Spacing * double(Size - 1);
+			const double Distance = glm::sqrt(HeightAbove * HeightAbove + Inner * Inner);
+			const double Ratio = double(m_TerrainPixelError) * (1.0 - GainA) * Distance / (double(MaxHeight - shape.m_MinHeight) * PixelsPerUnit);
+
+			octaves[level] = Ratio >= 1.0 ? 1 : glm::clamp(int32_t(glm::floor(glm::log(Ratio) / glm::log(GainA))), 1, 64);
+		}
+
+		// texels evaluated from farther away are reused until the budget outgrows them
+		const int32_t Stored = glm::min(state.Octaves, previous[level].Octaves);
+		const bool Refine = Stored + m_TerrainRefineOctaves < octaves[level];
+
+		evaluate[level] = !state.Valid || Refine || state.Center != Center || state.Origin != tracking.Origin || state.VertexScale != VertexScale || Drift > 0.5;
+		force[level] = state.Valid && !Refine ? 0u : 1u;
+
+		// switching between tiles and noise would leave texels of both in the layer
+		if (tileLevel[level] != state.TileLevel && (evaluate[level] || tileLevel[level] >= 0))
+		{
+			evaluate[level] = true;
+			force[level] = 1u;
+		}
+
+		origins[level] = glm::ivec4(evaluate[level] ? tracking.Origin : state.Origin, previous[level].Origin);
+
+		if (evaluate[level])
+		{
+			const int32_t Lowest = force[level] ? octaves[level] : glm::min(Stored, octaves[level]);
+
+			state = tracking;
+			state.Octaves = Lowest;
+			state.TileLevel = tileLevel[level];
+		}
+	}
+
+	m_TerrainOrigins[m_ResourceIndex]->Update(cmd, origins.data(), sizeof(glm::ivec4) * origins.size());
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	// reference vertices are stored level by level, so unchanged levels are not dispatched at all
+	m_UBOTempSets[m_ResourceIndex]->BindSet(0, cmd, *m_TerrainCompute);
+	m_TerrainSet[m_ResourceIndex]->BindSet(1, cmd, *m_TerrainCompute);
+	m_TerrainCompute->BindPipeline(cmd);
+
+	bool evaluated = false;
+	for (uint32_t level = 0; level < levels.size(); level++)
+	{
+		const uint32_t Dispatch[5] = { m_TerrainLevelVertices[level], m_TerrainLevelVertices[level + 1] - m_TerrainLevelVertices[level], force[level], static_cast<uint32_t>(octaves[level]), static_cast<uint32_t>(tileLevel[level]) };
+		if (!evaluate[level] || Dispatch[1] == 0)
+			continue;
+
+		m_TerrainCompute->PushConstants(cmd, Dispatch, sizeof(Dispatch), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		vkCmdDispatch(cmd, Dispatch[1] / 32 + static_cast<uint32_t>(Dispatch[1] % 32 > 0), 1, 1);
+		evaluated = true;
+	}
+
+	if (!evaluated)
+		return;
+
+	m_TerrainLUT[m_ResourceIndex].Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+	m_TerrainSet[m_ResourceIndex]->BindSet(0, cmd, *m_TerrainCompose);
+	m_TerrainCompose->BindPipeline(cmd);
+
+	// coarser layers take maximum of the finer ones, which has to be redone whenever any finer layer changed
+	bool changed = evaluate[0];
+	for (uint32_t i = 1; i < levels.size(); i++)
+	{
+		changed = changed || evaluate[i];
+		if (!changed)
+			continue;
+
+		m_TerrainLUT[m_ResourceIndex].Image->TransitionLayout(cmd, VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, i - 1, 1), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		m_TerrainCompose->PushConstants(cmd, &i, sizeof(uint32_t), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		vkCmdDispatch(cmd, ceil(float((m_TerrainLUT[0].Image->GetExtent().width) / 16.f)), ceil(float((m_TerrainLUT[0].Image->GetExtent().height) / 8.f)), 1);
+	}
+}
+
+void VulkanBase::terrain_erosion(VkCommandBuffer cmd)
+{
+	const uint32_t Rings = m_WaterLUT[0].Image->GetArrayLayers();
+	const VkExtent3D& Extent = m_WaterLUT[0].Image->GetExtent();
+	const VkImageSubresourceRange Running = VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, Rings);
+	const VkImageSubresourceRange Finished = VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, Rings, Rings);
+
+	VkClearColorValue Color{};
+
+	VkImageCopy region{};
+	region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, Rings };
+	region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, Rings, Rings };
+	region.extent = Extent;
+
+	// flow is addressed with the origins of the level, once a level is placed anew its wrapped rows hold flow of the terrain that was there before
+	// and the running pass would mix droplets traced under both placements, so the level is cleared and fills again over the next passes
+	const std::vector<TerrainLevelState>& levels = m_TerrainLevels[m_ResourceIndex];
+	m_ErosionPlacement.resize(levels.size());
+
+	bool moved = false;
+	for (uint32_t level = 0; level < levels.size() && level < Rings; level++)
+	{
+		TerrainLevelState& placement = m_ErosionPlacement[level];
+		if (placement.Valid && placement.Center == levels[level].Center && placement.Origin == levels[level].Origin && placement.VertexScale == levels[level].VertexScale)
+			continue;
+
+		placement = levels[level];
+		if (m_ErosionReset)
+			continue;
+
+		const VkImageSubresourceRange Layers[2] = { VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, level, 1), VkImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, Rings + level, 1) };
+		for (const VkImageSubresourceRange& Layer : Layers)
+		{
+			m_ErosionMap.Image->TransitionLayout(cmd, Layer, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+			vkCmdClearColorImage(cmd, m_ErosionMap.Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &Color, 1, &Layer);
+			m_ErosionMap.Image->TransitionLayout(cmd, Layer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+		}
+
+		moved = true;
+	}
+
+	// frames in flight have to drop the cleared levels as well
+	if (moved)
+	{
+		m_ErosionVersion++;
+	}
+
+	// new settings restart the pass, finished one is dropped as well since it was traced over different heights
+	if (m_ErosionReset)
+	{
+		m_ErosionMap.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		vkCmdClearColorImage(cmd, m_ErosionMap.Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &Color, 1, &m_ErosionMap.Image->GetSubResourceRange());
+		m_ErosionMap.Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+		m_ErosionFrame = 0u;
+		m_ErosionVersion = m_ErosionDroplets == 0u ? 0u : m_ErosionVersion + 1u;
+		m_ErosionReset = false;
+	}
+	else if (m_ErosionDroplets > 0u && m_ErosionFrame == 0u)
+	{
+		m_ErosionMap.Image->TransitionLayout(cmd, Running, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+		vkCmdClearColorImage(cmd, m_ErosionMap.Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &Color, 1, &Running);
+		m_ErosionMap.Image->TransitionLayout(cmd, Running, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+	}
+
+	if (m_ErosionDroplets > 0u)
+	{
+		// every texel of every level starts one droplet per pass, split evenly between the frames of the pass
+		const uint32_t Texels = Extent.width * Extent.height * Rings;
+		const uint32_t Slices = (Texels + m_ErosionDroplets - 1u) / m_ErosionDroplets;
+		const uint32_t Droplets = (Texels + Slices - 1u) / Slices;
+		const uint32_t Dispatch[3] = { Droplets, Slices, m_ErosionFrame };
+
+		m_ErosionMap.Image->TransitionLayout(cmd, Running, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+		m_WaterSet[m_ResourceIndex]->BindSet(0, cmd, *m_WaterCompute);
+		m_WaterCompute->PushConstants(cmd, Dispatch, sizeof(Dispatch), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		m_WaterCompute->BindPipeline(cmd);
+		vkCmdDispatch(cmd, Droplets / 64 + static_cast<uint32_t>(Droplets % 64 > 0), 1, 1);
+
+		if (++m_ErosionFrame >= Slices)
+		{
+			m_ErosionMap.Image->TransitionLayout(cmd, Running, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+			m_ErosionMap.Image->TransitionLayout(cmd, Finished, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+			vkCmdCopyImage(cmd, m_ErosionMap.Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_ErosionMap.Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			m_ErosionMap.Image->TransitionLayout(cmd, Running, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+			m_ErosionMap.Image->TransitionLayout(cmd, Finished, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+			m_ErosionFrame = 0u;
+			m_ErosionVersion++;
+		}
+	}
+
+	// frames in flight pick up the finished pass one by one, the copy is only made when it changed
+	if (m_WaterVersion[m_ResourceIndex] == m_ErosionVersion)
+		return;
+
+	region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, Rings, Rings };
+	region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, Rings };
+
+	m_ErosionMap.Image->TransitionLayout(cmd, Finished, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+	m_WaterLUT[m_ResourceIndex].Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+	vkCmdCopyImage(cmd, m_ErosionMap.Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_WaterLUT[m_ResourceIndex].Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	m_WaterLUT[m_ResourceIndex].Image->TransitionLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_QUEUE_COMPUTE_BIT);
+	m_ErosionMap.Image->TransitionLayout(cmd, Finished, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_COMPUTE_BIT);
+
+	m_WaterVersion[m_ResourceIndex] = m_ErosionVersion;
+}
+
+void VulkanBase::terrain_cache_open()
+{
+	m_TerrainCache.reset();
+
+	// resident tiles and tiles still in flight may belong to the old settings
+	m_TerrainTileSlotUse.assign(TerrainTileSlots, { UINT64_MAX, 0u });
+	m_TerrainTileResident.clear();
+	m_TerrainTileTableDirty = true;
+
+	for (std::vector<std::pair<uint64_t, uint32_t>>& readback : m_TerrainTileReadback)
+		readback.clear();
+
+	if (m_TerrainCachePath.empty())
+		return;
+
+	GR::TerrainCache::Key key{};
+	key.ProfileHash = m_TerrainLayerHash;
+	key.Seed = m_TerrainShape.m_NoiseSeed;
+	key.TileSize = TerrainTileSize;
+	key.MinHeight = m_TerrainShape.m_MinHeight;
+	key.MaxHeight = glm::max(m_TerrainShape.m_MaxHeight, m_TerrainShape.m_MinHeight + 1);
+	key.Radius = Rg;
+
+	char name[64];
+	snprintf(name, sizeof(name), "terrain_%08x_%016llx.bin", key.Seed, static_cast<unsigned long long>(key.ProfileHash));
+
+	m_TerrainCache = std::make_unique<GR::TerrainCache>((std::filesystem::path(m_TerrainCachePath) / name).string(), key);
+}
+
+void VulkanBase::terrain_tiles_update(VkCommandBuffer cmd, const std::vector<TerrainLevelState>& levels, float VertexScale, std::vector<int32_t>& outTileLevel)
+{
+	outTileLevel.assign(levels.size(), -1);
+
+	if (!m_TerrainCache)
+		return;
+
+	const int32_t Size = static_cast<int32_t>(m_TerrainLUT[0].Image->GetExtent().width);
+	const uint32_t TileExtent = TerrainTileSize + 1u;
+	const uint32_t TileWords = (TileExtent * TileExtent + 1u) / 2u;
+	const uint32_t TableSize = 2u * TerrainTileSlots;
+
+	Buffer& staging = *m_TerrainTileStaging[m_ResourceIndex];
+	uint8_t* stagingMemory = static_cast<uint8_t*>(staging.mappedMemory);
+
+	// frame which generated these tiles is finished once its command buffer is recorded again
+	std::vector<std::pair<uint64_t, uint32_t>>& readback = m_TerrainTileReadback[m_ResourceIndex];
+	if (!readback.empty())
+	{
+		staging.Invalidate();
+
+		for (const std::pair<uint64_t, uint32_t>& generated : readback)
+		{
+			std::vector<uint16_t> heights(TileExtent * TileExtent);
+			memcpy(heights.data(), stagingMemory + sizeof(uint32_t) * TileWords * generated.second, sizeof(uint16_t) * heights.size());
+
+			m_TerrainCache->Store(generated.first, std::move(heights));
+		}
+
+		readback.clear();
+	}
+
+	m_TerrainTileFrame++;
+
+	struct TileJob
+	{
+		uint64_t Tile;
+		uint32_t Slot;
+		bool Generate;
+	};
+
+	std::vector<TileJob> jobs;
+	jobs.reserve(TerrainTileBudget);
+
+	for (uint32_t level = 0; level < levels.size(); level++)
+	{
+		// samples of the tile are at most as far apart as the level vertices, measured at the face center where they are the sparsest
+		const double Spacing = VertexScale * glm::exp2(float(level));
+		const int32_t Depth = static_cast<int32_t>(glm::ceil(glm::log2(2.0 * double(Rg) / (double(TerrainTileSize) * Spacing))));
+
+		if (!levels[level].Valid || Depth < 0 || Depth > static_cast<int32_t>(GR::TerrainCache::MaxLevel))
+			continue;
+
+		// probe the level square densely enough to not step over a tile
+		const glm::mat3 Orientation = glm::mat3_cast(GR::Utils::OrientationFromNormal(glm::vec3(levels[level].Up)));
+		const double Extent = 0.5 * Spacing * double(Size - 1);
+		const uint32_t Tiles = 1u << Depth;
+
+		std::set<uint64_t> needed;
+		for (uint32_t y = 0; y <= 16u; y++)
+		{
+			for (uint32_t x = 0; x <= 16u; x++)
+			{
+				const glm::dvec2 Offset = glm::mix(glm::dvec2(-Extent), glm::dvec2(Extent), glm::dvec2(x, y) / 16.0);
+				const glm::dvec3 Position = levels[level].Center + glm::dvec3(Orientation * glm::vec3(Offset.x, 0.0, Offset.y));
+
+				glm::dvec2 UV;
+				const uint32_t Face = GR::TerrainCache::CubeFace(glm::normalize(Position), UV);
+				const glm::uvec2 Tile = glm::min(glm::uvec2(UV * double(Tiles)), glm::uvec2(Tiles - 1u));
+
+				needed.insert(GR::TerrainCache::TileKey(Face, Depth, Tile.x, Tile.y));
+			}
+		}
+
+		bool complete = true;
+		for (uint64_t tile : needed)
+		{
+			auto resident = m_TerrainTileResident.find(tile);
+			if (resident != m_TerrainTileResident.end())
+			{
+				m_TerrainTileSlotUse[resident->second].second = m_TerrainTileFrame;
+				continue;
+			}
+
+			// least recently needed slot, which none of the levels asked for in this frame
+			uint32_t slot = UINT32_MAX;
+			for (uint32_t i = 0; i < TerrainTileSlots && jobs.size() < TerrainTileBudget; i++)
+			{
+				if (m_TerrainTileSlotUse[i].second < m_TerrainTileFrame && (slot == UINT32_MAX || m_TerrainTileSlotUse[i].second < m_TerrainTileSlotUse[slot].second))
+					slot = i;
+			}
+
+			if (slot == UINT32_MAX)
+			{
+				complete = false;
+				continue;
+			}
+
+			if (m_TerrainTileSlotUse[slot].first != UINT64_MAX)
+				m_TerrainTileResident.erase(m_TerrainTileSlotUse[slot].first);
+
+			m_TerrainTileSlotUse[slot] = { tile, m_TerrainTileFrame };
+			m_TerrainTileResident[tile] = slot;
+			m_TerrainTileTableDirty = true;
+
+			uint16_t* heights = reinterpret_cast<uint16_t*>(stagingMemory + sizeof(uint32_t) * TileWords * jobs.size());
+			jobs.push_back({ tile, slot, !m_TerrainCache->Load(tile, heights) });
+		}
+
+		outTileLevel[level] = complete ? Depth : -1;
+	}
+
+	// previous frames may still read the table and the slots being replaced
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	if (m_TerrainTileTableDirty)
+	{
+		// linear probing, same as FetchTileHeight in terrain_noise
+		std::vector<glm::uvec4> table(TableSize, glm::uvec4(UINT32_MAX));
+		for (auto it = m_TerrainTileResident.begin(); it != m_TerrainTileResident.end();)
+		{
+			const uint32_t Hash = GR::TerrainCache::TileHash(it->first);
+
+			uint32_t probe = 0;
+			while (probe < TerrainTileProbes && table[(Hash + probe) % TableSize].x != UINT32_MAX)
+				probe++;
+
+			if (probe < TerrainTileProbes)
+			{
+				table[(Hash + probe) % TableSize] = glm::uvec4(uint32_t(it->first), uint32_t(it->first >> 32u), it->second, 0u);
+				it++;
+				continue;
+			}
+
+			// tile can't be reached by the shader, so levels of its depth fall back to noise
+			const int32_t Depth = static_cast<int32_t>((uint32_t(it->first) >> 8u) & 0xFFu);
+			std::replace(outTileLevel.begin(), outTileLevel.end(), Depth, -1);
+
+			m_TerrainTileSlotUse[it->second] = { UINT64_MAX, 0u };
+			it = m_TerrainTileResident.erase(it);
+		}
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+		m_TerrainTileTable->Update(cmd, table.data(), sizeof(glm::uvec4) * table.size());
+		m_TerrainTileTableDirty = false;
+
+		if (jobs.empty())
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+		}
+	}
+
+	if (jobs.empty())
+		return;
+
+	// loaded tiles were written through the mapping
+	staging.Flush();
+
+	m_UBOTempSets[m_ResourceIndex]->BindSet(0, cmd, *m_TerrainTileCompute);
+	m_TerrainTileSet[m_ResourceIndex]->BindSet(1, cmd, *m_TerrainTileCompute);
+	m_TerrainTileCompute->BindPipeline(cmd);
+
+	std::vector<VkBufferImageCopy> regions(jobs.size());
+	for (uint32_t i = 0; i < jobs.size(); i++)
+	{
+		regions[i].bufferOffset = sizeof(uint32_t) * TileWords * i;
+		regions[i].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, jobs[i].Slot, 1 };
+		regions[i].imageExtent = { TileExtent, TileExtent, 1 };
+
+		if (!jobs[i].Generate)
+			continue;
+
+		struct
+		{
+			int32_t Face;
+			int32_t Level;
+			glm::uvec2 Tile;
+			uint32_t Offset;
+			float Spacing;
+		} TileConstants;
+
+		TileConstants.Face = static_cast<int32_t>(uint32_t(jobs[i].Tile) & 0xFFu);
+		TileConstants.Level = static_cast<int32_t>((uint32_t(jobs[i].Tile) >> 8u) & 0xFFu);
+		TileConstants.Tile = glm::uvec2(uint32_t(jobs[i].Tile >> 32u) & 0xFFFFu, uint32_t(jobs[i].Tile >> 48u));
+		TileConstants.Offset = TileWords * i;
+		TileConstants.Spacing = 2.f * Rg / float((1u << TileConstants.Level) * TerrainTileSize);
+
+		m_TerrainTileCompute->PushConstants(cmd, &TileConstants, sizeof(TileConstants), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		vkCmdDispatch(cmd, TileWords / 64 + static_cast<uint32_t>(TileWords % 64 > 0), 1, 1);
+
+		readback.push_back({ jobs[i].Tile, i });
+	}
+
+	barrier.dstAccessMask |= VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	vkCmdCopyBufferToImage(cmd, staging.GetBuffer(), m_TerrainTiles.Image->GetImage(), VK_IMAGE_LAYOUT_GENERAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+}
@@ -35,16 +35,20 @@ VkBool32 VulkanBase::volumetric_precompute()
 	VkSampler SamplerClamp = m_Scope.GetSampler(ESamplerType::BillinearClamp, 1);
 
 	// m_Volumetrics = std::make_unique<GraphicsObject>();
-	m_VolumetricsDescriptor = DescriptorSetDescriptor()
-		.AddUniformBuffer(0, VK_SHADER_STAGE_COMPUTE_BIT, *m_CloudLayer)
-		.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeShape.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeShape.View->GetSubresourceRange().levelCount))
-		.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeDetail.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeDetail.View->GetSubresourceRange().levelCount))
-		.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeWeather.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeather.View->GetSubresourceRange().levelCount))
-		.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT.View->GetImageView(), SamplerClamp)
-		.AddImageSampler(5, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT.View->GetImageView(), SamplerClamp)
-		.AddImageSampler(6, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT.View->GetImageView(), SamplerClamp)
-		.AddImageSampler(7, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeWeatherCube.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeatherCube.View->GetSubresourceRange().levelCount))
-		.Allocate(m_Scope);
+	m_VolumetricsDescriptors.resize(m_TransmittanceLUT.size());
+	for (size_t i = 0; i < m_VolumetricsDescriptors.size(); i++)
+	{
+		m_VolumetricsDescriptors[i] = DescriptorSetDescriptor()
+			.AddUniformBuffer(0, VK_SHADER_STAGE_COMPUTE_BIT, *m_CloudLayer)
+			.AddImageSampler(1, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeShape.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeShape.View->GetSubresourceRange().levelCount))
+			.AddImageSampler(2, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeDetail.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeDetail.View->GetSubresourceRange().levelCount))
+			.AddImageSampler(3, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeWeather.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeather.View->GetSubresourceRange().levelCount))
+			.AddImageSampler(4, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLUT[i].View->GetImageView(), SamplerClamp)
+			.AddImageSampler(5, VK_SHADER_STAGE_COMPUTE_BIT, m_IrradianceLUT[i].View->GetImageView(), SamplerClamp)
+			.AddImageSampler(6, VK_SHADER_STAGE_COMPUTE_BIT, m_ScatteringLUT[i].View->GetImageView(), SamplerClamp)
+			.AddImageSampler(7, VK_SHADER_STAGE_COMPUTE_BIT, m_VolumeWeatherCube.View->GetImageView(), m_Scope.GetSampler(ESamplerType::BillinearRepeat, m_VolumeWeatherCube.View->GetSubresourceRange().levelCount))
+			.Allocate(m_Scope);
+	}
 
 	VkDescriptorSetLayout dummy;
 	CreateDescriptorLayout(m_Scope.GetDevice(), { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE , VK_DESCRIPTOR_TYPE_STORAGE_IMAGE , VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER }, VK_SHADER_STAGE_COMPUTE_BIT, &dummy);
@@ -55,7 +59,7 @@ VkBool32 VulkanBase::volumetric_precompute()
 
 	ComputePipelineDescriptor VolumetricPSO{};
 	VolumetricPSO.AddDescriptorLayout(m_UBOSets[0]->GetLayout())
-		.AddDescriptorLayout(m_VolumetricsDescriptor->GetLayout())
+		.AddDescriptorLayout(m_VolumetricsDescriptors[0]->GetLayout())
 		.AddDescriptorLayout(dummy)
 		.AddPushConstant(ConstantOrder)
 		.AddSpecializationConstant(0, Rg)
@@ -299,7 +299,7 @@ RenderScope& RenderScope::CreateCubemapRenderPass()
 	VkRenderPassCreateInfo createInfo{};
 	std::array<VkAttachmentDescription, 1> attachments;
 
-	attachments[0].format = GetHDRFormat();
+	attachments[0].format = GetBRDFFormat();
 	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -352,7 +352,7 @@ RenderScope& RenderScope::CreateSimpleRenderPass()
 	VkRenderPassCreateInfo createInfo{};
 	std::array<VkAttachmentDescription, 1> attachments;
 
-	attachments[0].format = GetHDRFormat();
+	attachments[0].format = GetBRDFFormat();
 	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -647,4 +647,25 @@ const VkSampler RenderScope::GetSampler(ESamplerType Type, uint32_t Mips) const
 	vkCreateSampler(m_LogicalDevice, &samplerInfo, VK_NULL_HANDLE, &sampler);
 
 	return m_Samplers.emplace_back(std::tuple(Type, Mips, sampler))._Get_rest()._Get_rest()._Myfirst._Val;
-}
\ No newline at end of file
+}
+
+const VkFormat RenderScope::GetBRDFFormat() const
+{
+	return GetSupportedFormat({ VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16_SFLOAT }, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+}
+
+const VkFormat RenderScope::GetSupportedFormat(const std::vector<VkFormat>& candidates, VkFormatFeatureFlags features) const
+{
+	for (VkFormat format : candidates)
+	{
+		VkFormatProperties properties{};
+		vkGetPhysicalDeviceFormatProperties(m_PhysicalDevice, format, &properties);
+
+		if ((properties.optimalTilingFeatures & features) == features)
+		{
+			return format;
+		}
+	}
+
+	return candidates.back();
+}
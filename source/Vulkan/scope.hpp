@@ -83,6 +83,12 @@ public:
 	inline const VkFormat GetColorFormat() const { return VK_FORMAT_B8G8R8A8_SRGB; };
 
 	inline const VkFormat GetDepthFormat() const { return VK_FORMAT_D32_SFLOAT; };
+	// sky cubemap and its specular and diffuse convolutions, written as storage images
+	inline const VkFormat GetIBLFormat() const { return VK_FORMAT_R16G16B16A16_SFLOAT; };
+	// split sum scale and bias, both are in [0, 1]
+	const VkFormat GetBRDFFormat() const;
+	// first of the candidates supporting all of the features with optimal tiling, the last one otherwise
+	const VkFormat GetSupportedFormat(const std::vector<VkFormat>& candidates, VkFormatFeatureFlags features) const;
 
 	inline const uint32_t& GetMaxFramesInFlight() const { return m_FramesInFlight; };
 
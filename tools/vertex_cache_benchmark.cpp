@@ -0,0 +1,181 @@
+#include "pch.hpp"
+#include "Engine/utils.hpp"
+#include "Vulkan/mesh.hpp"
+#include <assimp/scene.h>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <cstdio>
+
+/*
+* Reports post-transform cache efficiency of generated and imported meshes before and after the optimization pass shapes run by default
+*
+* usage: vertex_cache_benchmark [model files...]
+*/
+
+struct BenchmarkMesh
+{
+	std::string name;
+	std::vector<MeshVertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+// same lattice and winding as Shapes::Plane
+static BenchmarkMesh make_grid(uint32_t splits)
+{
+	const uint32_t n = splits + 2;
+	BenchmarkMesh mesh = { "plane " + std::to_string(splits) + " splits" };
+	mesh.vertices.resize(n * n);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		for (uint32_t j = 0; j < n; j++)
+		{
+			mesh.vertices[i * n + j].position = glm::vec3(float(i) / float(n - 1) - 0.5f, 0.0, float(j) / float(n - 1) - 0.5f);
+		}
+	}
+
+	for (uint32_t i = 0; i < n - 1; i++)
+	{
+		for (uint32_t j = 0; j < n - 1; j++)
+		{
+			const uint32_t k1 = i * n + j;
+			const uint32_t k2 = k1 + n;
+			mesh.indices.insert(mesh.indices.end(), { k1 + 1, k2, k1, k2 + 1, k2, k1 + 1 });
+		}
+	}
+
+	return mesh;
+}
+
+// same rings, slices and triangle order as Shapes::Sphere
+static BenchmarkMesh make_sphere(uint32_t rings, uint32_t slices)
+{
+	BenchmarkMesh mesh = { "sphere " + std::to_string(rings) + "x" + std::to_string(slices) };
+	auto triangle = [&mesh](uint32_t a, uint32_t b, uint32_t c)
+	{
+		mesh.indices.insert(mesh.indices.end(), { a, b, c });
+	};
+
+	mesh.vertices.push_back({});
+	mesh.vertices.back().position = glm::vec3(0.0, 0.0, 1.0);
+	for (uint32_t i = 1; i < rings; i++)
+	{
+		const double phi = glm::pi<double>() * double(i) / double(rings);
+		for (uint32_t j = 0; j < slices; j++)
+		{
+			const double theta = glm::two_pi<double>() * double(j) / double(slices);
+			mesh.vertices.push_back({});
+			mesh.vertices.back().position = glm::vec3(glm::cos(theta) * glm::sin(phi), glm::sin(theta) * glm::sin(phi), glm::cos(phi));
+		}
+	}
+	mesh.vertices.push_back({});
+	mesh.vertices.back().position = glm::vec3(0.0, 0.0, -1.0);
+
+	for (uint32_t j = 0; j < slices; j++)
+	{
+		triangle(0, j + 1, (j + 1) % slices + 1);
+	}
+
+	for (uint32_t i = 0; i < rings - 2; i++)
+	{
+		const uint32_t top = i * slices + 1;
+		const uint32_t bottom = top + slices;
+
+		for (uint32_t j = 0; j < slices; j++)
+		{
+			const uint32_t next = (j + 1) % slices;
+			triangle(bottom + j, bottom + next, top + next);
+			triangle(bottom + j, top + next, top + j);
+		}
+	}
+
+	const uint32_t last = static_cast<uint32_t>(mesh.vertices.size()) - 1;
+	const uint32_t ring = last - slices;
+	for (uint32_t j = slices - 1; j > 0; j--)
+	{
+		triangle(last, ring + j, ring + j - 1);
+	}
+	triangle(last, ring, ring + slices - 1);
+
+	return mesh;
+}
+
+// all submeshes of the model in one list, shared vertices are joined the way a deduplicated import would have them
+static bool load_model(const std::string& path, BenchmarkMesh& mesh)
+{
+	Assimp::Importer importer;
+	const aiScene* model = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+	if (!model)
+		return false;
+
+	mesh.name = path;
+	for (uint32_t m = 0; m < model->mNumMeshes; m++)
+	{
+		const aiMesh* source = model->mMeshes[m];
+		const uint32_t base = static_cast<uint32_t>(mesh.vertices.size());
+
+		for (uint32_t v = 0; v < source->mNumVertices; v++)
+		{
+			mesh.vertices.push_back({});
+			mesh.vertices.back().position = glm::vec3(source->mVertices[v].x, source->mVertices[v].y, source->mVertices[v].z);
+		}
+
+		for (uint32_t f = 0; f < source->mNumFaces; f++)
+		{
+			if (source->mFaces[f].mNumIndices != 3)
+				continue;
+
+			mesh.indices.insert(mesh.indices.end(), { base + source->mFaces[f].mIndices[0], base + source->mFaces[f].mIndices[1], base + source->mFaces[f].mIndices[2] });
+		}
+	}
+
+	return !mesh.indices.empty();
+}
+
+// same passes as optimize_mesh of the shapes, timed together
+static void report(BenchmarkMesh& mesh)
+{
+	const GR::Utils::VertexCacheStats before = GR::Utils::AnalyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+
+	const auto start = std::chrono::steady_clock::now();
+	GR::Utils::OptimizeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	GR::Utils::OptimizeOverdraw(mesh.indices.data(), mesh.indices.size(), &mesh.vertices[0].position.x, sizeof(MeshVertex), mesh.vertices.size());
+	GR::Utils::OptimizeVertexFetch(mesh.vertices, mesh.indices);
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	const GR::Utils::VertexCacheStats after = GR::Utils::AnalyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+
+	printf("%-32s %8zu %8zu   %5.3f -> %5.3f   %5.3f -> %5.3f %10.2f\n", mesh.name.c_str(), mesh.vertices.size(), mesh.indices.size() / 3,
+		before.ACMR, after.ACMR, before.ATVR, after.ATVR, ms);
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<BenchmarkMesh> meshes;
+	meshes.push_back(make_grid(62));
+	meshes.push_back(make_grid(254));
+	meshes.push_back(make_sphere(16, 16));
+	meshes.push_back(make_sphere(64, 64));
+	meshes.push_back(make_sphere(256, 256));
+
+	for (int i = 1; i < argc; i++)
+	{
+		BenchmarkMesh mesh;
+		if (load_model(argv[i], mesh))
+		{
+			meshes.push_back(std::move(mesh));
+		}
+		else
+		{
+			fprintf(stderr, "failed to load %s\n", argv[i]);
+		}
+	}
+
+	printf("%-32s %8s %8s   %-14s   %-14s %10s\n", "mesh", "vertices", "tris", "ACMR", "ATVR", "ms");
+	for (BenchmarkMesh& mesh : meshes)
+	{
+		report(mesh);
+	}
+
+	return 0;
+}